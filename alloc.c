@@ -0,0 +1,449 @@
+#include <pthread.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#include "xlib.h"
+
+static void *
+libc_alloc(void *ctx, size_t size) {
+    (void)ctx;
+    return malloc(size);
+}
+
+static void *
+libc_realloc(void *ctx, void *p, size_t size) {
+    (void)ctx;
+    return realloc(p, size);
+}
+
+static void
+libc_free(void *ctx, void *p) {
+    (void)ctx;
+    free(p);
+}
+
+Allocator mem_libc = { libc_alloc, libc_realloc, libc_free, NULL, NULL };
+Allocator *mem_allocator = &mem_libc;
+__thread Allocator *mem_thread_allocator = NULL;
+
+void
+mem_set_allocator(Allocator *a) {
+    mem_allocator = a ? a : &mem_libc;
+}
+
+Allocator *
+mem_use_allocator(Allocator *a) {
+    Allocator *old = mem_thread_allocator;
+    mem_thread_allocator = a;
+    return old;
+}
+
+void
+mem_release(Allocator *a) {
+    if (a->release)
+        a->release(a->ctx);
+}
+
+void *
+mem_calloc(Allocator *a, size_t n, size_t size) {
+    void *p;
+    if (size && n > SSIZE_T_MAX / size)
+        return NULL;
+    p = Mem_AMALLOC(a, n * size);
+    if (p != NULL)
+        memset(p, 0, n * size);
+    return p;
+}
+
+char *
+mem_strdup(Allocator *a, const char *s) {
+    size_t len = strlen(s) + 1;
+    char *copy = (char *)Mem_AMALLOC(a, len);
+    if (copy != NULL)
+        memcpy(copy, s, len);
+    return copy;
+}
+
+void
+mem_free(void *p) {
+    Mem_FREE(p);
+}
+
+/* every piece has its size in front of it for realloc, the union keeps
+   pieces as aligned as malloc's */
+typedef union {
+    size_t size;
+    long double align1;
+    void *align2;
+} ArenaHeader;
+
+#define ARENA_ROUND(n) (((n) + sizeof(ArenaHeader) - 1) \
+                        / sizeof(ArenaHeader) * sizeof(ArenaHeader))
+
+typedef struct _arenablock {
+    struct _arenablock *next;
+    size_t size;  /* # bytes for pieces */
+    size_t used;
+} ArenaBlock;
+
+#define ARENA_DATA(b) ((char *)(b) + ARENA_ROUND(sizeof(ArenaBlock)))
+
+typedef struct {
+    Allocator base;  /* first, so an Arena * is its Allocator * */
+    ArenaBlock *blocks;  /* the one pieces are taken from first */
+    size_t blocksize;
+} Arena;
+
+static void *
+arena_alloc(void *ctx, size_t size) {
+    Arena *ar = (Arena *)ctx;
+    ArenaBlock *b = ar->blocks;
+    ArenaHeader *head;
+    size_t bsize, need;
+    if (size > SSIZE_T_MAX / 2)
+        return NULL;
+    need = sizeof(ArenaHeader) + ARENA_ROUND(size);
+    if (b == NULL || b->size - b->used < need) {
+        bsize = need > ar->blocksize ? need : ar->blocksize;
+        b = (ArenaBlock *)malloc(ARENA_ROUND(sizeof(ArenaBlock)) + bsize);
+        if (b == NULL)
+            return NULL;
+        b->size = bsize;
+        b->used = 0;
+        /* a piece bigger than a block gets one of its own, kept behind
+           the current block so that its room isn't lost */
+        if (ar->blocks != NULL && bsize > ar->blocksize) {
+            b->next = ar->blocks->next;
+            ar->blocks->next = b;
+        } else {
+            b->next = ar->blocks;
+            ar->blocks = b;
+        }
+    }
+    head = (ArenaHeader *)(ARENA_DATA(b) + b->used);
+    b->used += need;
+    head->size = size;
+    return (void *)(head + 1);
+}
+
+static void *
+arena_realloc(void *ctx, void *p, size_t size) {
+    void *q;
+    size_t old;
+    if (p == NULL)
+        return arena_alloc(ctx, size);
+    old = ((ArenaHeader *)p - 1)->size;
+    if (size <= old)
+        return p;
+    if ((q = arena_alloc(ctx, size)) != NULL)
+        memcpy(q, p, old);
+    return q;
+}
+
+static void
+arena_free(void *ctx, void *p) {
+    (void)ctx;
+    (void)p;
+}
+
+static void
+arena_release(void *ctx) {
+    Arena *ar = (Arena *)ctx;
+    ArenaBlock *b, *next;
+    for (b = ar->blocks; b != NULL; b = next) {
+        next = b->next;
+        free(b);
+    }
+    ar->blocks = NULL;
+}
+
+Allocator *
+mem_arena_new(size_t blocksize) {
+    Arena *ar = (Arena *)malloc(sizeof(Arena));
+    if (ar == NULL)
+        return NULL;
+    ar->base.alloc = arena_alloc;
+    ar->base.realloc = arena_realloc;
+    ar->base.free = arena_free;
+    ar->base.release = arena_release;
+    ar->base.ctx = ar;
+    ar->blocks = NULL;
+    ar->blocksize = blocksize ? blocksize : 1 << 20;
+    return &ar->base;
+}
+
+void
+mem_arena_free(Allocator *a) {
+    mem_release(a);
+    free(a);
+}
+
+/* the kernel's, numaif.h isn't always there */
+#define HUGE_MPOL_BIND 2
+#define HUGE_MPOL_INTERLEAVE 3
+#define HUGE_MPOL_F_MEMS_ALLOWED (1 << 2)
+#define HUGE_MAXNODE 1024
+
+typedef struct _hugepiece {
+    struct _hugepiece *prev, *next;  /* the live mappings */
+    char *base;  /* of the mapping, NULL if malloc'ed */
+    size_t maplen;
+    size_t size;  /* # usable bytes */
+} HugePiece;
+
+/* in front of every piece, as aligned as malloc's */
+typedef union {
+    HugePiece piece;
+    long double align1;
+    void *align2;
+} HugeHeader;
+
+typedef struct {
+    Allocator base;  /* first, so a HugeAllocator * is its Allocator * */
+    pthread_mutex_t lock;
+    HugePiece live;  /* sentinel of the mappings' ring */
+    size_t threshold;
+    size_t hugepage;
+    size_t page;
+    int policy;  /* MemNumaPolicy */
+    unsigned long nodes[HUGE_MAXNODE / (8 * sizeof(unsigned long))];
+    size_t maps, mapped, advise_failed, bind_failed;
+} HugeAllocator;
+
+#define HUGE_HEAD(p) (&((HugeHeader *)(p) - 1)->piece)
+
+static void *
+huge_malloc(size_t size) {
+    HugeHeader *h;
+    if (size > SSIZE_T_MAX - sizeof(HugeHeader))
+        return NULL;
+    h = (HugeHeader *)malloc(sizeof(HugeHeader) + size);
+    if (h == NULL)
+        return NULL;
+    h->piece.base = NULL;
+    h->piece.size = size;
+    return (void *)(h + 1);
+}
+
+#ifdef __linux__
+/* a mapping starting a header before a huge page boundary, its length
+   rounded up to huge pages so that the last one can be huge too */
+static void *
+huge_map(HugeAllocator *ha, size_t size) {
+    size_t len, total;
+    char *raw, *p, *base, *end;
+    HugePiece *h;
+    if (size > SSIZE_T_MAX / 2)
+        return NULL;
+    len = (size + ha->hugepage - 1) / ha->hugepage * ha->hugepage;
+    total = len + ha->hugepage + ha->page;
+    raw = (char *)mmap(NULL, total, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == (char *)MAP_FAILED)
+        return NULL;
+    p = (char *)(((uintptr_t)raw + sizeof(HugeHeader) + ha->hugepage - 1)
+                 & ~(uintptr_t)(ha->hugepage - 1));
+    base = (char *)((uintptr_t)(p - sizeof(HugeHeader))
+                    & ~(uintptr_t)(ha->page - 1));
+    end = p + len;
+    if (base > raw)
+        munmap(raw, base - raw);
+    if (raw + total > end)
+        munmap(end, raw + total - end);
+    h = HUGE_HEAD(p);
+    h->base = base;
+    h->maplen = end - base;
+    h->size = len;
+    pthread_mutex_lock(&ha->lock);
+#ifdef MADV_HUGEPAGE
+    if (madvise(p, len, MADV_HUGEPAGE) != 0)
+        ha->advise_failed++;
+#else
+    ha->advise_failed++;
+#endif
+#ifdef SYS_mbind
+    if (ha->policy != MEM_NUMA_LOCAL
+        && syscall(SYS_mbind, base, h->maplen,
+                   ha->policy == MEM_NUMA_BIND ? HUGE_MPOL_BIND : HUGE_MPOL_INTERLEAVE,
+                   ha->nodes, (unsigned long)HUGE_MAXNODE, 0) != 0)
+        ha->bind_failed++;
+#else
+    if (ha->policy != MEM_NUMA_LOCAL)
+        ha->bind_failed++;
+#endif
+    h->prev = &ha->live;
+    h->next = ha->live.next;
+    ha->live.next->prev = h;
+    ha->live.next = h;
+    ha->maps++;
+    ha->mapped += h->maplen;
+    pthread_mutex_unlock(&ha->lock);
+    return (void *)p;
+}
+#endif
+
+static void *
+huge_alloc(void *ctx, size_t size) {
+    HugeAllocator *ha = (HugeAllocator *)ctx;
+#ifdef __linux__
+    if (size >= ha->threshold)
+        return huge_map(ha, size);
+#else
+    (void)ha;
+#endif
+    return huge_malloc(size);
+}
+
+static void
+huge_free(void *ctx, void *p) {
+    HugeAllocator *ha = (HugeAllocator *)ctx;
+    HugePiece *h;
+    if (p == NULL)
+        return;
+    h = HUGE_HEAD(p);
+    if (h->base == NULL) {
+        free((HugeHeader *)p - 1);
+        return;
+    }
+#ifdef __linux__
+    pthread_mutex_lock(&ha->lock);
+    h->prev->next = h->next;
+    h->next->prev = h->prev;
+    ha->maps--;
+    ha->mapped -= h->maplen;
+    pthread_mutex_unlock(&ha->lock);
+    munmap(h->base, h->maplen);
+#endif
+}
+
+static void *
+huge_realloc(void *ctx, void *p, size_t size) {
+    HugeAllocator *ha = (HugeAllocator *)ctx;
+    HugePiece *h;
+    HugeHeader *nh;
+    void *q;
+    if (p == NULL)
+        return huge_alloc(ctx, size);
+    h = HUGE_HEAD(p);
+    if (h->base == NULL && size < ha->threshold) {
+        if (size > SSIZE_T_MAX - sizeof(HugeHeader))
+            return NULL;
+        nh = (HugeHeader *)realloc((HugeHeader *)p - 1, sizeof(HugeHeader) + size);
+        if (nh == NULL)
+            return NULL;
+        nh->piece.size = size;
+        return (void *)(nh + 1);
+    }
+    if (h->base != NULL && size >= ha->threshold && size <= h->size)
+        return p;
+    if ((q = huge_alloc(ctx, size)) == NULL)
+        return NULL;
+    memcpy(q, p, h->size < size ? h->size : size);
+    huge_free(ctx, p);
+    return q;
+}
+
+#ifdef __linux__
+/* the hugepage size THP uses, 2MB on x86-64 */
+static size_t
+huge_pagesize(void) {
+    FILE *fp = fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r");
+    unsigned long size = 0;
+    if (fp != NULL) {
+        if (fscanf(fp, "%lu", &size) != 1)
+            size = 0;
+        fclose(fp);
+    }
+    if (size == 0 || (size & (size - 1)))
+        size = 1 << 21;
+    return (size_t)size;
+}
+#endif
+
+Allocator *
+mem_huge_new(size_t threshold, MemNumaPolicy policy, int node) {
+    HugeAllocator *ha = (HugeAllocator *)malloc(sizeof(HugeAllocator));
+    if (ha == NULL)
+        return NULL;
+    assert(policy != MEM_NUMA_BIND || (node >= 0 && node < HUGE_MAXNODE));
+    ha->base.alloc = huge_alloc;
+    ha->base.realloc = huge_realloc;
+    ha->base.free = huge_free;
+    ha->base.release = NULL;
+    ha->base.ctx = ha;
+    pthread_mutex_init(&ha->lock, NULL);
+    ha->live.prev = ha->live.next = &ha->live;
+    ha->threshold = threshold ? threshold : 1 << 23;
+    ha->policy = policy;
+    ha->maps = ha->mapped = ha->advise_failed = ha->bind_failed = 0;
+    memset(ha->nodes, 0, sizeof(ha->nodes));
+#ifdef __linux__
+    ha->hugepage = huge_pagesize();
+    ha->page = (size_t)sysconf(_SC_PAGESIZE);
+    if (policy == MEM_NUMA_BIND)
+        ha->nodes[node / (8 * sizeof(unsigned long))] =
+            1UL << (node % (8 * sizeof(unsigned long)));
+#ifdef SYS_get_mempolicy
+    /* interleave over the nodes this process may use */
+    else if (policy == MEM_NUMA_INTERLEAVE
+             && syscall(SYS_get_mempolicy, NULL, ha->nodes,
+                        (unsigned long)HUGE_MAXNODE, NULL,
+                        HUGE_MPOL_F_MEMS_ALLOWED) != 0)
+        memset(ha->nodes, 0, sizeof(ha->nodes));
+#endif
+#else
+    ha->hugepage = ha->page = 0;
+#endif
+    return &ha->base;
+}
+
+void
+mem_huge_free(Allocator *a) {
+    HugeAllocator *ha = (HugeAllocator *)a->ctx;
+    assert(ha->live.next == &ha->live);
+    pthread_mutex_destroy(&ha->lock);
+    free(ha);
+}
+
+int
+mem_huge_stats(Allocator *a, MemHugeStats *st) {
+    HugeAllocator *ha = (HugeAllocator *)a->ctx;
+    int ret = -1;
+#ifdef __linux__
+    FILE *fp;
+    char line[256];
+    unsigned long start, end;
+    size_t kb;
+    int in = 0;
+    HugePiece *h;
+#endif
+    pthread_mutex_lock(&ha->lock);
+    st->maps = ha->maps;
+    st->mapped = ha->mapped;
+    st->advise_failed = ha->advise_failed;
+    st->bind_failed = ha->bind_failed;
+    st->huge = 0;
+#ifdef __linux__
+    /* sum AnonHugePages over the VMAs holding our mappings, neighbouring
+       mappings with the same flags may share a VMA */
+    if ((fp = fopen("/proc/self/smaps", "r")) != NULL) {
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+                in = 0;
+                for (h = ha->live.next; h != &ha->live && !in; h = h->next)
+                    in = (uintptr_t)h->base < end
+                         && (uintptr_t)h->base + h->maplen > start;
+            } else if (in && sscanf(line, "AnonHugePages: %zu kB", &kb) == 1)
+                st->huge += kb * 1024;
+        }
+        fclose(fp);
+        if (st->huge > st->mapped)
+            st->huge = st->mapped;
+        ret = 0;
+    }
+#endif
+    pthread_mutex_unlock(&ha->lock);
+    return ret;
+}
@@ -0,0 +1,78 @@
+/* Where memory comes from. alloc, realloc and free work like malloc's on
+behalf of ctx, free must take NULL. release, if not NULL, frees all that
+alloc gave at once, e.g. for an arena; nothing made with the allocator
+may be used afterwards. */
+typedef struct {
+    void *(*alloc)(void *ctx, size_t size);
+    void *(*realloc)(void *ctx, void *p, size_t size);
+    void (*free)(void *ctx, void *p);
+    void (*release)(void *ctx);
+    void *ctx;
+} Allocator;
+
+/* malloc, realloc and free */
+extern Allocator mem_libc;
+
+/* The process wide allocator, behind the Mem_* macros and the default
+key and value callbacks of the containers. Set it with mem_set_allocator
+before anything is made. */
+extern Allocator *mem_allocator;
+/* this thread's allocator for new containers, NULL means mem_allocator */
+extern __thread Allocator *mem_thread_allocator;
+
+#define MEM_CONTAINER_ALLOCATOR() \
+    (mem_thread_allocator ? mem_thread_allocator : mem_allocator)
+
+void mem_set_allocator(Allocator *a);
+/* The containers (dicts, sets, lists, rbtrees and clists) made by this
+thread from now on take their structs, tables and nodes from @a, NULL
+for mem_allocator, and keep it for life, as do the list key index and
+the scratch of the partitioned set ops and of dict_merge_many. The
+*_anew constructors take one explicitly instead. Returns the previous
+one. */
+Allocator *mem_use_allocator(Allocator *a);
+void mem_release(Allocator *a);
+
+void *mem_calloc(Allocator *a, size_t n, size_t size);
+char *mem_strdup(Allocator *a, const char *s);
+/* free with mem_allocator, e.g. the keys handed out by the pop functions
+of containers with the default callbacks */
+void mem_free(void *p);
+
+/* A bump allocator taking @blocksize bytes at a time from malloc.
+free is a no-op and mem_release drops every block, so it suits the
+containers of a shard that are built, used and thrown away together.
+Not thread safe. */
+Allocator *mem_arena_new(size_t blocksize);
+void mem_arena_free(Allocator *a);
+
+/* where mem_huge_new's mappings live on a multi-socket box */
+typedef enum {
+    MEM_NUMA_LOCAL,  /* the kernel's default, the node that first touches */
+    MEM_NUMA_INTERLEAVE,  /* pages spread round robin over all nodes */
+    MEM_NUMA_BIND  /* all pages on one node */
+} MemNumaPolicy;
+
+typedef struct {
+    size_t maps;  /* # live pieces that got a mapping of their own */
+    size_t mapped;  /* # bytes of those mappings */
+    size_t huge;  /* # of those bytes the kernel backs with huge pages */
+    size_t advise_failed;  /* # mappings refused MADV_HUGEPAGE */
+    size_t bind_failed;  /* # mappings refused the NUMA policy */
+} MemHugeStats;
+
+/* Pieces of at least @threshold bytes (0 for 8MB), i.e. big tables, get
+a mapping of their own aligned to huge pages and advised to be backed by
+transparent huge pages, so that a probe no longer costs a TLB miss, and
+placed by @policy (@node is for MEM_NUMA_BIND). Smaller pieces come from
+malloc. Thread safe. Off Linux it is plain malloc. Give it to the
+*_anew constructors or mem_use_allocator for the big containers. */
+Allocator *mem_huge_new(size_t threshold, MemNumaPolicy policy, int node);
+/* after everything it gave has been freed */
+void mem_huge_free(Allocator *a);
+/* Whether huge pages were actually obtained: the kernel only hands them
+out when pages are first touched, and may not at all (THP disabled or
+memory fragmented), so @st->huge is read from /proc/self/smaps at the
+time of the call. Returns -1 if it can't be read, the rest of @st is
+still filled. */
+int mem_huge_stats(Allocator *a, MemHugeStats *st);
@@ -0,0 +1,908 @@
+#include "xlib.h"
+
+enum { OP_AND, OP_OR, OP_SUB, OP_XOR };
+
+#define BIT_HAS(words, v) ((words)[(v) >> 6] >> ((v) & 63) & 1)
+#define BIT_MASK(v) ((uint64_t)1 << ((v) & 63))
+
+/* Word kernels of bitmap containers. There is a scalar version and, on
+   x86, an AVX2 one picked at runtime, which does 256 bits per step.
+*/
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define BITMAP_SIMD
+#include <immintrin.h>
+#endif
+
+static int
+bits_use_avx2(void) {
+    static int avx2 = -1;
+    if (avx2 == -1) {
+#ifdef BITMAP_SIMD
+        __builtin_cpu_init();
+        avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+#else
+        avx2 = 0;
+#endif
+    }
+    return avx2;
+}
+
+/* out = a op b, @out may be @a. Returns the # bits of out. */
+static uint32_t
+bits_op_scalar(int op, uint64_t *out, const uint64_t *a, const uint64_t *b) {
+    size_t i;
+    uint32_t card = 0;
+    for (i = 0; i < BITMAP_WORDS; i++) {
+        uint64_t w = op == OP_AND ? a[i] & b[i] :
+                     op == OP_OR ? a[i] | b[i] :
+                     op == OP_SUB ? a[i] & ~b[i] : a[i] ^ b[i];
+        out[i] = w;
+        card += __builtin_popcountll(w);
+    }
+    return card;
+}
+
+static int
+bits_subset_scalar(const uint64_t *a, const uint64_t *b) {
+    size_t i;
+    uint64_t rest = 0;
+    for (i = 0; i < BITMAP_WORDS; i++)
+        rest |= a[i] & ~b[i];
+    return rest == 0;
+}
+
+#ifdef BITMAP_SIMD
+
+#define AVX2 __attribute__((target("avx2,popcnt")))
+
+AVX2 static uint32_t
+bits_op_avx2(int op, uint64_t *out, const uint64_t *a, const uint64_t *b) {
+    size_t i;
+    uint32_t card = 0;
+    for (i = 0; i < BITMAP_WORDS; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i w = op == OP_AND ? _mm256_and_si256(x, y) :
+                    op == OP_OR ? _mm256_or_si256(x, y) :
+                    op == OP_SUB ? _mm256_andnot_si256(y, x) :
+                    _mm256_xor_si256(x, y);
+        _mm256_storeu_si256((__m256i *)(out + i), w);
+        card += _mm_popcnt_u64(_mm256_extract_epi64(w, 0));
+        card += _mm_popcnt_u64(_mm256_extract_epi64(w, 1));
+        card += _mm_popcnt_u64(_mm256_extract_epi64(w, 2));
+        card += _mm_popcnt_u64(_mm256_extract_epi64(w, 3));
+    }
+    return card;
+}
+
+AVX2 static int
+bits_subset_avx2(const uint64_t *a, const uint64_t *b) {
+    size_t i;
+    __m256i rest = _mm256_setzero_si256();
+    for (i = 0; i < BITMAP_WORDS; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+        rest = _mm256_or_si256(rest, _mm256_andnot_si256(y, x));
+    }
+    return _mm256_testz_si256(rest, rest);
+}
+
+#define BITS_CALL(kernel, args) \
+    (bits_use_avx2() ? kernel##_avx2 args : kernel##_scalar args)
+
+#else
+
+#define BITS_CALL(kernel, args) (kernel##_scalar args)
+
+#endif
+
+/* first position of @a whose value >= @v */
+static uint32_t
+array_bisect(const uint16_t *a, uint32_t lo, uint32_t hi, uint16_t v) {
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (a[mid] < v)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* z = x op y for sorted arrays, @z may be @x for OP_AND and OP_SUB since
+   the output never overtakes the input. Returns the # values of z. */
+static uint32_t
+array_merge(int op, const uint16_t *x, uint32_t nx,
+            const uint16_t *y, uint32_t ny, uint16_t *z) {
+    uint32_t i = 0, j = 0, k = 0;
+    if ((op == OP_AND || op == OP_SUB) && (size_t)nx * 32 < ny) {
+        /* a few values against many, bisect instead of walking y */
+        for (; i < nx; i++) {
+            j = array_bisect(y, j, ny, x[i]);
+            if ((j < ny && y[j] == x[i]) == (op == OP_AND))
+                z[k++] = x[i];
+        }
+        return k;
+    }
+    while (i < nx && j < ny) {
+        if (x[i] < y[j]) {
+            if (op != OP_AND)
+                z[k++] = x[i];
+            i++;
+        } else if (x[i] > y[j]) {
+            if (op == OP_OR || op == OP_XOR)
+                z[k++] = y[j];
+            j++;
+        } else {
+            if (op == OP_AND || op == OP_OR)
+                z[k++] = x[i];
+            i++;
+            j++;
+        }
+    }
+    if (op != OP_AND)
+        while (i < nx)
+            z[k++] = x[i++];
+    if (op == OP_OR || op == OP_XOR)
+        while (j < ny)
+            z[k++] = y[j++];
+    return k;
+}
+
+static void
+cont_free(BitmapContainer *c) {
+    Mem_FREE(c->data);
+}
+
+static int
+cont_copy(BitmapContainer *dst, BitmapContainer *src) {
+    *dst = *src;
+    if (src->type == BITMAP_BITS) {
+        dst->data = Mem_NEW(uint64_t, BITMAP_WORDS);
+        if (dst->data == NULL)
+            return -1;
+        memcpy(dst->data, src->data, BITMAP_WORDS * sizeof(uint64_t));
+    } else {
+        dst->capacity = src->card;
+        dst->data = Mem_NEW(uint16_t, src->card);
+        if (dst->data == NULL)
+            return -1;
+        memcpy(dst->data, src->data, src->card * sizeof(uint16_t));
+    }
+    return 0;
+}
+
+static int
+cont_to_bits(BitmapContainer *c) {
+    uint16_t *a = (uint16_t *)c->data;
+    uint64_t *words = Mem_NEW(uint64_t, BITMAP_WORDS);
+    uint32_t i;
+    if (words == NULL)
+        return -1;
+    memset(words, 0, BITMAP_WORDS * sizeof(uint64_t));
+    for (i = 0; i < c->card; i++)
+        words[a[i] >> 6] |= BIT_MASK(a[i]);
+    Mem_FREE(a);
+    c->type = BITMAP_BITS;
+    c->capacity = 0;
+    c->data = words;
+    return 0;
+}
+
+/* a bitmap container that got sparse goes back to an array, on failure
+   it just stays a bitmap */
+static void
+cont_shrink(BitmapContainer *c) {
+    uint64_t *words = (uint64_t *)c->data;
+    uint16_t *a;
+    uint32_t i, k = 0;
+    if (c->type != BITMAP_BITS || c->card == 0 || c->card > BITMAP_ARRAY_MAX)
+        return;
+    a = Mem_NEW(uint16_t, c->card);
+    if (a == NULL)
+        return;
+    for (i = 0; i < BITMAP_WORDS; i++) {
+        uint64_t w = words[i];
+        while (w) {
+            a[k++] = (uint16_t)(i * 64 + __builtin_ctzll(w));
+            w &= w - 1;
+        }
+    }
+    Mem_FREE(words);
+    c->type = BITMAP_ARRAY;
+    c->capacity = c->card;
+    c->data = a;
+}
+
+static int
+cont_has(BitmapContainer *c, uint16_t low) {
+    uint16_t *a;
+    uint32_t i;
+    if (c->type == BITMAP_BITS)
+        return BIT_HAS((uint64_t *)c->data, low);
+    a = (uint16_t *)c->data;
+    i = array_bisect(a, 0, c->card, low);
+    return i < c->card && a[i] == low;
+}
+
+/* returns 1 if @low is new, 0 if it is there already */
+static int
+cont_add(BitmapContainer *c, uint16_t low) {
+    uint16_t *a;
+    uint32_t i;
+    if (c->type == BITMAP_ARRAY) {
+        a = (uint16_t *)c->data;
+        i = array_bisect(a, 0, c->card, low);
+        if (i < c->card && a[i] == low)
+            return 0;
+        if (c->card < BITMAP_ARRAY_MAX) {
+            if (c->card == c->capacity) {
+                uint32_t new_capacity = c->capacity < 64 ? c->capacity * 2 + 4 :
+                                        c->capacity + (c->capacity >> 1);
+                if (new_capacity > BITMAP_ARRAY_MAX)
+                    new_capacity = BITMAP_ARRAY_MAX;
+                Mem_RESIZE(a, uint16_t, new_capacity);
+                if (a == NULL)
+                    return -1;
+                c->data = a;
+                c->capacity = new_capacity;
+            }
+            memmove(a + i + 1, a + i, (c->card - i) * sizeof(uint16_t));
+            a[i] = low;
+            c->card++;
+            return 1;
+        }
+        if (cont_to_bits(c) == -1)
+            return -1;
+    }
+    if (BIT_HAS((uint64_t *)c->data, low))
+        return 0;
+    ((uint64_t *)c->data)[low >> 6] |= BIT_MASK(low);
+    c->card++;
+    return 1;
+}
+
+/* returns 1 if @low was there */
+static int
+cont_discard(BitmapContainer *c, uint16_t low) {
+    uint16_t *a;
+    uint32_t i;
+    if (c->type == BITMAP_BITS) {
+        uint64_t *words = (uint64_t *)c->data;
+        if (!BIT_HAS(words, low))
+            return 0;
+        words[low >> 6] &= ~BIT_MASK(low);
+        c->card--;
+        cont_shrink(c);
+        return 1;
+    }
+    a = (uint16_t *)c->data;
+    i = array_bisect(a, 0, c->card, low);
+    if (i == c->card || a[i] != low)
+        return 0;
+    memmove(a + i, a + i + 1, (c->card - i - 1) * sizeof(uint16_t));
+    c->card--;
+    return 1;
+}
+
+/* The four pairings of container types. With @inplace, @a's data is
+   reused or freed on success and left alone on failure. */
+
+static int
+bits_bits(int op, BitmapContainer *a, BitmapContainer *b,
+          BitmapContainer *out, int inplace) {
+    uint64_t *words = inplace ? (uint64_t *)a->data : Mem_NEW(uint64_t, BITMAP_WORDS);
+    if (words == NULL)
+        return -1;
+    out->card = BITS_CALL(bits_op, (op, words, (uint64_t *)a->data,
+                                    (uint64_t *)b->data));
+    out->type = BITMAP_BITS;
+    out->capacity = 0;
+    out->data = words;
+    cont_shrink(out);
+    return 0;
+}
+
+static int
+array_array(int op, BitmapContainer *a, BitmapContainer *b,
+            BitmapContainer *out, int inplace) {
+    uint16_t *x = (uint16_t *)a->data, *y = (uint16_t *)b->data, *z;
+    uint32_t j, nx = a->card, ny = b->card;
+    uint64_t *words;
+    if (op == OP_AND || op == OP_SUB || nx + ny <= BITMAP_ARRAY_MAX) {
+        int reuse = inplace && (op == OP_AND || op == OP_SUB);
+        z = reuse ? x : Mem_NEW(uint16_t, op == OP_AND || op == OP_SUB ? nx : nx + ny);
+        if (z == NULL)
+            return -1;
+        out->type = BITMAP_ARRAY;
+        out->capacity = reuse ? a->capacity : op == OP_AND || op == OP_SUB ? nx : nx + ny;
+        out->card = array_merge(op, x, nx, y, ny, z);
+        out->data = z;
+        if (inplace && !reuse)
+            Mem_FREE(x);
+        return 0;
+    }
+    /* the union may overflow an array, count it in a bitmap */
+    words = Mem_NEW(uint64_t, BITMAP_WORDS);
+    if (words == NULL)
+        return -1;
+    memset(words, 0, BITMAP_WORDS * sizeof(uint64_t));
+    for (j = 0; j < nx; j++)
+        words[x[j] >> 6] |= BIT_MASK(x[j]);
+    out->card = nx;
+    for (j = 0; j < ny; j++) {
+        if (BIT_HAS(words, y[j])) {
+            if (op == OP_XOR) {
+                words[y[j] >> 6] ^= BIT_MASK(y[j]);
+                out->card--;
+            }
+        } else {
+            words[y[j] >> 6] |= BIT_MASK(y[j]);
+            out->card++;
+        }
+    }
+    if (inplace)
+        Mem_FREE(x);
+    out->type = BITMAP_BITS;
+    out->capacity = 0;
+    out->data = words;
+    cont_shrink(out);
+    return 0;
+}
+
+static int
+array_bits(int op, BitmapContainer *a, BitmapContainer *b,
+           BitmapContainer *out, int inplace) {
+    uint16_t *x = (uint16_t *)a->data, *z;
+    uint64_t *y = (uint64_t *)b->data, *words;
+    uint32_t j, k = 0;
+    if (op == OP_AND || op == OP_SUB) {
+        z = inplace ? x : Mem_NEW(uint16_t, a->card);
+        if (z == NULL)
+            return -1;
+        for (j = 0; j < a->card; j++)
+            if ((int)BIT_HAS(y, x[j]) == (op == OP_AND))
+                z[k++] = x[j];
+        out->type = BITMAP_ARRAY;
+        out->capacity = inplace ? a->capacity : a->card;
+        out->card = k;
+        out->data = z;
+        return 0;
+    }
+    words = Mem_NEW(uint64_t, BITMAP_WORDS);
+    if (words == NULL)
+        return -1;
+    memcpy(words, y, BITMAP_WORDS * sizeof(uint64_t));
+    out->card = b->card;
+    for (j = 0; j < a->card; j++) {
+        if (BIT_HAS(words, x[j])) {
+            if (op == OP_XOR) {
+                words[x[j] >> 6] ^= BIT_MASK(x[j]);
+                out->card--;
+            }
+        } else {
+            words[x[j] >> 6] |= BIT_MASK(x[j]);
+            out->card++;
+        }
+    }
+    if (inplace)
+        Mem_FREE(x);
+    out->type = BITMAP_BITS;
+    out->capacity = 0;
+    out->data = words;
+    cont_shrink(out);
+    return 0;
+}
+
+static int
+bits_array(int op, BitmapContainer *a, BitmapContainer *b,
+           BitmapContainer *out, int inplace) {
+    uint64_t *x = (uint64_t *)a->data, *words;
+    uint16_t *y = (uint16_t *)b->data, *z;
+    uint32_t j, k = 0;
+    if (op == OP_AND) {
+        z = Mem_NEW(uint16_t, b->card);
+        if (z == NULL)
+            return -1;
+        for (j = 0; j < b->card; j++)
+            if (BIT_HAS(x, y[j]))
+                z[k++] = y[j];
+        if (inplace)
+            Mem_FREE(x);
+        out->type = BITMAP_ARRAY;
+        out->capacity = b->card;
+        out->card = k;
+        out->data = z;
+        return 0;
+    }
+    words = inplace ? x : Mem_NEW(uint64_t, BITMAP_WORDS);
+    if (words == NULL)
+        return -1;
+    if (!inplace)
+        memcpy(words, x, BITMAP_WORDS * sizeof(uint64_t));
+    out->card = a->card;
+    for (j = 0; j < b->card; j++) {
+        if (BIT_HAS(words, y[j])) {
+            if (op != OP_OR) {
+                words[y[j] >> 6] ^= BIT_MASK(y[j]);
+                out->card--;
+            }
+        } else if (op != OP_SUB) {
+            words[y[j] >> 6] |= BIT_MASK(y[j]);
+            out->card++;
+        }
+    }
+    out->type = BITMAP_BITS;
+    out->capacity = 0;
+    out->data = words;
+    cont_shrink(out);
+    return 0;
+}
+
+/* @out = @a op @b for containers of the same key, @out may end up empty */
+static int
+cont_op(int op, BitmapContainer *a, BitmapContainer *b,
+        BitmapContainer *out, int inplace) {
+    out->key = a->key;
+    if (a->type == BITMAP_BITS)
+        return b->type == BITMAP_BITS ? bits_bits(op, a, b, out, inplace) :
+               bits_array(op, a, b, out, inplace);
+    return b->type == BITMAP_BITS ? array_bits(op, a, b, out, inplace) :
+           array_array(op, a, b, out, inplace);
+}
+
+static int
+cont_issubset(BitmapContainer *a, BitmapContainer *b) {
+    uint32_t i, j = 0;
+    if (a->card > b->card)
+        return 0;
+    if (a->type == BITMAP_BITS && b->type == BITMAP_BITS)
+        return BITS_CALL(bits_subset, ((uint64_t *)a->data, (uint64_t *)b->data));
+    if (a->type == BITMAP_ARRAY) {
+        uint16_t *x = (uint16_t *)a->data;
+        for (i = 0; i < a->card; i++) {
+            if (b->type == BITMAP_BITS) {
+                if (!BIT_HAS((uint64_t *)b->data, x[i]))
+                    return 0;
+            } else {
+                uint16_t *y = (uint16_t *)b->data;
+                while (j < b->card && y[j] < x[i])
+                    j++;
+                if (j == b->card || y[j] != x[i])
+                    return 0;
+            }
+        }
+        return 1;
+    }
+    /* a bitmap which failed to shrink back to an array */
+    for (i = 0; i < BITMAP_WORDS; i++) {
+        uint64_t w = ((uint64_t *)a->data)[i];
+        while (w) {
+            if (!cont_has(b, (uint16_t)(i * 64 + __builtin_ctzll(w))))
+                return 0;
+            w &= w - 1;
+        }
+    }
+    return 1;
+}
+
+/* binary search of the container for @key, returns 1 if found, else 0
+   and *pos is where it would go */
+static int
+bitmap_find(BitmapObject *bm, uint16_t key, size_t *pos) {
+    size_t lo = 0, hi = bm->size;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (bm->containers[mid].key < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *pos = lo;
+    return lo < bm->size && bm->containers[lo].key == key;
+}
+
+/* open an uninitialized container at j, over-allocates like list_resize() */
+static int
+bitmap_dir_insert(BitmapObject *bm, size_t j) {
+    size_t n = bm->size;
+    if (n == bm->allocated) {
+        size_t new_allocated = n + (n >> 3) + (n < 9 ? 3 : 6);
+        BitmapContainer *containers = bm->containers;
+        Mem_RESIZE(containers, BitmapContainer, new_allocated);
+        if (containers == NULL)
+            return -1;
+        bm->containers = containers;
+        bm->allocated = new_allocated;
+    }
+    memmove(bm->containers + j + 1, bm->containers + j,
+            (n - j) * sizeof(BitmapContainer));
+    bm->size++;
+    return 0;
+}
+
+BitmapObject *
+bitmap_new(void) {
+    BitmapObject *bm = Mem_NEW(BitmapObject, 1);
+    if (bm == NULL)
+        return NULL;
+    bm->used = 0;
+    bm->size = 0;
+    bm->allocated = 0;
+    bm->containers = NULL;
+    return bm;
+}
+
+void
+bitmap_clear(BitmapObject *bm) {
+    size_t j;
+    for (j = 0; j < bm->size; j++)
+        cont_free(bm->containers + j);
+    Mem_FREE(bm->containers);
+    bm->used = 0;
+    bm->size = 0;
+    bm->allocated = 0;
+    bm->containers = NULL;
+}
+
+void
+bitmap_free(BitmapObject *bm) {
+    bitmap_clear(bm);
+    Mem_FREE(bm);
+}
+
+BitmapObject *
+bitmap_copy(BitmapObject *bm) {
+    size_t j;
+    BitmapObject *copy = bitmap_new();
+    if (copy == NULL)
+        return NULL;
+    copy->containers = Mem_NEW(BitmapContainer, bm->size);
+    if (copy->containers == NULL) {
+        Mem_FREE(copy);
+        return NULL;
+    }
+    copy->allocated = bm->size;
+    for (j = 0; j < bm->size; j++) {
+        if (cont_copy(copy->containers + j, bm->containers + j) == -1) {
+            bitmap_free(copy);
+            return NULL;
+        }
+        copy->size++;
+    }
+    copy->used = bm->used;
+    return copy;
+}
+
+size_t
+bitmap_len(BitmapObject *bm) {
+    return bm->used;
+}
+
+int
+bitmap_add(BitmapObject *bm, uint32_t value) {
+    size_t j;
+    int r;
+    BitmapContainer *c;
+    if (!bitmap_find(bm, (uint16_t)(value >> 16), &j)) {
+        uint16_t *a = Mem_NEW(uint16_t, 4);
+        if (a == NULL || bitmap_dir_insert(bm, j) == -1) {
+            Mem_FREE(a);
+            return -1;
+        }
+        c = bm->containers + j;
+        c->key = (uint16_t)(value >> 16);
+        c->type = BITMAP_ARRAY;
+        c->card = 0;
+        c->capacity = 4;
+        c->data = a;
+    }
+    r = cont_add(bm->containers + j, (uint16_t)value);
+    if (r == -1)
+        return -1;
+    bm->used += r;
+    return 0;
+}
+
+int
+bitmap_has(BitmapObject *bm, uint32_t value) {
+    size_t j;
+    if (!bitmap_find(bm, (uint16_t)(value >> 16), &j))
+        return 0;
+    return cont_has(bm->containers + j, (uint16_t)value);
+}
+
+void
+bitmap_discard(BitmapObject *bm, uint32_t value) {
+    size_t j;
+    BitmapContainer *c;
+    if (!bitmap_find(bm, (uint16_t)(value >> 16), &j))
+        return;
+    c = bm->containers + j;
+    if (!cont_discard(c, (uint16_t)value))
+        return;
+    bm->used--;
+    if (c->card == 0) {
+        cont_free(c);
+        memmove(c, c + 1, (bm->size - j - 1) * sizeof(BitmapContainer));
+        bm->size--;
+    }
+}
+
+/* Merge the container directories of @bm and @other into @res, which
+   only gets a directory. With @inplace, @bm's containers are moved or
+   consumed instead of copied, and freed on failure. */
+static int
+bitmap_merge(int op, BitmapObject *bm, BitmapObject *other,
+             BitmapObject *res, int inplace) {
+    BitmapContainer *a = bm->containers, *b = other->containers, *c;
+    size_t i = 0, j = 0, na = bm->size, nb = other->size;
+    size_t n = op == OP_AND ? (na < nb ? na : nb) : op == OP_SUB ? na : na + nb;
+    res->size = 0;
+    res->used = 0;
+    res->containers = Mem_NEW(BitmapContainer, n);
+    if (res->containers == NULL)
+        goto fail;
+    res->allocated = n;
+    while (i < na || j < nb) {
+        c = res->containers + res->size;
+        if (j == nb || (i < na && a[i].key < b[j].key)) {
+            /* only in bm */
+            if (op == OP_AND) {
+                if (inplace)
+                    cont_free(a + i);
+                i++;
+                continue;
+            }
+            if (inplace)
+                *c = a[i];
+            else if (cont_copy(c, a + i) == -1)
+                goto fail;
+            i++;
+        } else if (i == na || a[i].key > b[j].key) {
+            /* only in other */
+            if (op == OP_AND || op == OP_SUB) {
+                if (i == na)
+                    break;
+                j++;
+                continue;
+            }
+            if (cont_copy(c, b + j) == -1)
+                goto fail;
+            j++;
+        } else {
+            if (cont_op(op, a + i, b + j, c, inplace) == -1)
+                goto fail;
+            i++;
+            j++;
+            if (c->card == 0) {
+                cont_free(c);
+                continue;
+            }
+        }
+        res->used += c->card;
+        res->size++;
+    }
+    return 0;
+fail:
+    for (j = 0; j < res->size; j++)
+        cont_free(res->containers + j);
+    if (inplace)
+        for (; i < na; i++)
+            cont_free(a + i);
+    Mem_FREE(res->containers);
+    res->containers = NULL;
+    res->size = res->allocated = res->used = 0;
+    return -1;
+}
+
+static BitmapObject *
+bitmap_op(int op, BitmapObject *bm, BitmapObject *other) {
+    BitmapObject *res = bitmap_new();
+    if (res == NULL)
+        return NULL;
+    if (bitmap_merge(op, bm, other, res, 0) == -1) {
+        Mem_FREE(res);
+        return NULL;
+    }
+    return res;
+}
+
+/* on failure @bm is left empty */
+static int
+bitmap_iop(int op, BitmapObject *bm, BitmapObject *other) {
+    BitmapObject res;
+    int r;
+    if (bm == other) {
+        if (op == OP_SUB || op == OP_XOR)
+            bitmap_clear(bm);
+        return 0;
+    }
+    r = bitmap_merge(op, bm, other, &res, 1);
+    /* the containers have been moved to res or freed */
+    Mem_FREE(bm->containers);
+    if (r == -1) {
+        bm->used = bm->size = bm->allocated = 0;
+        bm->containers = NULL;
+        return -1;
+    }
+    *bm = res;
+    return 0;
+}
+
+BitmapObject *
+bitmap_or(BitmapObject *bm, BitmapObject *other) {
+    return bitmap_op(OP_OR, bm, other);
+}
+
+BitmapObject *
+bitmap_and(BitmapObject *bm, BitmapObject *other) {
+    return bitmap_op(OP_AND, bm, other);
+}
+
+BitmapObject *
+bitmap_sub(BitmapObject *bm, BitmapObject *other) {
+    return bitmap_op(OP_SUB, bm, other);
+}
+
+BitmapObject *
+bitmap_xor(BitmapObject *bm, BitmapObject *other) {
+    return bitmap_op(OP_XOR, bm, other);
+}
+
+int
+bitmap_ior(BitmapObject *bm, BitmapObject *other) {
+    return bitmap_iop(OP_OR, bm, other);
+}
+
+int
+bitmap_iand(BitmapObject *bm, BitmapObject *other) {
+    return bitmap_iop(OP_AND, bm, other);
+}
+
+int
+bitmap_isub(BitmapObject *bm, BitmapObject *other) {
+    return bitmap_iop(OP_SUB, bm, other);
+}
+
+int
+bitmap_ixor(BitmapObject *bm, BitmapObject *other) {
+    return bitmap_iop(OP_XOR, bm, other);
+}
+
+int
+bitmap_issubset(BitmapObject *bm, BitmapObject *other) {
+    size_t i, j = 0;
+    if (bm->used > other->used)
+        return 0;
+    for (i = 0; i < bm->size; i++) {
+        BitmapContainer *a = bm->containers + i;
+        while (j < other->size && other->containers[j].key < a->key)
+            j++;
+        if (j == other->size || other->containers[j].key != a->key)
+            return 0;
+        if (!cont_issubset(a, other->containers + j))
+            return 0;
+    }
+    return 1;
+}
+
+int
+bitmap_issuperset(BitmapObject *bm, BitmapObject *other) {
+    return bitmap_issubset(other, bm);
+}
+
+int
+bitmap_walk(BitmapObject *bm, uint64_t *cursor, uint32_t *value) {
+    size_t j;
+    uint32_t low;
+    if (*cursor > UINT32_MAX)
+        return 0;
+    low = bitmap_find(bm, (uint16_t)(*cursor >> 16), &j) ?
+          (uint32_t)(*cursor & 0xffff) : 0;
+    for (; j < bm->size; j++, low = 0) {
+        BitmapContainer *c = bm->containers + j;
+        uint32_t found = 0x10000;
+        if (c->type == BITMAP_ARRAY) {
+            uint16_t *a = (uint16_t *)c->data;
+            uint32_t i = array_bisect(a, 0, c->card, (uint16_t)low);
+            if (i < c->card)
+                found = a[i];
+        } else {
+            uint64_t *words = (uint64_t *)c->data;
+            size_t w = low >> 6;
+            uint64_t bits = words[w] & (~(uint64_t)0 << (low & 63));
+            while (bits == 0 && ++w < BITMAP_WORDS)
+                bits = words[w];
+            if (bits)
+                found = (uint32_t)(w * 64 + __builtin_ctzll(bits));
+        }
+        if (found < 0x10000) {
+            *value = (uint32_t)c->key << 16 | found;
+            *cursor = (uint64_t)*value + 1;
+            return 1;
+        }
+    }
+    *cursor = (uint64_t)UINT32_MAX + 1;
+    return 0;
+}
+
+static uint32_t
+default_keyvalue(void *key) {
+    return (uint32_t)*(int *)key;
+}
+
+BitmapObject *
+bitmap_fromset(SetObject *sp, uint32_t (*keyvalue)(void *key)) {
+    void *key;
+    BitmapObject *bm = bitmap_new();
+    if (bm == NULL)
+        return NULL;
+    if (keyvalue == NULL)
+        keyvalue = default_keyvalue;
+    SET_FOREACH(sp, key) {
+        if (bitmap_add(bm, keyvalue(key)) == -1) {
+            bitmap_free(bm);
+            return NULL;
+        }
+    }
+    return bm;
+}
+
+BitmapObject *
+bitmap_fromlist(ListObject *lp, uint32_t (*keyvalue)(void *key)) {
+    size_t i;
+    BitmapObject *bm = bitmap_new();
+    if (bm == NULL)
+        return NULL;
+    if (keyvalue == NULL)
+        keyvalue = default_keyvalue;
+    for (i = 0; i < lp->used; i++) {
+        if (bitmap_add(bm, keyvalue(lp->table[i])) == -1) {
+            bitmap_free(bm);
+            return NULL;
+        }
+    }
+    return bm;
+}
+
+SetObject *
+bitmap_toset(BitmapObject *bm,
+             size_t (*keyhash)(void *key),
+             int (*keycmp)(void *key1, void *key2),
+             void * (*keydup)(void *key),
+             void (*keyfree)(void *key)) {
+    uint64_t cursor = 0;
+    uint32_t value;
+    SetObject *sp = set_cnew(bm->used, keyhash, keycmp, keydup, keyfree);
+    if (sp == NULL)
+        return NULL;
+    while (bitmap_walk(bm, &cursor, &value)) {
+        if (set_add(sp, &value) == -1) {
+            set_free(sp);
+            return NULL;
+        }
+    }
+    return sp;
+}
+
+ListObject *
+bitmap_tolist(BitmapObject *bm) {
+    uint64_t cursor = 0;
+    uint32_t value;
+    size_t n = 0;
+    ListObject *lp = list_cnew(bm->used, NULL, NULL, NULL);
+    if (lp == NULL)
+        return NULL;
+    while (bitmap_walk(bm, &cursor, &value)) {
+        int v = (int)value;
+        if ((lp->table[n] = lp->keydup(&v)) == NULL) {
+            lp->used = n; /* only free the copies made so far */
+            list_free(lp);
+            return NULL;
+        }
+        n++;
+    }
+    return lp;
+}
@@ -0,0 +1,68 @@
+/* # values over which an array container becomes a bitmap container */
+#define BITMAP_ARRAY_MAX 4096
+/* # 64-bit words of a bitmap container, 2^16 bits */
+#define BITMAP_WORDS 1024
+
+typedef enum {
+    BITMAP_ARRAY, BITMAP_BITS
+} BitmapContainerType;
+
+/* the values of a bitmap sharing their high 16 bits */
+typedef struct {
+    uint16_t key;  /* the high 16 bits */
+    uint16_t type;  /* BitmapContainerType */
+    uint32_t card;  /* # values */
+    uint32_t capacity;  /* # uint16_t slots of an array container */
+    void *data;  /* sorted uint16_t array, or BITMAP_WORDS words */
+} BitmapContainer;
+
+/* Compressed set of uint32_t values (roaring bitmap). Sparse chunks of
+2^16 values are sorted arrays, dense ones are plain bitmaps, so a dense
+set costs about a bit per value instead of a SetEntry and a key. */
+typedef struct {
+    size_t used;  /* # values */
+    size_t size;  /* # containers */
+    size_t allocated;
+    BitmapContainer *containers;  /* sorted by key */
+} BitmapObject;
+
+/* bitmap level functions */
+BitmapObject *bitmap_new(void);
+void bitmap_clear(BitmapObject *bm);
+void bitmap_free(BitmapObject *bm);
+BitmapObject *bitmap_copy(BitmapObject *bm);
+size_t bitmap_len(BitmapObject *bm);
+
+/* value level functions */
+int bitmap_add(BitmapObject *bm, uint32_t value);
+int bitmap_has(BitmapObject *bm, uint32_t value);
+void bitmap_discard(BitmapObject *bm, uint32_t value);
+
+/* set algebra, the same as set.c's */
+BitmapObject *bitmap_or(BitmapObject *bm, BitmapObject *other);
+BitmapObject *bitmap_and(BitmapObject *bm, BitmapObject *other);
+BitmapObject *bitmap_sub(BitmapObject *bm, BitmapObject *other);
+BitmapObject *bitmap_xor(BitmapObject *bm, BitmapObject *other);
+int bitmap_ior(BitmapObject *bm, BitmapObject *other);
+int bitmap_iand(BitmapObject *bm, BitmapObject *other);
+int bitmap_isub(BitmapObject *bm, BitmapObject *other);
+int bitmap_ixor(BitmapObject *bm, BitmapObject *other);
+int bitmap_issubset(BitmapObject *bm, BitmapObject *other);
+int bitmap_issuperset(BitmapObject *bm, BitmapObject *other);
+
+/* traversal, set *cursor to 0 to start, returns 0 past the end */
+int bitmap_walk(BitmapObject *bm, uint64_t *cursor, uint32_t *value);
+
+/*communicate between other data structures. @keyvalue maps a key to
+its value, NULL reads keys as ints like list_new's keys. */
+BitmapObject *bitmap_fromset(SetObject *sp, uint32_t (*keyvalue)(void *key));
+BitmapObject *bitmap_fromlist(ListObject *lp, uint32_t (*keyvalue)(void *key));
+/* the set's keys are made by keydup from a uint32_t */
+SetObject *
+bitmap_toset(BitmapObject *bm,
+             size_t (*keyhash)(void *key),
+             int (*keycmp)(void *key1, void *key2),
+             void * (*keydup)(void *key),
+             void (*keyfree)(void *key));
+/* a list_new() style list of ints */
+ListObject *bitmap_tolist(BitmapObject *bm);
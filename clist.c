@@ -0,0 +1,463 @@
+#include "xlib.h"
+
+static int
+default_keycmp(void *key1, void *key2) {
+    return *(int *)key1 - *(int *)key2;
+}
+
+static void *
+default_keydup(void *_key) {
+    int *key = Mem_NEW(int, 1);
+    if (key == NULL)
+        return NULL;
+    *key = *(int *)_key;
+    return (void *)key;
+}
+
+static void **
+chunk_items_new(CListObject *clp) {
+    void **items = clp->spare;
+    if (items != NULL) {
+        clp->spare = NULL;
+        return items;
+    }
+    return Mem_ANEW(clp->allocator, void *, CLIST_CHUNK);
+}
+
+/* keep one emptied chunk, so add() and pop() around a chunk boundary
+   don't allocate every time */
+static void
+chunk_items_free(CListObject *clp, void **items) {
+    if (clp->spare == NULL)
+        clp->spare = items;
+    else
+        Mem_AFREE(clp->allocator, items);
+}
+
+/* open an uninitialized slot at chunks[j], the directory over-allocates
+   like list_resize() does */
+static int
+dir_insert(CListObject *clp, size_t j) {
+    size_t n = clp->nchunks;
+    if (n == clp->allocated) {
+        size_t new_allocated = n + (n >> 3) + (n < 9 ? 3 : 6);
+        CListChunk *chunks = clp->chunks;
+        Mem_ARESIZE(clp->allocator, chunks, CListChunk, new_allocated);
+        if (chunks == NULL)
+            return -1;
+        clp->chunks = chunks;
+        clp->allocated = new_allocated;
+    }
+    memmove(clp->chunks + j + 1, clp->chunks + j,
+            (n - j) * sizeof(CListChunk));
+    clp->nchunks++;
+    return 0;
+}
+
+static void
+dir_remove(CListObject *clp, size_t j) {
+    chunk_items_free(clp, clp->chunks[j].items);
+    memmove(clp->chunks + j, clp->chunks + j + 1,
+            (clp->nchunks - j - 1) * sizeof(CListChunk));
+    clp->nchunks--;
+}
+
+static void
+shift_starts(CListObject *clp, size_t j, ssize_t delta) {
+    size_t n = clp->nchunks;
+    for (; j < n; j++)
+        clp->chunks[j].start += delta;
+}
+
+/* chunk holding the index'th key, index must be in range */
+static size_t
+clist_locate(CListObject *clp, size_t index) {
+    CListChunk *chunks = clp->chunks;
+    size_t lo, hi, mid, j = clp->finger;
+    /* sequential access stays in the finger's chunk or moves to the next */
+    if (j < clp->nchunks && index >= chunks[j].start) {
+        if (index < chunks[j].start + chunks[j].used)
+            return j;
+        if (j + 1 < clp->nchunks && index < chunks[j + 1].start + chunks[j + 1].used
+            && index >= chunks[j + 1].start)
+            return clp->finger = j + 1;
+    }
+    lo = 0;
+    hi = clp->nchunks - 1;
+    while (lo < hi) {
+        mid = lo + (hi - lo + 1) / 2;
+        if (chunks[mid].start <= index)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return clp->finger = lo;
+}
+
+CListObject *
+clist_anew(Allocator *a,
+           int (*keycmp)(void *key1, void *key2),
+           void * (*keydup)(void *key),
+           void (*keyfree)(void *key)) {
+    CListObject *clp;
+    if (a == NULL)
+        a = mem_allocator;
+    clp = Mem_ANEW(a, CListObject, 1);
+    if (clp == NULL)
+        return NULL;
+    clp->allocator = a;
+    clp->used = 0;
+    clp->nchunks = 0;
+    clp->allocated = 0;
+    clp->chunks = NULL;
+    clp->finger = 0;
+    clp->spare = NULL;
+    clp->keycmp = keycmp ? keycmp : default_keycmp;
+    clp->keydup = keydup ? keydup : default_keydup;
+    clp->keyfree = keyfree ? keyfree : mem_free;
+    return clp;
+}
+
+CListObject *
+clist_cnew(int (*keycmp)(void *key1, void *key2),
+           void * (*keydup)(void *key),
+           void (*keyfree)(void *key)) {
+    return clist_anew(MEM_CONTAINER_ALLOCATOR(), keycmp, keydup, keyfree);
+}
+
+CListObject *
+clist_new(void) {
+    return clist_cnew(NULL, NULL, NULL);
+}
+
+void
+clist_clear(CListObject *clp) {
+    size_t i, j;
+    for (j = 0; j < clp->nchunks; j++) {
+        CListChunk *c = clp->chunks + j;
+        for (i = 0; i < c->used; i++)
+            clp->keyfree(c->items[i]);
+        Mem_AFREE(clp->allocator, c->items);
+    }
+    Mem_AFREE(clp->allocator, clp->chunks);
+    Mem_AFREE(clp->allocator, clp->spare);
+    clp->used = 0;
+    clp->nchunks = 0;
+    clp->allocated = 0;
+    clp->chunks = NULL;
+    clp->finger = 0;
+    clp->spare = NULL;
+}
+
+int
+clist_free(CListObject *clp) {
+    clist_clear(clp);
+    Mem_AFREE(clp->allocator, clp);
+    return 0;
+}
+
+size_t
+clist_len(CListObject *clp) {
+    return clp->used;
+}
+
+void *
+clist_get(CListObject *clp, ssize_t index) {
+    ssize_t n = clp->used;
+    CListChunk *c;
+    if (index < 0)
+        index += n;
+    if (index < 0 || index >= n) {
+        return NULL;
+    }
+    c = clp->chunks + clist_locate(clp, index);
+    return c->items[index - c->start];
+}
+
+int
+clist_rset(CListObject *clp, ssize_t index, void *key) {
+    ssize_t n = clp->used;
+    CListChunk *c;
+    if (index < 0)
+        index += n;
+    if (index < 0 || index >= n) {
+        return -1;
+    }
+    c = clp->chunks + clist_locate(clp, index);
+    c->items[index - c->start] = key;
+    return 0;
+}
+
+int
+clist_set(CListObject *clp, ssize_t index, void *key) {
+    ssize_t n = clp->used;
+    void *new_v;
+    if (index < -n || index >= n) {
+        return -1;
+    }
+    if ((new_v = clp->keydup(key)) == NULL)
+        return -1;
+    return clist_rset(clp, index, new_v);
+}
+
+int
+clist_radd(CListObject *clp, void *key) {
+    size_t j = clp->nchunks;
+    CListChunk *c;
+    if (j == 0 || clp->chunks[j - 1].used == CLIST_CHUNK) {
+        void **items = chunk_items_new(clp);
+        if (items == NULL)
+            return -1;
+        if (dir_insert(clp, j) == -1) {
+            chunk_items_free(clp, items);
+            return -1;
+        }
+        c = clp->chunks + j;
+        c->start = clp->used;
+        c->used = 0;
+        c->items = items;
+    } else {
+        c = clp->chunks + j - 1;
+    }
+    c->items[c->used++] = key;
+    clp->used++;
+    return 0;
+}
+
+int
+clist_add(CListObject *clp, void *key) {
+    void *new_v = clp->keydup(key);
+    if (new_v == NULL)
+        return -1;
+    if (clist_radd(clp, new_v) == -1) {
+        clp->keyfree(new_v);
+        return -1;
+    }
+    return 0;
+}
+
+/* move the upper half of the full chunks[j] into a new chunk after it */
+static int
+chunk_split(CListObject *clp, size_t j) {
+    size_t half = CLIST_CHUNK / 2;
+    CListChunk *c, *d;
+    void **items = chunk_items_new(clp);
+    if (items == NULL)
+        return -1;
+    if (dir_insert(clp, j + 1) == -1) {
+        chunk_items_free(clp, items);
+        return -1;
+    }
+    c = clp->chunks + j;
+    d = c + 1;
+    memcpy(items, c->items + half, (CLIST_CHUNK - half) * sizeof(void *));
+    d->items = items;
+    d->start = c->start + half;
+    d->used = CLIST_CHUNK - half;
+    c->used = half;
+    return 0;
+}
+
+int
+clist_rinsert(CListObject *clp, ssize_t where, void *key) {
+    ssize_t n = clp->used;
+    size_t j, off;
+    CListChunk *c;
+    if (where < 0) {
+        where += n;
+        if (where < 0)
+            where = 0;
+    }
+    if (where >= n)
+        return clist_radd(clp, key);
+    j = clist_locate(clp, where);
+    if (clp->chunks[j].used == CLIST_CHUNK) {
+        if (chunk_split(clp, j) == -1)
+            return -1;
+        if ((size_t)where >= clp->chunks[j + 1].start)
+            j++;
+    }
+    c = clp->chunks + j;
+    off = where - c->start;
+    memmove(c->items + off + 1, c->items + off,
+            (c->used - off) * sizeof(void *));
+    c->items[off] = key;
+    c->used++;
+    shift_starts(clp, j + 1, 1);
+    clp->used++;
+    return 0;
+}
+
+int
+clist_insert(CListObject *clp, ssize_t where, void *key) {
+    void *new_v = clp->keydup(key);
+    if (new_v == NULL)
+        return -1;
+    if (clist_rinsert(clp, where, new_v) == -1) {
+        clp->keyfree(new_v);
+        return -1;
+    }
+    return 0;
+}
+
+void *
+clist_popi(CListObject *clp, ssize_t index) {
+    ssize_t n = clp->used;
+    size_t j, off;
+    CListChunk *c;
+    void *v;
+    if (index < 0)
+        index += n;
+    if (index < 0 || index >= n) {
+        return NULL;
+    }
+    j = clist_locate(clp, index);
+    c = clp->chunks + j;
+    off = index - c->start;
+    v = c->items[off];
+    memmove(c->items + off, c->items + off + 1,
+            (c->used - off - 1) * sizeof(void *));
+    c->used--;
+    shift_starts(clp, j + 1, -1);
+    clp->used--;
+    if (c->used == 0) {
+        dir_remove(clp, j);
+    } else if (c->used < CLIST_CHUNK / 4) {
+        /* merge a sparse chunk into a neighbour, keeping the merged
+           chunk half empty so the next insertion won't split it */
+        if (j + 1 < clp->nchunks && c->used + c[1].used <= CLIST_CHUNK / 2) {
+            memcpy(c->items + c->used, c[1].items, c[1].used * sizeof(void *));
+            c->used += c[1].used;
+            dir_remove(clp, j + 1);
+        } else if (j > 0 && c[-1].used + c->used <= CLIST_CHUNK / 2) {
+            memcpy(c[-1].items + c[-1].used, c->items, c->used * sizeof(void *));
+            c[-1].used += c->used;
+            dir_remove(clp, j);
+        }
+    }
+    return v;
+}
+
+void *
+clist_pop(CListObject *clp) {
+    return clist_popi(clp, -1);
+}
+
+int
+clist_del(CListObject *clp, ssize_t index) {
+    void *v = clist_popi(clp, index);
+    if (v == NULL)
+        return -1;
+    clp->keyfree(v);
+    return 0;
+}
+
+size_t
+clist_index(CListObject *clp, void *key) {
+    size_t i, j;
+    void *k;
+    for (j = 0; j < clp->nchunks; j++) {
+        CListChunk *c = clp->chunks + j;
+        for (i = 0; i < c->used; i++) {
+            k = c->items[i];
+            if (k == key || clp->keycmp(key, k) == 0)
+                return c->start + i;
+        }
+    }
+    return LIST_NOT_FOUND;
+}
+
+size_t
+clist_count(CListObject *clp, void *key) {
+    size_t i, j, result = 0;
+    void *k;
+    for (j = 0; j < clp->nchunks; j++) {
+        CListChunk *c = clp->chunks + j;
+        for (i = 0; i < c->used; i++) {
+            k = c->items[i];
+            if (k == key || clp->keycmp(key, k) == 0)
+                result++;
+        }
+    }
+    return result;
+}
+
+int
+clist_remove(CListObject *clp, void *key) {
+    size_t i = clist_index(clp, key);
+    if (i == LIST_NOT_FOUND) {
+        assert(0);/* raise key not found error */
+        return -1;
+    }
+    return clist_del(clp, i);
+}
+
+int
+clist_extend_from_array(CListObject *clp, void **keys, size_t k) {
+    size_t i;
+    for (i = 0; i < k; i++) {
+        if (clist_add(clp, keys[i]) == -1) {
+            while (i-- > 0)
+                clp->keyfree(clist_pop(clp));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+CListObject *
+clist_copy(CListObject *clp) {
+    size_t j;
+    CListObject *nclp = clist_cnew(clp->keycmp, clp->keydup, clp->keyfree);
+    if (nclp == NULL)
+        return NULL;
+    for (j = 0; j < clp->nchunks; j++) {
+        CListChunk *c = clp->chunks + j;
+        if (clist_extend_from_array(nclp, c->items, c->used) == -1) {
+            clist_free(nclp);
+            return NULL;
+        }
+    }
+    return nclp;
+}
+
+ListObject *
+clist_tolist(CListObject *clp) {
+    size_t i, j, n = 0;
+    ListObject *lp = list_cnew(clp->used, clp->keycmp, clp->keydup,
+                               clp->keyfree);
+    if (lp == NULL)
+        return NULL;
+    for (j = 0; j < clp->nchunks; j++) {
+        CListChunk *c = clp->chunks + j;
+        for (i = 0; i < c->used; i++, n++) {
+            if ((lp->table[n] = clp->keydup(c->items[i])) == NULL) {
+                lp->used = n; /* only free the copies made so far */
+                list_free(lp);
+                return NULL;
+            }
+        }
+    }
+    return lp;
+}
+
+size_t
+clist_walk(CListObject *clp, size_t *pos, void **key_addr) {
+    CListChunk *c;
+    if (*pos >= clp->used)
+        return 0;
+    c = clp->chunks + clist_locate(clp, *pos);
+    *key_addr = c->items[*pos - c->start];
+    (*pos)++;
+    return 1;
+}
+
+void
+clist_print(CListObject *clp) {
+    size_t pos = 0;
+    void *key;
+    printf("[");
+    while (clist_walk(clp, &pos, &key))
+        printf("%d, ", *(int*)key);
+    printf("]\n\n");
+}
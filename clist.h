@@ -0,0 +1,69 @@
+/* # key slots of a chunk */
+#define CLIST_CHUNK 1024
+
+typedef struct {
+    size_t start;  /* index of items[0] in the list */
+    size_t used;
+    void **items;  /* CLIST_CHUNK slots */
+} CListChunk;
+
+/* Chunked list. Keys live in fixed-size chunks, so growing never moves
+existing keys and an insertion only shifts keys within one chunk. Only
+the chunk directory is reallocated, which is CLIST_CHUNK times smaller
+than the table of a ListObject of the same length. */
+typedef struct {
+    size_t used;  /* # keys */
+    size_t nchunks;
+    size_t allocated;  /* # slots of chunks */
+    CListChunk *chunks;
+    size_t finger;  /* chunk of the last access, checked before searching */
+    void **spare;  /* items of the last emptied chunk, kept for reuse */
+    Allocator *allocator;  /* of the struct, directory and chunks */
+    int (*keycmp)(void *key1, void *key2);
+    void *(*keydup)(void *key);
+    void (*keyfree)(void *key);
+} CListObject;
+
+/* list level functions */
+CListObject *
+clist_cnew(int (*keycmp)(void *key1, void *key2),
+           void * (*keydup)(void *key),
+           void (*keyfree)(void *key));
+/* the same, taking the struct, directory and chunks from @a instead of
+the thread's container allocator, NULL for mem_allocator */
+CListObject *
+clist_anew(Allocator *a,
+           int (*keycmp)(void *key1, void *key2),
+           void * (*keydup)(void *key),
+           void (*keyfree)(void *key));
+CListObject *clist_new(void);
+void clist_clear(CListObject *clp);
+int clist_free(CListObject *clp);
+CListObject *clist_copy(CListObject *clp);
+size_t clist_len(CListObject *clp);
+int clist_extend_from_array(CListObject *clp, void **keys, size_t k);
+ListObject *clist_tolist(CListObject *clp);
+
+/* key level functions, the same as list_*. As there, clist_set and
+clist_rset leave the key they replace to the caller. */
+void *clist_get(CListObject *clp, ssize_t index);
+int clist_set(CListObject *clp, ssize_t index, void *key);
+int clist_add(CListObject *clp, void *key);
+void *clist_pop(CListObject *clp);
+void *clist_popi(CListObject *clp, ssize_t index);
+int clist_insert(CListObject *clp, ssize_t index, void *key);
+size_t clist_index(CListObject *clp, void *key);
+size_t clist_count(CListObject *clp, void *key);
+int clist_del(CListObject *clp, ssize_t index);
+int clist_remove(CListObject *clp, void *key);
+
+/*key level functions. 'r' prefix is short for 'reference'.*/
+int clist_rset(CListObject *clp, ssize_t index, void *key);
+int clist_radd(CListObject *clp, void *key);
+int clist_rinsert(CListObject *clp, ssize_t index, void *key);
+
+/* set *pos to 0 to start, returns 0 past the end */
+size_t clist_walk(CListObject *clp, size_t *pos, void **key_addr);
+
+/*other functions for printing or testing*/
+void clist_print(CListObject *clp);
@@ -1,8 +1,8 @@
 #include "xlib.h"
 
 /* Object used as dummy key to fill deleted entries */
-static DummyStruct _dummy_struct;
-#define dummy (&_dummy_struct)
+DummyStruct dict_dummy_struct;
+#define dummy DICT_DUMMY
 
 static size_t
 default_keyhash(void *_key) {
@@ -20,12 +20,14 @@ default_keycmp(void *key1, void *key2) {
 
 static void *
 default_keydup(void *key) {
-    return (void *)strdup((char *)key);
+    return (void *)mem_strdup(mem_allocator, (char *)key);
 }
 
 static void *
 default_valuedup(void *_value) {
-    size_t *value = (size_t*)malloc(sizeof(size_t));
+    size_t *value = Mem_NEW(size_t, 1);
+    if (value == NULL)
+        return NULL;
     *value = *(size_t *)_value;
     return (void *)value;
 }
@@ -33,7 +35,9 @@ default_valuedup(void *_value) {
 /* dvf is short for "default_value_function" */
 static void *
 default_dvf(void) {
-    size_t *value = (size_t*)malloc(sizeof(size_t));
+    size_t *value = Mem_NEW(size_t, 1);
+    if (value == NULL)
+        return NULL;
     *value = 0;
     return (void *)value;
 }
@@ -100,6 +104,38 @@ dict_search_nodummy(DictObject *dp, void *key, size_t hash) {
     return 0;
 }
 
+/* give ep a copy of @key, inline if it is short enough */
+static int
+dict_entry_dup(DictObject *dp, DictEntry *ep, void *key) {
+    void *copy;
+#ifdef X_INLINE_KEYS
+    if (dp->keydup == default_keydup) {
+        size_t len = strlen((char *)key);
+        if (len < INLINE_KEY_SIZE) {
+            memcpy(ep->inl, key, len + 1);
+            ep->key = ep->inl;
+            ep->isinline = 1;
+            return 0;
+        }
+    }
+#endif
+    if ((copy = dp->keydup(key)) == NULL)
+        return -1;
+    ENTRY_SET_REF(ep, copy);
+    return 0;
+}
+
+/* ep's key for the caller to own, a copy if it is inline */
+static void *
+dict_entry_take(DictObject *dp, DictEntry *ep) {
+    (void)dp;
+#ifdef X_INLINE_KEYS
+    if (ep->isinline)
+        return dp->keydup(ep->key);
+#endif
+    return ep->key;
+}
+
 /*
 intern routine used by dict_add, dict_replace and dict_set. @key and
 @value should be buffered data, this function knows how to deal with
@@ -118,10 +154,11 @@ dict_insert_entry(DictObject *dp, void *key, size_t hash, DictEntry *ep,
         /*else make copies of @key and @value, then add them.*/
     } else {
         void *old_key = ep->key;
-        if ((ep->key = dp->keydup(key)) == NULL)
+        if (dict_entry_dup(dp, ep, key) == -1)
             return -1;
         if ((ep->value = dp->valuedup(value)) == NULL) {
-            dp->keyfree(ep->key);
+            ENTRY_FREE_KEY(dp, ep);
+            ep->key = old_key;
             return -1;
         }
         if (old_key == NULL)
@@ -138,11 +175,11 @@ dict_insert(DictObject *dp, void *key, size_t hash, void *value) {
 }
 
 /*
-intern fast function to insert @key and @value pair to dp when no dummy
-or equal key exists in dp. Assign their addresses, not new copies.
+intern fast function to find @hash's slot in dp when no dummy or equal
+key exists in dp. The caller fills in the key and value.
 */
-static void
-dict_insert_clean(DictObject *dp, void *key, size_t hash, void *value) {
+static DictEntry *
+dict_slot_clean(DictObject *dp, size_t hash) {
     size_t i;
     size_t perturb;
     size_t mask = dp->mask;
@@ -156,9 +193,8 @@ dict_insert_clean(DictObject *dp, void *key, size_t hash, void *value) {
     }
     dp->fill++;
     dp->used++;
-    ep->key = key;
     ep->hash = hash;
-    ep->value = value;
+    return ep;
 }
 
 /*
@@ -169,7 +205,7 @@ actually be smaller than the old one.
 static int
 dict_resize(DictObject *dp, size_t minused) {
     size_t newsize;
-    DictEntry *oldtable, *newtable, *ep;
+    DictEntry *oldtable, *newtable, *ep, *newep;
     DictEntry small_copy[HASH_MINSIZE];
     /* Find the smallest table size > minused. */
     for (newsize = HASH_MINSIZE;
@@ -192,7 +228,7 @@ dict_resize(DictObject *dp, size_t minused) {
             oldtable = small_copy;
         }
     } else {
-        newtable = Mem_NEW(DictEntry, newsize);
+        newtable = Mem_ANEW(dp->allocator, DictEntry, newsize);
         if (newtable == NULL)
             return -1;
     }
@@ -207,16 +243,19 @@ dict_resize(DictObject *dp, size_t minused) {
     for (ep = oldtable; used > 0; ep++) {
         if (ep->value) {             /* active entry */
             used--;
-            dict_insert_clean(dp, ep->key, ep->hash, ep->value);
+            newep = dict_slot_clean(dp, ep->hash);
+            ENTRY_SHARE(newep, ep);
+            newep->value = ep->value;
         }
     }
     if (is_oldtable_malloced)
-        free(oldtable);
+        Mem_AFREE(dp->allocator, oldtable);
     return 0;
 }
 
 DictObject *
-dict_cnew(size_t size,
+dict_anew(Allocator *a,
+          size_t size,
           size_t (*keyhash)(void *key),
           int (*keycmp)(void *key1, void *key2),
           void * (*keydup)(void *key),
@@ -224,7 +263,10 @@ dict_cnew(size_t size,
           void * (*dvf)(void),
           void (*keyfree)(void *key),
           void (*valuefree)(void *value)) {
-    DictObject *dp = (DictObject*)malloc(sizeof(DictObject));
+    DictObject *dp;
+    if (a == NULL)
+        a = mem_allocator;
+    dp = Mem_ANEW(a, DictObject, 1);
     if (dp == NULL)
         return NULL;
     size_t newsize;
@@ -233,9 +275,11 @@ dict_cnew(size_t size,
             newsize <<= 1)
         ;
     if (newsize > HASH_MINSIZE) {
-        DictEntry *newtable = Mem_NEW(DictEntry, newsize);
-        if (newtable == NULL)
+        DictEntry *newtable = Mem_ANEW(a, DictEntry, newsize);
+        if (newtable == NULL) {
+            Mem_AFREE(a, dp);
             return NULL;
+        }
         memset(newtable, 0, sizeof(DictEntry)* newsize);
         dp->table = newtable;
         dp->mask = newsize - 1;
@@ -244,31 +288,47 @@ dict_cnew(size_t size,
         EMPTY_TO_MINSIZE(dp);
     }
     dp->type = DICT;
+    dp->allocator = a;
     dp->keyhash = keyhash ? keyhash : default_keyhash;
     dp->keycmp = keycmp ? keycmp : default_keycmp;
     dp->keydup = keydup ? keydup : default_keydup;
     dp->valuedup = valuedup ? valuedup : default_valuedup;
     dp->dvf = dvf ? dvf : default_dvf;
-    dp->keyfree = keyfree ? keyfree : free;
-    dp->valuefree = valuefree ? valuefree : free;
+    dp->keyfree = keyfree ? keyfree : mem_free;
+    dp->valuefree = valuefree ? valuefree : mem_free;
     return dp;
 }
 
+DictObject *
+dict_cnew(size_t size,
+          size_t (*keyhash)(void *key),
+          int (*keycmp)(void *key1, void *key2),
+          void * (*keydup)(void *key),
+          void * (*valuedup)(void *value),
+          void * (*dvf)(void),
+          void (*keyfree)(void *key),
+          void (*valuefree)(void *value)) {
+    return dict_anew(MEM_CONTAINER_ALLOCATOR(), size, keyhash, keycmp,
+                     keydup, valuedup, dvf, keyfree, valuefree);
+}
+
 /*default version of a dict. That is, key is char*, value is size_t*. */
 DictObject *
 dict_new(void) {
-    DictObject *dp = (DictObject*)malloc(sizeof(DictObject));;
+    Allocator *a = MEM_CONTAINER_ALLOCATOR();
+    DictObject *dp = Mem_ANEW(a, DictObject, 1);
     if (dp == NULL)
         return NULL;
     EMPTY_TO_MINSIZE(dp);
     dp->type = DICT;
+    dp->allocator = a;
     dp->keyhash = default_keyhash;
     dp->keycmp = default_keycmp;
     dp->keydup = default_keydup;
     dp->valuedup = default_valuedup;
     dp->dvf = default_dvf;
-    dp->keyfree = free;
-    dp->valuefree = free;
+    dp->keyfree = mem_free;
+    dp->valuefree = mem_free;
     return dp;
 }
 
@@ -293,18 +353,26 @@ dict_clear(DictObject *dp) {
         /*only free active entry, this is different from thon 2.7*/
         if (ep->value) {
             used--;
-            dp->keyfree(ep->key);
+            ENTRY_FREE_KEY(dp, ep);
             dp->valuefree(ep->value);
         }
     }
     if (table_is_malloced)
-        free(table);
+        Mem_AFREE(dp->allocator, table);
+}
+
+/* empty dp, whose keys and values have all been handed over or freed */
+static void
+dict_forget(DictObject *dp) {
+    if (dp->table != dp->smalltable)
+        Mem_AFREE(dp->allocator, dp->table);
+    EMPTY_TO_MINSIZE(dp);
 }
 
 void
 dict_free(DictObject *dp) {
     dict_clear(dp);
-    free(dp);
+    Mem_AFREE(dp->allocator, dp);
 }
 
 /*if key exists, return its correspondent value, else NULL.*/
@@ -352,7 +420,7 @@ dict_rset(DictObject *dp, void *key, void *value) {
         if (ep->key == NULL)
             dp->fill++;
         dp->used++;
-        ep->key = key;
+        ENTRY_SET_REF(ep, key);
         ep->value = value;
         ep->hash = hash;
         if (NEED_RESIZE(dp))
@@ -371,10 +439,11 @@ dict_add(DictObject *dp, void *key, void *value) {
     /*only for non-existing keys*/
     assert(ep->value == NULL);
     void *old_key = ep->key;
-    if ((ep->key = dp->keydup(key)) == NULL)
+    if (dict_entry_dup(dp, ep, key) == -1)
         return -1;
     if ((ep->value = dp->valuedup(value)) == NULL) {
-        dp->keyfree(ep->key);
+        ENTRY_FREE_KEY(dp, ep);
+        ep->key = old_key;
         return -1;
     }
     if (old_key == NULL)
@@ -399,7 +468,7 @@ dict_radd(DictObject *dp, void *key, void *value) {
     if (ep->key == NULL)
         dp->fill++;
     dp->used++;
-    ep->key = key;
+    ENTRY_SET_REF(ep, key);
     ep->value = value;
     ep->hash = hash;
     if (NEED_RESIZE(dp))
@@ -450,13 +519,38 @@ dict_del(DictObject *dp, void *key) {
     DictEntry *ep = dict_search(dp, key, hash);
     /*only for existing keys*/
     assert(ep->value);
-    dp->keyfree(ep->key);
+    ENTRY_FREE_KEY(dp, ep);
     dp->valuefree(ep->value);
     ep->key = dummy;
     ep->value = NULL;
     dp->used--;
 }
 
+/*remove @key and hand its value over to the caller instead of freeing
+it, and its key too if @key_addr isn't NULL. Returns NULL if @key doesn't
+exist, or if copying an inline key fails, and dp is left as it was.*/
+void *
+dict_pop(DictObject *dp, void *key, void **key_addr) {
+    assert(key);
+    DictEntry *ep = dict_search(dp, key, dp->keyhash(key));
+    void *value = ep->value;
+    if (value == NULL)
+        return NULL;
+    if (key_addr == NULL)
+        ENTRY_FREE_KEY(dp, ep);
+    else if ((*key_addr = dict_entry_take(dp, ep)) == NULL)
+        return NULL;
+    ep->key = dummy;
+    ep->value = NULL;
+    dp->used--;
+    return value;
+}
+
+void *
+dict_take(DictObject *dp, void *key) {
+    return dict_pop(dp, key, NULL);
+}
+
 /*if @key exists, same as dict_get. if not, add the copies of @key
 and the dict's default value to dict first, then return value.*/
 void *
@@ -466,10 +560,11 @@ dict_fget(DictObject *dp, void *key) {
     DictEntry *ep = dict_search(dp, key, hash);
     if (ep->value == NULL) { /* dummy or unused */
         void *old_key = ep->key;
-        if ((ep->key = dp->keydup(key)) == NULL)
+        if (dict_entry_dup(dp, ep, key) == -1)
             return NULL;
         if ((ep->value = dp->dvf()) == NULL) {
-            dp->keyfree(ep->key);
+            ENTRY_FREE_KEY(dp, ep);
+            ep->key = old_key;
             return NULL;
         }
         if (old_key == NULL)
@@ -510,28 +605,339 @@ dict_update(DictObject *dp, DictObject *other) {
     return 0;
 }
 
+/*the same as dict_update, but other's keys and values are moved into dp
+instead of copied*/
+int
+dict_update_move(DictObject *dp, DictObject *other) {
+    DictEntry *ep, *ep2;
+    size_t o_used = other->used;
+    if (dp == other || o_used == 0)
+        return 0;
+    assert(other->keyhash == dp->keyhash);
+    if ((dp->fill + o_used) * 3 >= (dp->mask + 1) * 2) {
+        if (dict_resize(dp, (dp->used + o_used) * 2) != 0)
+            return -1;
+    }
+    for (ep = other->table; o_used > 0; ep++) {
+        if (ep->value) {             /* active entry */
+            o_used--;
+            ep2 = dict_search(dp, ep->key, ep->hash);
+            if (ep2->value) {
+                /* dp keeps its key, and takes the value */
+                ENTRY_FREE_KEY(other, ep);
+                dp->valuefree(ep2->value);
+            } else {
+                if (ep2->key == NULL)
+                    dp->fill++;
+                dp->used++;
+                ENTRY_SHARE(ep2, ep);
+                ep2->hash = ep->hash;
+            }
+            ep2->value = ep->value;
+        }
+    }
+    dict_forget(other);
+    return 0;
+}
+
+/* dict_merge_many groups the shards' entries by partitions of the hash
+   space, then matches each partition on its own thread */
+#define MERGE_BUCKET 2048
+#define MERGE_MAXBITS 16
+
+enum { MERGE_COUNT, MERGE_SCATTER, MERGE_MATCH, MERGE_COMBINE };
+
+typedef struct {
+    DictObject *dp;
+    DictObject **shards;
+    size_t n;
+    void (*combine)(void *value, void *other);
+    int move;
+    int phase;
+    int pbits;
+    size_t nparts;
+    size_t nslices;  /* of the shards' tables put end to end */
+    size_t nslots;  /* # slots of the shards */
+    size_t next;  /* next slice or partition to be taken by a thread */
+    size_t *hist;  /* per slice and partition, counts and then fill positions */
+    size_t *bounds;  /* partition i is entries[bounds[i]:bounds[i + 1]] */
+    size_t maxpart;
+    DictEntry **entries;  /* shard entries, then dp's for the new keys */
+    void **targets;  /* the value each entry is folded into */
+    char *isnew;  /* first entry of a key that dp hasn't */
+    size_t nnew;
+    /* merge_match's table for thread id starts at tables + id * tsize,
+       taken up front from dp's allocator since that one need not be
+       thread safe */
+    unsigned int *tables;
+    size_t tsize;
+    int error;
+} MergeJob;
+
+#define MERGE_PART(job, hash) ((job)->pbits == 0 ? 0 :\
+    (size_t)(((uint64_t)(hash) * 0x9E3779B97F4A7C15ULL) >> (64 - (job)->pbits)))
+
+/* count or gather the entries of slice t of the shards' slots */
+static void
+merge_slice(MergeJob *job, size_t t) {
+    size_t lo = job->nslots / job->nslices * t;
+    size_t hi = t == job->nslices - 1 ? job->nslots : lo + job->nslots / job->nslices;
+    size_t *hist = job->hist + t * job->nparts;
+    size_t s, size, base = 0;
+    DictEntry *ep, *end;
+    for (s = 0; s < job->n && base < hi; s++, base += size) {
+        size = job->shards[s]->mask + 1;
+        if (base + size <= lo)
+            continue;
+        ep = job->shards[s]->table + (lo > base ? lo - base : 0);
+        end = job->shards[s]->table + (hi < base + size ? hi - base : size);
+        for (; ep < end; ep++) {
+            if (ep->value) {             /* active entry */
+                size_t part = MERGE_PART(job, ep->hash);
+                if (job->phase == MERGE_COUNT)
+                    hist[part]++;
+                else
+                    job->entries[hist[part]++] = ep;
+            }
+        }
+    }
+}
+
+/* find the value each entry of a partition goes to: the one of its key
+   in dp, or else of the partition's first entry of its key */
+static void
+merge_match(MergeJob *job, size_t id) {
+    size_t i, j, part, base, len, tsize, tmask, slot;
+    DictEntry *ep, *fp;
+    unsigned int *table = job->tables + id * job->tsize;
+    void *value;
+    DictObject *dp = job->dp;
+    while (!job->error && (part = PARALLEL_NEXT(job->next)) < job->nparts) {
+        base = job->bounds[part];
+        len = job->bounds[part + 1] - base;
+        for (tsize = 8; tsize < len * 2; tsize <<= 1)
+            ;
+        tmask = tsize - 1;
+        memset(table, 0, tsize * sizeof(unsigned int));
+        for (i = 0; i < len; i++) {
+            ep = job->entries[base + i];
+            /* dp doesn't change before all the threads are done */
+            fp = dict_search(dp, ep->key, ep->hash);
+            if (fp->value) {
+                job->targets[base + i] = fp->value;
+                continue;
+            }
+            slot = ep->hash & tmask;
+            for (; (j = table[slot]) != 0; slot = (slot + 1) & tmask) {
+                fp = job->entries[base + j - 1];
+                if (fp->hash == ep->hash
+                    && (fp->key == ep->key || dp->keycmp(fp->key, ep->key) == 0))
+                    break;
+            }
+            if (j != 0) {
+                job->targets[base + i] = job->targets[base + j - 1];
+                continue;
+            }
+            value = ep->value;
+            if (!job->move && (value = dp->valuedup(value)) == NULL) {
+                job->error = 1;
+                break;
+            }
+            table[slot] = i + 1;
+            job->targets[base + i] = value;
+            job->isnew[base + i] = 1;
+            __atomic_fetch_add(&job->nnew, 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* fold the entries of the keys already there into their values */
+static void
+merge_combine(MergeJob *job) {
+    size_t i, part;
+    DictEntry *ep;
+    DictObject *dp = job->dp;
+    while ((part = PARALLEL_NEXT(job->next)) < job->nparts) {
+        for (i = job->bounds[part]; i < job->bounds[part + 1]; i++) {
+            if (job->isnew[i])
+                continue;
+            ep = job->entries[i];
+            job->combine(job->targets[i], ep->value);
+            if (job->move) {
+                ENTRY_FREE_KEY(dp, ep);
+                dp->valuefree(ep->value);
+            }
+        }
+    }
+}
+
+static void
+merge_worker(void *arg, size_t id) {
+    MergeJob *job = (MergeJob *)arg;
+    size_t t;
+    if (job->phase == MERGE_MATCH)
+        merge_match(job, id);
+    else if (job->phase == MERGE_COMBINE)
+        merge_combine(job);
+    else
+        while ((t = PARALLEL_NEXT(job->next)) < job->nslices)
+            merge_slice(job, t);
+}
+
+static void
+merge_phase(MergeJob *job, int phase, size_t nthreads) {
+    job->phase = phase;
+    job->next = 0;
+    parallel_run(nthreads, merge_worker, job);
+}
+
+int
+dict_merge_many(DictObject *dp, DictObject **shards, size_t n,
+                void (*combine)(void *value, void *other), int move,
+                size_t nthreads) {
+    MergeJob job;
+    DictEntry *ep;
+    size_t i, j, t, c, pos, total = 0;
+    int failed = 0;
+    assert(combine);
+    if (nthreads == 0)
+        nthreads = 1;
+    memset(&job, 0, sizeof(job));
+    for (i = 0; i < n; i++) {
+        assert(shards[i] != dp && shards[i]->keyhash == dp->keyhash);
+        total += shards[i]->used;
+        job.nslots += shards[i]->mask + 1;
+    }
+    if (total == 0)
+        return 0;
+    job.dp = dp;
+    job.shards = shards;
+    job.n = n;
+    job.combine = combine;
+    job.move = move;
+    for (job.pbits = 0; job.pbits < MERGE_MAXBITS
+         && (total >> job.pbits) > MERGE_BUCKET; job.pbits++)
+        ;
+    job.nparts = (size_t)1 << job.pbits;
+    job.nslices = nthreads;
+    job.hist = (size_t *)mem_calloc(dp->allocator,
+                                     job.nslices * job.nparts, sizeof(size_t));
+    job.bounds = Mem_ANEW(dp->allocator, size_t, job.nparts + 1);
+    job.entries = Mem_ANEW(dp->allocator, DictEntry *, total);
+    job.targets = Mem_ANEW(dp->allocator, void *, total);
+    job.isnew = (char *)mem_calloc(dp->allocator, total, 1);
+    if (job.hist == NULL || job.bounds == NULL || job.entries == NULL
+        || job.targets == NULL || job.isnew == NULL) {
+        failed = 1;
+        goto done;
+    }
+    merge_phase(&job, MERGE_COUNT, nthreads);
+    for (pos = 0, i = 0; i < job.nparts; i++) {
+        job.bounds[i] = pos;
+        for (t = 0; t < job.nslices; t++) {
+            c = job.hist[t * job.nparts + i];
+            job.hist[t * job.nparts + i] = pos;
+            pos += c;
+        }
+        if (pos - job.bounds[i] > job.maxpart)
+            job.maxpart = pos - job.bounds[i];
+    }
+    job.bounds[job.nparts] = pos;
+    merge_phase(&job, MERGE_SCATTER, nthreads);
+    for (job.tsize = 8; job.tsize < job.maxpart * 2; job.tsize <<= 1)
+        ;
+    if (job.tsize > SSIZE_T_MAX / nthreads
+        || (job.tables = Mem_ANEW(dp->allocator, unsigned int,
+                                  job.tsize * nthreads)) == NULL) {
+        failed = 1;
+        goto done;
+    }
+    merge_phase(&job, MERGE_MATCH, nthreads);
+    if (job.error) {
+        failed = 1;
+        goto done;
+    }
+    /* one resize for all the new keys, the entries of dp found in the
+       match phase are only known by their values from here on */
+    if ((dp->fill + job.nnew) * 3 >= (dp->mask + 1) * 2
+        && dict_resize(dp, (dp->used + job.nnew) * 2) != 0) {
+        failed = 1;
+        goto done;
+    }
+    for (i = 0; i < total; i++) {
+        if (!job.isnew[i])
+            continue;
+        ep = job.entries[i];
+        job.entries[i] = dict_slot_clean(dp, ep->hash);
+        if (move) {
+            ENTRY_SHARE(job.entries[i], ep);
+            ep->value = NULL;
+        } else if (dict_entry_dup(dp, job.entries[i], ep->key) == -1) {
+            job.entries[i]->key = NULL;
+            dp->fill--;
+            dp->used--;
+            /* take the new keys out again, like dict_del */
+            for (j = 0; j < i; j++) {
+                if (job.isnew[j]) {
+                    ENTRY_FREE_KEY(dp, job.entries[j]);
+                    job.entries[j]->key = dummy;
+                    job.entries[j]->value = NULL;
+                    dp->used--;
+                }
+            }
+            failed = 1;
+            goto done;
+        }
+        job.entries[i]->value = job.targets[i];
+    }
+    /* nothing can fail from here on */
+    merge_phase(&job, MERGE_COMBINE, nthreads);
+    if (move) {
+        /* every entry of the shards was moved or freed */
+        for (i = 0; i < n; i++)
+            dict_forget(shards[i]);
+    }
+done:
+    if (failed && !move && job.isnew) {
+        for (i = 0; i < total; i++)
+            if (job.isnew[i])
+                dp->valuefree(job.targets[i]);
+    }
+    Mem_AFREE(dp->allocator, job.hist);
+    Mem_AFREE(dp->allocator, job.bounds);
+    Mem_AFREE(dp->allocator, job.entries);
+    Mem_AFREE(dp->allocator, job.targets);
+    Mem_AFREE(dp->allocator, job.isnew);
+    Mem_AFREE(dp->allocator, job.tables);
+    return failed ? -1 : 0;
+}
+
 /*make a copy of dp, deleting dummy entries by the way*/
 DictObject *
 dict_copy(DictObject *dp) {
     DictObject *copy = DICT_COPY_INIT(dp);
     if (copy == NULL)
         return NULL;
-    DictEntry *ep;
-    void *key, *value;
+    DictEntry *ep, *newep;
+    void *value;
     size_t used = dp->used;
     for (ep = dp->table; used > 0; ep++) {
         if (ep->value) {             /* active entry */
             used--;
-            if ((key = copy->keydup(ep->key)) == NULL) {
+            if ((value = copy->valuedup(ep->value)) == NULL) {
                 dict_free(copy);
                 return NULL;
             }
-            if ((value = copy->valuedup(ep->value)) == NULL) {
-                copy->keyfree(key);
+            newep = dict_slot_clean(copy, ep->hash);
+            if (dict_entry_dup(copy, newep, ep->key) == -1) {
+                copy->valuefree(value);
+                newep->key = NULL;
+                copy->fill--;
+                copy->used--;
                 dict_free(copy);
                 return NULL;
             }
-            dict_insert_clean(copy, key, ep->hash, value);
+            newep->value = value;
         }
     }
     return copy;
@@ -554,11 +960,28 @@ dict_iter_new(DictObject *dp) {
     dio = (IterObject*)malloc(sizeof(IterObject));;
     if (dio == NULL)
         return NULL;
+    dict_iter_init(dp, dio);
+    return dio;
+}
+
+void
+dict_iter_init(DictObject *dp, IterObject *dio) {
     dio->object = dp;
     dio->inipos = dp->table;
     dio->rest = dp->used;
+    dio->endpos = dp->table + dp->mask + 1;
+    dio->type = DICT;
+}
+
+void
+dict_iter_split(DictObject *dp, IterObject *dio, size_t k, size_t i) {
+    size_t slots = dp->mask + 1;
+    assert(k > 0 && i < k);
+    dio->object = dp;
+    dio->inipos = dp->table + slots * i / k;
+    dio->rest = i == 0 && k == 1 ? dp->used : (size_t)-1;
+    dio->endpos = dp->table + slots * (i + 1) / k;
     dio->type = DICT;
-    return dio;
 }
 
 size_t
@@ -566,7 +989,7 @@ dict_iter_walk(IterObject *dio, void **key_addr) {
     DictEntry *ep;
     void *key;
     size_t rest = dio->rest;
-    for(ep = (DictEntry *)dio->inipos; rest > 0; ep++) {
+    for(ep = (DictEntry *)dio->inipos; rest > 0 && ep < (DictEntry *)dio->endpos; ep++) {
         key = ep->key;
         if ( key && key != dummy) {
             dio->rest--;
@@ -580,10 +1003,7 @@ dict_iter_walk(IterObject *dio, void **key_addr) {
 
 void
 dict_iter_flush(IterObject *dio) {
-    DictObject *dp = (DictObject *)dio->object;
-    dio->inipos = dp->table;
-    dio->rest = dp->used;
-    dio->type = DICT;
+    dict_iter_init((DictObject *)dio->object, dio);
 }
 
 size_t
@@ -591,7 +1011,7 @@ dict_iterkv(IterObject *dio, void **key_addr, void **value_addr) {
     DictEntry *ep;
     void *key;
     size_t rest = dio->rest;
-    for(ep = (DictEntry *)dio->inipos; rest > 0; ep++) {
+    for(ep = (DictEntry *)dio->inipos; rest > 0 && ep < (DictEntry *)dio->endpos; ep++) {
         key = ep->key;
         if ( key && key != dummy) {
             dio->rest--;
@@ -604,25 +1024,128 @@ dict_iterkv(IterObject *dio, void **key_addr, void **value_addr) {
     return 0;
 }
 
+size_t
+dict_iter_next_batch(IterObject *dio, void **keys, void **values, size_t n) {
+    DictEntry *ep = (DictEntry *)dio->inipos;
+    DictEntry *end = (DictEntry *)dio->endpos;
+    void *key;
+    size_t i = 0;
+    if (n > dio->rest)
+        n = dio->rest;
+    for (; i < n && ep < end; ep++) {
+        key = ep->key;
+        if (key && key != dummy) {
+            keys[i] = key;
+            if (values)
+                values[i] = ep->value;
+            i++;
+        }
+    }
+    dio->rest -= i;
+    dio->inipos = ep;
+    return i;
+}
+
+/* shared by dict_parallel_for and dict_parallel_reduce, accs is NULL for
+   the former */
+typedef struct {
+    DictObject *dp;
+    size_t nchunks;
+    size_t next;
+    void (*fn)(void *arg, void *key, void *value);
+    void *arg;
+    char *accs;  /* an accumulator of accsize bytes per chunk */
+    size_t accsize;
+    void (*init)(void *acc);
+} DictParallelJob;
+
+static void
+dict_parallel_worker(void *_job, size_t id) {
+    DictParallelJob *job = (DictParallelJob *)_job;
+    IterObject it;
+    DictEntry *ep, *end;
+    void *arg, *key;
+    size_t chunk;
+    (void)id;
+    while ((chunk = PARALLEL_NEXT(job->next)) < job->nchunks) {
+        dict_iter_split(job->dp, &it, job->nchunks, chunk);
+        arg = job->arg;
+        if (job->accs) {
+            arg = job->accs + chunk * job->accsize;
+            if (job->init)
+                job->init(arg);
+        }
+        end = (DictEntry *)it.endpos;
+        for (ep = (DictEntry *)it.inipos; ep < end; ep++) {
+            key = ep->key;
+            if (key && key != dummy)
+                job->fn(arg, key, ep->value);
+        }
+    }
+}
+
+static void
+dict_parallel_run(DictParallelJob *job, size_t nthreads) {
+    if (nthreads == 0)
+        nthreads = 1;
+    job->nchunks = nthreads == 1 ? 1 : nthreads * PARALLEL_CHUNKS;
+    if (job->nchunks > job->dp->mask + 1)
+        job->nchunks = job->dp->mask + 1;
+    job->next = 0;
+    parallel_run(nthreads, dict_parallel_worker, job);
+}
+
+void
+dict_parallel_for(DictObject *dp, size_t nthreads,
+                  void (*fn)(void *arg, void *key, void *value), void *arg) {
+    DictParallelJob job;
+    memset(&job, 0, sizeof(job));
+    job.dp = dp;
+    job.fn = fn;
+    job.arg = arg;
+    dict_parallel_run(&job, nthreads);
+}
+
+int
+dict_parallel_reduce(DictObject *dp, size_t nthreads, void *acc,
+                     size_t accsize, void (*init)(void *acc),
+                     void (*fn)(void *acc, void *key, void *value),
+                     void (*merge)(void *acc, void *other)) {
+    DictParallelJob job;
+    size_t i;
+    memset(&job, 0, sizeof(job));
+    job.dp = dp;
+    job.fn = fn;
+    job.accsize = accsize;
+    job.init = init;
+    /* the chunks of the largest possible split */
+    i = (nthreads ? nthreads : 1) * PARALLEL_CHUNKS;
+    if (accsize == 0 || i > SSIZE_T_MAX / accsize)
+        return -1;
+    job.accs = (char *)mem_calloc(dp->allocator, i, accsize);
+    if (job.accs == NULL)
+        return -1;
+    dict_parallel_run(&job, nthreads);
+    for (i = 0; i < job.nchunks; i++)
+        merge(acc, job.accs + i * accsize);
+    Mem_AFREE(dp->allocator, job.accs);
+    return 0;
+}
+
 void
 dict_print2(DictObject *dp) {
     void *key, *value;
-    IterObject *dio = dict_iter_new(dp);
-    while (dict_iterkv(dio, &key, &value)) {
+    DICT_FOREACH(dp, key, value) {
         fprintf(stdout, "%s\t%u\n", (char*)key, *(size_t*)value);
     }
-    free(dio);
 }
 
 void
 dict_print(DictObject *dp) {
     void *key, *value;
-    IterObject *dio = iter(dp);
-    while (iterw(dio, &key)) {
-        value = dict_get(dp, key);
+    DICT_FOREACH(dp, key, value) {
         fprintf(stdout, "%s\t%u\n", (char*)key, *(size_t*)value);
     }
-    free(dio);
 }
 
 /*helper function for sorting a DictEntry by its value*/
@@ -12,8 +12,13 @@ typedef struct {
     size_t hash;
     void *key;
     void *value;
+    INLINE_KEY_FIELDS
 } DictEntry;
 
+/* fills deleted entries, exported for DICT_FOREACH */
+extern DummyStruct dict_dummy_struct;
+#define DICT_DUMMY (&dict_dummy_struct)
+
 typedef struct _dictobject DictObject;
 struct _dictobject {
     ObjectType type;
@@ -22,6 +27,7 @@ struct _dictobject {
     size_t mask;
     DictEntry *table;
     DictEntry smalltable[HASH_MINSIZE];
+    Allocator *allocator;  /* of the struct and table */
     size_t (*keyhash)(void *key);
     int (*keycmp)(void *key1, void *key2);
     void *(*keydup)(void *key);
@@ -47,10 +53,36 @@ dict_cnew(size_t size,
           void * (*dvf)(void),
           void (*keyfree)(void *key),
           void (*valuefree)(void *value));
+/* the same, taking the struct, table and entries from @a instead of
+the thread's container allocator, NULL for mem_allocator */
+DictObject *
+dict_anew(Allocator *a,
+          size_t size,
+          size_t (*keyhash)(void *key),
+          int (*keycmp)(void *key1, void *key2),
+          void * (*keydup)(void *key),
+          void * (*valuedup)(void *value),
+          void * (*dvf)(void),
+          void (*keyfree)(void *key),
+          void (*valuefree)(void *value));
 DictObject *dict_new(void);
 void dict_clear(DictObject *dp);
 void dict_free(DictObject *dp);
 int dict_update(DictObject *dp, DictObject *other);
+/* the same, moving other's keys and values instead of copying them.
+@other must have dp's callbacks and is left empty. */
+int dict_update_move(DictObject *dp, DictObject *other);
+/* Merge @n dicts made with dp's callbacks into @dp on up to @nthreads
+threads. A key already in dp, or in an earlier shard, has the value of a
+later one folded into its own by combine(value, other), e.g. adding up
+counts. The table is resized once. With @move the shards' keys and
+values are moved into dp, or freed once folded, and the shards are left
+empty; otherwise they are copied. Returns -1 if out of memory, with dp
+and the shards as they were. */
+int
+dict_merge_many(DictObject *dp, DictObject **shards, size_t n,
+                void (*combine)(void *value, void *other), int move,
+                size_t nthreads);
 DictObject *dict_copy(DictObject *dp);
 size_t dict_len(DictObject *dp);
 
@@ -64,6 +96,10 @@ void dict_del(DictObject *dp, void *key);
 int dict_add(DictObject *dp, void *key, void *value);
 int dict_replace(DictObject *dp, void *key, void *value);
 size_t dict_has(DictObject *dp, void *key);
+/*remove @key and return its value without freeing it, NULL if @key
+doesn't exist. dict_pop hands the key over too, through @key_addr.*/
+void *dict_pop(DictObject *dp, void *key, void **key_addr);
+void *dict_take(DictObject *dp, void *key);
 
 /*key value level functions. 'r' prefix is short for 'reference'.
 Assign @key or @value's address directly instead of its copy's.
@@ -76,11 +112,52 @@ int dict_rreplace(DictObject *dp, void *key, void *value);
 
 /*traversal interfaces of DictObject*/
 IterObject *dict_iter_new(DictObject *dp);
+/* the same on a caller owned iterator, e.g. one on the stack */
+void dict_iter_init(DictObject *dp, IterObject *dio);
+/* set up @dio for the @i th of @k contiguous ranges of dp's slots, the
+iterators of i = 0..k-1 visit every item once between them */
+void dict_iter_split(DictObject *dp, IterObject *dio, size_t k, size_t i);
 size_t dict_iter_walk(IterObject *dio, void **key_addr);
 void dict_iter_flush(IterObject *dio);
 
 /*special traversal function for dict. Faster to get key and value at the same time*/
 size_t dict_iterkv(IterObject *dio, void **key_addr, void **value_addr);
+/* fill @keys and @values (unless NULL) with up to @n next items,
+returns how many, 0 at the end */
+size_t dict_iter_next_batch(IterObject *dio, void **keys, void **values, size_t n);
+
+/* Run the statement after it for each item of @dp, assigned to @_k
+and @_v (void *s). It scans the table itself, no IterObject nor call
+per item. break and continue work as in a for loop. @dp mustn't be
+resized meanwhile. */
+#define DICT_FOREACH(dp, _k, _v) \
+    for (DictEntry *_dfe_ep = (dp)->table, \
+         *_dfe_end = _dfe_ep + (dp)->mask + 1; \
+         _dfe_ep < _dfe_end; _dfe_ep++) \
+        if (((_k) = _dfe_ep->key) == NULL || (_k) == DICT_DUMMY) \
+            ; \
+        else if (((_v) = _dfe_ep->value), 0) \
+            ; \
+        else
+
+/*parallel traversal on up to @nthreads threads, see parallel.h. @dp
+mustn't change meanwhile.
+dict_parallel_for calls fn(arg, key, value) for every item, from any of
+the threads at once.
+dict_parallel_reduce folds the items of each chunk of the table into an
+accumulator of @accsize bytes, zeroed and then given to @init unless it
+is NULL, by fn(acc, key, value). The calling thread then merges these
+into @acc, by merge(acc, chunk's acc), in table order. Returns -1 if out
+of memory, and nothing is called.
+*/
+void
+dict_parallel_for(DictObject *dp, size_t nthreads,
+                  void (*fn)(void *arg, void *key, void *value), void *arg);
+int
+dict_parallel_reduce(DictObject *dp, size_t nthreads, void *acc,
+                     size_t accsize, void (*init)(void *acc),
+                     void (*fn)(void *acc, void *key, void *value),
+                     void (*merge)(void *acc, void *other));
 
 /*other functions for printing or testing*/
 void dict_print_by_value_desc(DictObject *dp);
@@ -0,0 +1,134 @@
+#include <pthread.h>
+#include "xlib.h"
+
+/* the header sits right in front of an interned string */
+typedef struct {
+    size_t hash;
+    size_t len;
+} InternHeader;
+
+#define INTERN_HEAD(key) ((InternHeader *)(key) - 1)
+
+static DictObject *interned = NULL;
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* the same as dict.c's and set.c's default hash, so an interned key
+   hashes like the string it stands for */
+static size_t
+intern_strhash(void *_key) {
+    char *key = (char *)_key;
+    size_t hash = 5381;
+    for (; *key; key++)
+        hash = ((hash << 5) + hash) + *key; /* hash * 33 + c */
+    return hash;
+}
+
+static void
+intern_block_free(void *key) {
+    Mem_FREE(INTERN_HEAD(key));
+}
+
+/* key and value are the same block, freed with the key */
+static void
+intern_value_free(void *value) {
+    (void)value;
+}
+
+/* the interner's dict maps a string to its interned copy, which is
+   also the key. It lives for the rest of the process, so it takes the
+   global allocator and never a container allocator the caller of the
+   first intern_str happens to have set. */
+static DictObject *
+intern_dict(void) {
+    Allocator *old;
+    if (interned == NULL) {
+        old = mem_use_allocator(NULL);
+        interned = dict_cnew(0, intern_strhash, NULL, NULL, NULL, NULL,
+                             intern_block_free, intern_value_free);
+        mem_use_allocator(old);
+    }
+    return interned;
+}
+
+char *
+intern_str(const char *s) {
+    InternHeader *head;
+    char *key = NULL;
+    size_t len;
+    assert(s);
+    pthread_mutex_lock(&intern_lock);
+    if (intern_dict() == NULL)
+        goto done;
+    if ((key = (char *)dict_get(interned, (void *)s)) != NULL)
+        goto done;
+    len = strlen(s);
+    if (len > SSIZE_T_MAX - sizeof(InternHeader) - 1)
+        goto done;
+    head = (InternHeader *)Mem_MALLOC(sizeof(InternHeader) + len + 1);
+    if (head == NULL)
+        goto done;
+    key = (char *)(head + 1);
+    memcpy(key, s, len + 1);
+    head->hash = intern_strhash(key);
+    head->len = len;
+    /* a failed resize still leaves the key in the old table */
+    dict_radd(interned, key, key);
+done:
+    pthread_mutex_unlock(&intern_lock);
+    return key;
+}
+
+char *
+intern_lookup(const char *s) {
+    char *key = NULL;
+    assert(s);
+    pthread_mutex_lock(&intern_lock);
+    if (interned != NULL)
+        key = (char *)dict_get(interned, (void *)s);
+    pthread_mutex_unlock(&intern_lock);
+    return key;
+}
+
+size_t
+intern_len(void) {
+    size_t n;
+    pthread_mutex_lock(&intern_lock);
+    n = interned ? interned->used : 0;
+    pthread_mutex_unlock(&intern_lock);
+    return n;
+}
+
+void
+intern_clear(void) {
+    pthread_mutex_lock(&intern_lock);
+    if (interned != NULL) {
+        dict_free(interned);
+        interned = NULL;
+    }
+    pthread_mutex_unlock(&intern_lock);
+}
+
+size_t
+intern_strlen(const char *key) {
+    return INTERN_HEAD(key)->len;
+}
+
+size_t
+intern_keyhash(void *key) {
+    return INTERN_HEAD(key)->hash;
+}
+
+int
+intern_keycmp(void *key1, void *key2) {
+    return key1 == key2 ? 0 : (char *)key1 < (char *)key2 ? -1 : 1;
+}
+
+void *
+intern_keydup(void *key) {
+    return key;
+}
+
+void
+intern_keyfree(void *key) {
+    (void)key;
+}
@@ -0,0 +1,31 @@
+/* Global string interner. intern_str returns the one canonical copy of a
+string, so containers holding the same token share its memory. The
+copies live until intern_clear.
+
+A container opts into interned keys with
+
+    set_cnew(0, intern_keyhash, intern_keycmp, intern_keydup, intern_keyfree);
+
+(the same four for dict_cnew, rb_cnew and list_cnew). Its keys must then
+come from intern_str: the hash is read from the copy, equality is a
+pointer test and keys are never copied or freed by the container.
+intern_keycmp orders by address, so an rbtree of interned keys keeps
+them in no useful order; pass strcmp-like keycmp if the order matters.
+The interner is guarded by a mutex, the interned strings are read only. */
+
+/* the canonical copy of @s, NULL if out of memory */
+char *intern_str(const char *s);
+/* the canonical copy of @s if it was interned, else NULL */
+char *intern_lookup(const char *s);
+/* # strings interned */
+size_t intern_len(void);
+/* free every interned string, which must no longer be in use */
+void intern_clear(void);
+/* strlen of an interned string in O(1) */
+size_t intern_strlen(const char *key);
+
+/* callbacks of the interned keys mode */
+size_t intern_keyhash(void *key);
+int intern_keycmp(void *key1, void *key2);
+void *intern_keydup(void *key);
+void intern_keyfree(void *key);
@@ -7,16 +7,18 @@ default_keycmp(void *key1, void *key2) {
 
 static void *
 default_keydup(void *_key) {
-    int *key = (int*)malloc(sizeof(int));
+    int *key = Mem_NEW(int, 1);
+    if (key == NULL)
+        return NULL;
     *key = *(int *)_key;
     return (void *)key;
 }
 
 static int
-list_resize(ListObject *lp, int newsize) {
+list_resize(ListObject *lp, size_t newsize) {
     void **items;
     size_t new_allocated;
-    int allocated = lp->allocated;
+    size_t allocated = lp->allocated;
     /* Bypass realloc() when a previous overallocation is large enough
        to accommodate the newsize.  If the newsize falls lower than half
        the allocated size, then proceed with the realloc() to shrink the list.
@@ -26,6 +28,23 @@ list_resize(ListObject *lp, int newsize) {
         lp->used = newsize;
         return 0;
     }
+    /* Give the front slack left by list_popleft() back to the tail first,
+       realloc() must be passed the start of the block anyway. Only keep
+       the block as is if that leaves the usual over-allocation.
+    */
+    if (lp->offset) {
+        items = lp->table - lp->offset;
+        memmove(items, lp->table,
+                (lp->used < newsize ? lp->used : newsize) * sizeof(void *));
+        lp->table = items;
+        lp->allocated += lp->offset;
+        lp->offset = 0;
+        allocated = lp->allocated;
+        if (allocated >= newsize + (newsize >> 3) && newsize >= (allocated >> 1)) {
+            lp->used = newsize;
+            return 0;
+        }
+    }
     /* This over-allocates proportional to the list size, making room
      * for additional growth.  The over-allocation is mild, but is
      * enough to give linear-time amortized behavior over a long
@@ -44,7 +63,7 @@ list_resize(ListObject *lp, int newsize) {
         new_allocated = 0;
     items = lp->table;
     if (new_allocated <= (SIZE_MAX / sizeof(void *)))
-        Mem_RESIZE(items, void *, new_allocated);
+        Mem_ARESIZE(lp->allocator, items, void *, new_allocated);
     else
         items = NULL;
     if (items == NULL) {
@@ -56,13 +75,295 @@ list_resize(ListObject *lp, int newsize) {
     return 0;
 }
 
+/* Make room for at least one key in front of lp->table. The front slack
+   is proportional to the list size, so a sequence of appendleft() is
+   linear-time amortized just like append() is.
+*/
+static int
+list_grow_front(ListObject *lp) {
+    void **items;
+    size_t n = lp->used;
+    size_t front = (n >> 1) + 4;
+    if (lp->offset)
+        return 0;
+    /* check for integer overflow */
+    if (lp->allocated > SIZE_MAX - front)
+        return -1;
+    items = lp->table;
+    if (front + lp->allocated <= (SIZE_MAX / sizeof(void *)))
+        Mem_ARESIZE(lp->allocator, items, void *, front + lp->allocated);
+    else
+        items = NULL;
+    if (items == NULL)
+        return -1;
+    memmove(items + front, items, n * sizeof(void *));
+    lp->table = items + front;
+    lp->offset = front;
+    return 0;
+}
+
+static int
+slice_interpret(ssize_t n, ssize_t *start, ssize_t *stop, ssize_t step) {
+    if (step > 0) {
+        if (*start >= n) /*the result must be empty list, return directly */
+            return -1;
+        if (*start < 0)
+            *start += n;
+        if (*start < 0)
+            *start = 0;
+        if (*stop < 0)
+            *stop += n;
+        if (*stop <= 0) /*the result must be empty list, return directly */
+            return -1;
+        if (*stop > n)
+            *stop = n;
+    } else {
+        if (*start >= -n && *start <= -1)
+            *start += n;
+        if (*start > n - 1)
+            *start = n - 1;
+        if (*start < -n) /*the result must be empty list, return directly */
+            return -1;
+        if (*stop >= -n && *stop <= -1)
+            *stop += n;
+        if (*stop < -n)
+            *stop = -1;
+        if (*stop >= n - 1 ) /*the result must be empty list, return directly */
+            return -1;
+    }
+    return 0;
+}
+
+/* Value of lp->lookup->dict. @first is the position of the first equal
+   key, counted like ibase so the deque functions never touch it. Shifts
+   logged after @stamp are applied when the entry is read. If @lower,
+   @first is only a lower bound, list_index scans forward from it.
+*/
+typedef struct {
+    size_t count;
+    size_t first;
+    size_t stamp;
+    int lower;
+    Allocator *allocator;  /* the list's, see lookup_add */
+} LookupEntry;
+
+/* lookup_add makes the list's allocator the container allocator
+   around dict_fget, so the entries come from it like the rest of lp */
+static void *
+lookup_dvf(void) {
+    Allocator *a = MEM_CONTAINER_ALLOCATOR();
+    LookupEntry *e = (LookupEntry *)mem_calloc(a, 1, sizeof(LookupEntry));
+    if (e != NULL)
+        e->allocator = a;
+    return e;
+}
+
+static void
+lookup_entry_free(void *value) {
+    LookupEntry *e = (LookupEntry *)value;
+    Mem_AFREE(e->allocator, e);
+}
+
+/* apply the shifts logged since e was written. Returns -1 if some of them
+   have already dropped out of the log. */
+static int
+lookup_catch_up(ListLookup *lk, LookupEntry *e) {
+    size_t i;
+    if (lk->seq - e->stamp > LOOKUP_LOG)
+        return -1;
+    for (i = e->stamp; i < lk->seq; i++) {
+        ssize_t d = (ssize_t)(e->first - lk->shifts[i % LOOKUP_LOG].pos);
+        ssize_t delta = lk->shifts[i % LOOKUP_LOG].delta;
+        if (d < 0)
+            continue;
+        /* a lower bound inside a deleted range drops to its start */
+        if (delta < 0 && d < -delta)
+            e->first -= d;
+        else
+            e->first += delta;
+    }
+    e->stamp = lk->seq;
+    return 0;
+}
+
+/* position of e in lp. A lower bound left behind by popping the head may
+   point before table[0]. */
+static size_t
+lookup_pos(ListLookup *lk, LookupEntry *e) {
+    ssize_t i = (ssize_t)(e->first - lk->ibase);
+    return i < 0 ? 0 : (size_t)i;
+}
+
+/* rebuild every entry's position with two passes over lp */
+static void
+lookup_refresh(ListObject *lp) {
+    ListLookup *lk = lp->lookup;
+    LookupEntry *e;
+    size_t i, n = lp->used;
+    for (i = 0; i < n; i++) {
+        e = dict_get(lk->dict, lp->table[i]);
+        e->stamp = lk->seq;
+        e->lower = -1;
+    }
+    for (i = 0; i < n; i++) {
+        e = dict_get(lk->dict, lp->table[i]);
+        if (e->lower == -1) {
+            e->first = lk->ibase + i;
+            e->lower = 0;
+        }
+    }
+}
+
+/* count @key at pos in */
+static int
+lookup_add(ListObject *lp, void *key, size_t pos) {
+    ListLookup *lk = lp->lookup;
+    Allocator *old = mem_use_allocator(lp->allocator);
+    LookupEntry *e = dict_fget(lk->dict, key);
+    mem_use_allocator(old);
+    if (e == NULL)
+        return -1;
+    /* an entry too old to catch up stays stale until list_index
+       refreshes the whole index */
+    if (e->count++ == 0 || (lookup_catch_up(lk, e) == 0
+                            && lookup_pos(lk, e) > pos)) {
+        e->first = lk->ibase + pos;
+        e->stamp = lk->seq;
+        e->lower = 0;
+    }
+    return 0;
+}
+
+/* count @key at pos out. If it was the first one, the next equal key
+   will be found at @next or after. */
+static void
+lookup_discard(ListObject *lp, void *key, size_t pos, size_t next) {
+    ListLookup *lk = lp->lookup;
+    LookupEntry *e = dict_get(lk->dict, key);
+    assert(e);
+    if (--e->count == 0) {
+        dict_del(lk->dict, key);
+        return;
+    }
+    if (lookup_catch_up(lk, e) == 0 && e->first == lk->ibase + pos) {
+        e->first = lk->ibase + next;
+        e->lower = 1;
+    }
+}
+
+/* table[where:where + k] were just inserted into a list of n keys. */
+static int
+lookup_insert(ListObject *lp, size_t where, size_t k, size_t n) {
+    ListLookup *lk = lp->lookup;
+    size_t i, seq, ibase;
+    if (lk == NULL)
+        return 0;
+    seq = lk->seq;
+    ibase = lk->ibase;
+    if (where == 0 && n > 0) {
+        lk->ibase -= k;
+    } else if (where < n) {
+        lk->shifts[seq % LOOKUP_LOG].pos = ibase + where;
+        lk->shifts[seq % LOOKUP_LOG].delta = k;
+        lk->seq++;
+    }
+    for (i = 0; i < k; i++) {
+        if (lookup_add(lp, lp->table[where + i], where + i) == -1) {
+            while (i > 0) {
+                i--;
+                lookup_discard(lp, lp->table[where + i], where + i, where + i);
+            }
+            lk->ibase = ibase;
+            lk->seq = seq;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* table[start:start + k] of lp are about to be removed */
+static void
+lookup_remove(ListObject *lp, size_t start, size_t k) {
+    ListLookup *lk = lp->lookup;
+    size_t i, n = lp->used;
+    if (lk == NULL)
+        return;
+    for (i = start; i < start + k; i++)
+        lookup_discard(lp, lp->table[i], i, start ? start : k);
+    if (start == 0) {
+        lk->ibase += k;
+    } else if (start + k < n) {
+        lk->shifts[lk->seq % LOOKUP_LOG].pos = lk->ibase + start;
+        lk->shifts[lk->seq % LOOKUP_LOG].delta = -(ssize_t)k;
+        lk->seq++;
+    }
+}
+
+/* position of the first key equals to @key by the index */
+static size_t
+lookup_index(ListObject *lp, void *key) {
+    ListLookup *lk = lp->lookup;
+    LookupEntry *e = dict_get(lk->dict, key);
+    size_t i, n = lp->used;
+    void *k;
+    if (e == NULL)
+        return LIST_NOT_FOUND;
+    if (lookup_catch_up(lk, e) == -1) {
+        lookup_refresh(lp);
+        assert(e->lower == 0);
+    }
+    if (e->lower) {
+        for (i = lookup_pos(lk, e); i < n; i++) {
+            k = lp->table[i];
+            if (k == key || lp->keycmp(key, k) == 0)
+                break;
+        }
+        assert(i < n);
+        e->first = lk->ibase + i;
+        e->lower = 0;
+    }
+    return e->first - lk->ibase;
+}
+
+/* remove table[start:start + k] without freeing or indexing, used to
+   roll back an insertion */
+static void
+list_cut(ListObject *lp, size_t start, size_t k) {
+    size_t n = lp->used;
+    memmove(lp->table + start, lp->table + start + k,
+            (n - start - k) * sizeof(void *));
+    list_resize(lp, n - k);
+}
+
+static int
+lookup_new(ListObject *lp, size_t (*keyhash)(void *key)) {
+    ListLookup *lk = Mem_ANEW(lp->allocator, ListLookup, 1);
+    if (lk == NULL)
+        return -1;
+    /* the index's table comes from lp's allocator too */
+    lk->dict = dict_anew(lp->allocator, lp->used, keyhash, lp->keycmp,
+                         lp->keydup, NULL, lookup_dvf, lp->keyfree,
+                         lookup_entry_free);
+    if (lk->dict == NULL) {
+        Mem_AFREE(lp->allocator, lk);
+        return -1;
+    }
+    lk->ibase = 0;
+    lk->seq = 0;
+    lp->lookup = lk;
+    return lookup_insert(lp, 0, lp->used, 0);
+}
+
 ListObject *
-list_cnew(size_t size,
+list_anew(Allocator *a,
+          size_t size,
           int (*keycmp)(void *key1, void *key2),
           void *(*keydup)(void *key),
           void (*keyfree)(void *key)) {
     ListObject *lp;
     size_t nbytes;
+    if (a == NULL)
+        a = mem_allocator;
     if (size < 0) {
         return NULL;
     }
@@ -71,58 +372,104 @@ list_cnew(size_t size,
     if ((size_t)size > SIZE_MAX / sizeof(void *))
         return NULL;
     nbytes = size * sizeof(void *);
-    lp = (ListObject *)malloc(sizeof(ListObject));
+    lp = Mem_ANEW(a, ListObject, 1);
     if (lp == NULL)
         return NULL;
     if (size == 0)
         lp->table = NULL;
     else {
-        lp->table = (void **) Mem_MALLOC(nbytes);
+        lp->table = (void **) Mem_AMALLOC(a, nbytes);
         if (lp->table == NULL) {
-            free(lp);
+            Mem_AFREE(a, lp);
             return NULL;
         }
         memset(lp->table, 0, nbytes);
     }
+    lp->allocator = a;
     lp->type = LIST;
     lp->used = size;
     lp->allocated = size;
+    lp->offset = 0;
+    lp->lookup = NULL;
     lp->keycmp = keycmp ? keycmp : default_keycmp;
     lp->keydup = keydup ? keydup : default_keydup;
-    lp->keyfree = keyfree ? keyfree : free;
+    lp->keyfree = keyfree ? keyfree : mem_free;
+    return lp;
+}
+
+ListObject *
+list_cnew(size_t size,
+          int (*keycmp)(void *key1, void *key2),
+          void *(*keydup)(void *key),
+          void (*keyfree)(void *key)) {
+    return list_anew(MEM_CONTAINER_ALLOCATOR(), size, keycmp, keydup,
+                     keyfree);
+}
+
+ListObject *
+list_cnew_indexed(size_t size,
+                  size_t (*keyhash)(void *key),
+                  int (*keycmp)(void *key1, void *key2),
+                  void *(*keydup)(void *key),
+                  void (*keyfree)(void *key)) {
+    ListObject *lp;
+    assert(keyhash);
+    lp = list_cnew(size, keycmp, keydup, keyfree);
+    if (lp == NULL)
+        return NULL;
+    lp->used = 0;
+    if (lookup_new(lp, keyhash) == -1) {
+        list_free(lp);
+        return NULL;
+    }
     return lp;
 }
 
 ListObject *
 list_new(void) {
-    ListObject *lp = Mem_NEW(ListObject, 1);
+    Allocator *a = MEM_CONTAINER_ALLOCATOR();
+    ListObject *lp = Mem_ANEW(a, ListObject, 1);
     if (lp == NULL)
         return NULL;
+    lp->allocator = a;
     lp->table = NULL;
     lp->type = LIST;
     lp->used = 0;
     lp->allocated = 0;
+    lp->offset = 0;
+    lp->lookup = NULL;
     lp->keycmp = default_keycmp;
     lp->keydup = default_keydup;
-    lp->keyfree = free;
+    lp->keyfree = mem_free;
     return lp;
 }
 
 void
 list_clear(ListObject *lp) {
-    int n = lp->used;
+    ssize_t n = lp->used;
     while (--n >= 0)
         lp->keyfree(lp->table[n]);
-    free(lp->table);
+    if (lp->table)
+        Mem_AFREE(lp->allocator, lp->table - lp->offset);
     lp->used = 0;
     lp->allocated = 0;
+    lp->offset = 0;
     lp->table = NULL;
+    if (lp->lookup) {
+        dict_clear(lp->lookup->dict);
+        lp->lookup->ibase = 0;
+        lp->lookup->seq = 0;
+    }
 }
 
 int
 list_free(ListObject *lp) {
     list_clear(lp);
-    free(lp);
+    if (lp->lookup) {
+        dict_free(lp->lookup->dict);
+        Mem_AFREE(lp->allocator, lp->lookup);
+    }
+    Mem_AFREE(lp->allocator, lp);
     return 0;
 }
 
@@ -141,6 +488,10 @@ list_copy(ListObject *lp) {
         }
         nlp->table[i] = lpk;
     }
+    if (lp->lookup && lookup_new(nlp, lp->lookup->dict->keyhash) == -1) {
+        list_free(nlp);
+        return NULL;
+    }
     return nlp;
 }
 
@@ -155,8 +506,8 @@ list_is_empty(ListObject *lp) {
 }
 
 void *
-list_get(ListObject *lp, int index) {
-    size_t n = lp->used;
+list_get(ListObject *lp, ssize_t index) {
+    ssize_t n = lp->used;
     if (index < 0)
         index += n;
     if (index < 0 || index >= n) {
@@ -166,9 +517,9 @@ list_get(ListObject *lp, int index) {
 }
 
 int
-list_set(ListObject *lp, int index, void *key) {
+list_set(ListObject *lp, ssize_t index, void *key) {
     assert(key);
-    size_t n = lp->used;
+    ssize_t n = lp->used;
     if (index < 0)
         index += n;
     if (index < 0 || index >= n) {
@@ -178,33 +529,43 @@ list_set(ListObject *lp, int index, void *key) {
     if (new_v == NULL) {
         return -1;
     }
+    if (lp->lookup) {
+        if (lookup_add(lp, new_v, index) == -1) {
+            lp->keyfree(new_v);
+            return -1;
+        }
+        lookup_discard(lp, lp->table[index], index, index);
+    }
     lp->table[index] = new_v;
     return 0;
 }
 
-int list_rset(ListObject *lp, int index, void *key) {
+int list_rset(ListObject *lp, ssize_t index, void *key) {
     assert(key);
-    size_t n = lp->used;
+    ssize_t n = lp->used;
     if (index < 0)
         index += n;
     if (index < 0 || index >= n) {
         return -1;
     }
+    if (lp->lookup) {
+        if (lookup_add(lp, key, index) == -1)
+            return -1;
+        lookup_discard(lp, lp->table[index], index, index);
+    }
     lp->table[index] = key;
     return 0;
 }
 
 /* insert v's reference before where */
 int
-list_rinsert(ListObject *lp, int where, void *v) {
+list_rinsert(ListObject *lp, ssize_t where, void *v) {
     assert(v);
-    int i, n = lp->used;
+    ssize_t n = lp->used;
     void **items;
     if (n == SSIZE_T_MAX) {
         return -1;
     }
-    if (list_resize(lp, n + 1) == -1)
-        return -1;
     if (where < 0) {
         where += n;
         if (where < 0)
@@ -212,18 +573,36 @@ list_rinsert(ListObject *lp, int where, void *v) {
     }
     if (where > n)
         where = n;
-    items = lp->table;
-    for (i = n; --i >= where; )
-        items[i + 1] = items[i];
-    items[where] = v;
+    if (where < n - where) {
+        /* closer to the head, move the front part into the front slack */
+        if (list_grow_front(lp) == -1)
+            return -1;
+        lp->table--;
+        lp->offset--;
+        lp->allocated++;
+        lp->used++;
+        items = lp->table;
+        memmove(items, items + 1, where * sizeof(void *));
+        items[where] = v;
+    } else {
+        if (list_resize(lp, n + 1) == -1)
+            return -1;
+        items = lp->table;
+        memmove(items + where + 1, items + where, (n - where) * sizeof(void *));
+        items[where] = v;
+    }
+    if (lookup_insert(lp, where, 1, n) == -1) {
+        list_cut(lp, where, 1);
+        return -1;
+    }
     return 0;
 }
 
 /* insert v's copy before where */
 int
-list_insert(ListObject *lp, int where, void *v) {
+list_insert(ListObject *lp, ssize_t where, void *v) {
     assert(v);
-    int n = lp->used;
+    ssize_t n = lp->used;
     void *new_v;
     if (n == SSIZE_T_MAX) {
         return -1;
@@ -243,7 +622,7 @@ list_insert(ListObject *lp, int where, void *v) {
 int
 list_add(ListObject *lp, void *v) {
     assert(v);
-    int n = lp->used;
+    ssize_t n = lp->used;
     if (n == SSIZE_T_MAX) {
         return -1;
     }
@@ -256,6 +635,11 @@ list_add(ListObject *lp, void *v) {
         return -1;
     }
     lp->table[n] = new_v;
+    if (lookup_insert(lp, n, 1, n) == -1) {
+        list_resize(lp, n);
+        lp->keyfree(new_v);
+        return -1;
+    }
     return 0;
 }
 
@@ -263,7 +647,7 @@ list_add(ListObject *lp, void *v) {
 int
 list_radd(ListObject *lp, void *v) {
     assert(v);
-    int n = lp->used;
+    ssize_t n = lp->used;
     if (n == SSIZE_T_MAX) {
         return -1;
     }
@@ -271,6 +655,10 @@ list_radd(ListObject *lp, void *v) {
         return -1;
     }
     lp->table[n] = v;
+    if (lookup_insert(lp, n, 1, n) == -1) {
+        list_resize(lp, n);
+        return -1;
+    }
     return 0;
 }
 
@@ -281,6 +669,187 @@ list_pop(ListObject *lp) {
     if (n == 0)
         return NULL;
     void *v = lp->table[n - 1];
+    lookup_remove(lp, n - 1, 1);
+    if (list_resize(lp, n - 1) == -1) {
+        return NULL;
+    }
+    return v;
+}
+
+/* insert references of keys[0:k] before where, shifting the tail once */
+int
+list_rinsert_many(ListObject *lp, ssize_t where, void **keys, size_t k) {
+    ssize_t n = lp->used;
+    if (k == 0)
+        return 0;
+    if (k > (size_t)(SSIZE_T_MAX - n)) {
+        return -1;
+    }
+    if (where < 0) {
+        where += n;
+        if (where < 0)
+            where = 0;
+    }
+    if (where > n)
+        where = n;
+    if (list_resize(lp, n + k) == -1)
+        return -1;
+    memmove(lp->table + where + k, lp->table + where,
+            (n - where) * sizeof(void *));
+    memcpy(lp->table + where, keys, k * sizeof(void *));
+    if (lookup_insert(lp, where, k, n) == -1) {
+        list_cut(lp, where, k);
+        return -1;
+    }
+    return 0;
+}
+
+/* insert copies of keys[0:k] before where. keys must not point into
+   lp->table, which may move. */
+int
+list_insert_many(ListObject *lp, ssize_t where, void **keys, size_t k) {
+    ssize_t n = lp->used;
+    size_t i;
+    void **items;
+    if (k == 0)
+        return 0;
+    if (k > (size_t)(SSIZE_T_MAX - n)) {
+        return -1;
+    }
+    if (where < 0) {
+        where += n;
+        if (where < 0)
+            where = 0;
+    }
+    if (where > n)
+        where = n;
+    if (list_resize(lp, n + k) == -1)
+        return -1;
+    items = lp->table;
+    memmove(items + where + k, items + where, (n - where) * sizeof(void *));
+    for (i = 0; i < k; i++) {
+        if ((items[where + i] = lp->keydup(keys[i])) == NULL) {
+            /* roll back, lp is left as it was */
+            while (i > 0)
+                lp->keyfree(items[where + --i]);
+            list_cut(lp, where, k);
+            return -1;
+        }
+    }
+    if (lookup_insert(lp, where, k, n) == -1) {
+        for (i = 0; i < k; i++)
+            lp->keyfree(items[where + i]);
+        list_cut(lp, where, k);
+        return -1;
+    }
+    return 0;
+}
+
+/* append copies of keys[0:k] to lp with one resize */
+int
+list_extend_from_array(ListObject *lp, void **keys, size_t k) {
+    return list_insert_many(lp, lp->used, keys, k);
+}
+
+/* append copies of other's keys to lp */
+int
+list_extend(ListObject *lp, ListObject *other) {
+    ListView view;
+    if (lp != other)
+        return list_insert_many(lp, lp->used, other->table, other->used);
+    list_view(other, 0, other->used, 1, &view);
+    return list_extend_view(lp, &view);
+}
+
+int
+list_extend_move(ListObject *lp, ListObject *other) {
+    assert(lp != other);
+    if (list_rinsert_many(lp, lp->used, other->table, other->used) == -1)
+        return -1;
+    /* the keys are lp's now, clear other without freeing them */
+    other->used = 0;
+    list_clear(other);
+    return 0;
+}
+
+int
+list_extend_view(ListObject *lp, ListView *view) {
+    size_t i, n = lp->used, k = view->len;
+    if (k > SIZE_MAX - n)
+        return -1;
+    /* view may be over lp itself, its table moves with the resize, so
+       read through the view only afterwards */
+    if (list_resize(lp, n + k) == -1)
+        return -1;
+    for (i = 0; i < k; i++) {
+        if ((lp->table[n + i] = lp->keydup(LIST_VIEW_ITEM(view, i))) == NULL) {
+            while (i > 0)
+                lp->keyfree(lp->table[n + --i]);
+            list_resize(lp, n);
+            return -1;
+        }
+    }
+    if (lookup_insert(lp, n, k, n) == -1) {
+        for (i = 0; i < k; i++)
+            lp->keyfree(lp->table[n + i]);
+        list_resize(lp, n);
+        return -1;
+    }
+    return 0;
+}
+
+/* add v's reference to the front of lp */
+int
+list_rappendleft(ListObject *lp, void *v) {
+    assert(v);
+    size_t n = lp->used;
+    if (n == SSIZE_T_MAX) {
+        return -1;
+    }
+    if (list_grow_front(lp) == -1)
+        return -1;
+    lp->table--;
+    lp->offset--;
+    lp->allocated++;
+    lp->used++;
+    lp->table[0] = v;
+    if (lookup_insert(lp, 0, 1, n) == -1) {
+        lp->table++;
+        lp->offset++;
+        lp->allocated--;
+        lp->used--;
+        return -1;
+    }
+    return 0;
+}
+
+/* add v's copy to the front of lp */
+int
+list_appendleft(ListObject *lp, void *v) {
+    assert(v);
+    void *new_v = (void*)lp->keydup(v);
+    if (new_v == NULL) {
+        return -1;
+    }
+    if (list_rappendleft(lp, new_v) == -1) {
+        lp->keyfree(new_v);
+        return -1;
+    }
+    return 0;
+}
+
+/* pop the first key out of lp */
+void *
+list_popleft(ListObject *lp) {
+    size_t n = lp->used;
+    if (n == 0)
+        return NULL;
+    void *v = lp->table[0];
+    lookup_remove(lp, 0, 1);
+    lp->table++;
+    lp->offset++;
+    lp->allocated--;
+    lp->used--;
     if (list_resize(lp, n - 1) == -1) {
         return NULL;
     }
@@ -289,8 +858,8 @@ list_pop(ListObject *lp) {
 
 /* pop index th key out of lp */
 void *
-list_popi(ListObject *lp, int index) {
-    int i, n = lp->used;
+list_popi(ListObject *lp, ssize_t index) {
+    ssize_t n = lp->used;
     void *v;
     if (index < 0)
         index += n;
@@ -298,8 +867,18 @@ list_popi(ListObject *lp, int index) {
         return NULL;
     }
     v = lp->table[index];
-    for (i = index + 1; i < n; i++) {
-        lp->table[i - 1] = lp->table[i];
+    lookup_remove(lp, index, 1);
+    if (index < n - 1 - index) {
+        /* closer to the head, shift the front part and leave the hole
+           as front slack */
+        memmove(lp->table + 1, lp->table, index * sizeof(void *));
+        lp->table++;
+        lp->offset++;
+        lp->allocated--;
+        lp->used--;
+    } else {
+        memmove(lp->table + index, lp->table + index + 1,
+                (n - index - 1) * sizeof(void *));
     }
     if (list_resize(lp, n - 1) == -1) {
         return NULL;
@@ -308,7 +887,7 @@ list_popi(ListObject *lp, int index) {
 }
 
 int
-list_del(ListObject *lp, int index) {
+list_del(ListObject *lp, ssize_t index) {
     void *v = list_popi(lp, index);
     if (v == NULL)
         return -1;
@@ -316,38 +895,70 @@ list_del(ListObject *lp, int index) {
     return 0;
 }
 
+/* delete keys in [start, stop), the same as python's del lp[start:stop] */
+int
+list_del_range(ListObject *lp, ssize_t start, ssize_t stop) {
+    ssize_t i, k, n = lp->used;
+    if (slice_interpret(n, &start, &stop, 1) == -1 || start >= stop)
+        return 0;
+    k = stop - start;
+    lookup_remove(lp, start, k);
+    for (i = start; i < stop; i++)
+        lp->keyfree(lp->table[i]);
+    if (start < n - stop) {
+        /* fewer keys before the range, move them into the front slack */
+        memmove(lp->table + k, lp->table, start * sizeof(void *));
+        lp->table += k;
+        lp->offset += k;
+        lp->allocated -= k;
+        lp->used -= k;
+    } else {
+        memmove(lp->table + start, lp->table + stop,
+                (n - stop) * sizeof(void *));
+    }
+    return list_resize(lp, n - k);
+}
+
+/* index of the first key equals to @key, LIST_NOT_FOUND if none */
 size_t
 list_index(ListObject *lp, void *key) {
     size_t i, n = lp->used;
     void *k;
+    if (lp->lookup)
+        return lookup_index(lp, key);
     for(i = 0; i < n; i++) {
         k = lp->table[i];
         if(k == key || lp->keycmp(key, k) == 0)
             return i;
     }
-    return -1;
+    return LIST_NOT_FOUND;
 }
 
 int
 list_remove(ListObject *lp, void *key) {
-    size_t i, n = lp->used;
-    void *k;
-    for(i = 0; i < n; i++) {
-        k = lp->table[i];
-        if(k == key || lp->keycmp(key, k) == 0)
-            if (list_del(lp,i)==-1)
-                return -1;
-            else
-                return 0;
+    size_t i = list_index(lp, key);
+    if (i == LIST_NOT_FOUND) {
+        assert(0);/* raise key not found error */
+        return -1;
     }
-    assert(0);/* raise key not found error */
-    return -1;
+    return list_del(lp, i);
+}
+
+int
+list_has(ListObject *lp, void *key) {
+    if (lp->lookup)
+        return dict_get(lp->lookup->dict, key) != NULL;
+    return list_index(lp, key) != LIST_NOT_FOUND;
 }
 
 size_t
 list_count(ListObject *lp, void *key) {
     size_t i, result = 0, n = lp->used;
     void *k;
+    if (lp->lookup) {
+        LookupEntry *e = dict_get(lp->lookup->dict, key);
+        return e ? e->count : 0;
+    }
     for(i = 0; i < n; i++) {
         k = lp->table[i];
         if(k == key || lp->keycmp(key, k) == 0)
@@ -356,73 +967,135 @@ list_count(ListObject *lp, void *key) {
     return result;
 }
 
-static int
-slice_interpret(int n, int *start, int *stop, int step) {
-    if (step > 0) {
-        if (*start >= n) /*the result must be empty list, return directly */
-            return -1;
-        if (*start < 0)
-            *start += n;
-        if (*start < 0)
-            *start = 0;
-        if (*stop < 0)
-            *stop += n;
-        if (*stop <= 0) /*the result must be empty list, return directly */
-            return -1;
-        if (*stop > n)
-            *stop = n;
-    } else {
-        if (*start >= -n && *start <= -1)
-            *start += n;
-        if (*start > n - 1)
-            *start = n - 1;
-        if (*start < -n) /*the result must be empty list, return directly */
-            return -1;
-        if (*stop >= -n && *stop <= -1)
-            *stop += n;
-        if (*stop < -n)
-            *stop = -1;
-        if (*stop >= n - 1 ) /*the result must be empty list, return directly */
-            return -1;
+/* an empty-handed list of k slots for a slice result, left uninitialized
+   since the caller fills every slot */
+static ListObject *
+slice_new(ListObject *lp, size_t k) {
+    ListObject *nlp = list_cnew(0, lp->keycmp, lp->keydup, lp->keyfree);
+    if (nlp == NULL || k == 0)
+        return nlp;
+    nlp->table = Mem_ANEW(nlp->allocator, void *, k);
+    if (nlp->table == NULL) {
+        list_free(nlp);
+        return NULL;
     }
-    return 0;
+    nlp->used = k;
+    nlp->allocated = k;
+    return nlp;
+}
+
+/* # of keys picked by an interpreted slice */
+static size_t
+slice_length(ssize_t start, ssize_t stop, ssize_t step) {
+    if (step > 0)
+        return start < stop ? (stop - start - 1) / step + 1 : 0;
+    return start > stop ? (start - stop - 1) / -step + 1 : 0;
+}
+
+ListObject *
+list_rsslice(ListObject *lp, ssize_t start, ssize_t stop, ssize_t step) {
+    ListView view;
+    list_view(lp, start, stop, step, &view);
+    return list_view_rcopy(&view);
+}
+
+ListObject *
+list_sslice(ListObject *lp, ssize_t start, ssize_t stop, ssize_t step) {
+    ListView view;
+    list_view(lp, start, stop, step, &view);
+    return list_view_copy(&view);
+}
+
+ListObject *
+list_rslice(ListObject *lp, ssize_t start, ssize_t stop) {
+    return list_rsslice(lp, start, stop, 1);
 }
 
 ListObject *
-list_rsslice(ListObject *lp, int start, int stop, int step) {
+list_slice(ListObject *lp, ssize_t start, ssize_t stop) {
+    return list_sslice(lp, start, stop, 1);
+}
+
+void
+list_view(ListObject *lp, ssize_t start, ssize_t stop, ssize_t step,
+          ListView *view) {
     assert(step != 0);
-    ListObject *nlp = list_cnew(0, lp->keycmp, lp->keydup, lp->keyfree);
-    if (nlp == NULL)
+    view->base = lp;
+    view->step = step;
+    if (slice_interpret(lp->used, &start, &stop, step) == -1) {
+        view->start = 0;
+        view->len = 0;
+        return;
+    }
+    view->start = start;
+    view->len = slice_length(start, stop, step);
+}
+
+void
+list_view_slice(ListView *view, ssize_t start, ssize_t stop, ssize_t step,
+                ListView *sub) {
+    assert(step != 0);
+    sub->base = view->base;
+    sub->step = view->step * step;
+    if (slice_interpret(view->len, &start, &stop, step) == -1) {
+        sub->start = 0;
+        sub->len = 0;
+        return;
+    }
+    sub->start = view->start + start * view->step;
+    sub->len = slice_length(start, stop, step);
+}
+
+size_t
+list_view_len(ListView *view) {
+    return view->len;
+}
+
+void *
+list_view_get(ListView *view, ssize_t index) {
+    ssize_t n = view->len;
+    if (index < 0)
+        index += n;
+    if (index < 0 || index >= n) {
         return NULL;
-    size_t n = lp->used;
-    if (slice_interpret(n, &start, &stop, step) == -1)
+    }
+    return LIST_VIEW_ITEM(view, index);
+}
+
+size_t
+list_view_walk(ListView *view, size_t *pos, void **key_addr) {
+    if (*pos >= view->len)
+        return 0;
+    *key_addr = LIST_VIEW_ITEM(view, *pos);
+    (*pos)++;
+    return 1;
+}
+
+ListObject *
+list_view_rcopy(ListView *view) {
+    size_t i, k = view->len;
+    ListObject *nlp = slice_new(view->base, k);
+    if (nlp == NULL || k == 0)
+        return nlp;
+    if (view->step == 1) {
+        memcpy(nlp->table, view->base->table + view->start, k * sizeof(void *));
         return nlp;
-    void *k;
-    int factor = step > 0 ? 1 : -1;
-    for(; start * factor < stop * factor; start += step) {
-        k = lp->table[start];
-        if (list_radd(nlp, k) == -1) {
-            free(nlp); /*free nlp directly, or will infect the lp.*/
-            return NULL;
-        }
     }
+    for (i = 0; i < k; i++)
+        nlp->table[i] = LIST_VIEW_ITEM(view, i);
     return nlp;
 }
 
 ListObject *
-list_sslice(ListObject *lp, int start, int stop, int step) {
-    assert(step != 0);
-    ListObject *nlp = list_cnew(0, lp->keycmp, lp->keydup, lp->keyfree);
+list_view_copy(ListView *view) {
+    size_t i, k = view->len;
+    ListObject *lp = view->base;
+    ListObject *nlp = slice_new(lp, k);
     if (nlp == NULL)
         return NULL;
-    size_t n = lp->used;
-    if (slice_interpret(n, &start, &stop, step) == -1)
-        return nlp;
-    void *k;
-    int factor = step > 0 ? 1 : -1;
-    for(; start * factor < stop * factor; start += step) {
-        k = lp->table[start];
-        if (list_add(nlp, k) == -1) {
+    for (i = 0; i < k; i++) {
+        if ((nlp->table[i] = lp->keydup(LIST_VIEW_ITEM(view, i))) == NULL) {
+            nlp->used = i; /* only free the copies made so far */
             list_free(nlp);
             return NULL;
         }
@@ -430,27 +1103,23 @@ list_sslice(ListObject *lp, int start, int stop, int step) {
     return nlp;
 }
 
-ListObject *
-list_rslice(ListObject *lp, int start, int stop) {
-    return list_rsslice(lp, start, stop, 1);
-}
-
-ListObject *
-list_slice(ListObject *lp, int start, int stop) {
-    return list_sslice(lp, start, stop, 1);
-}
-
 IterObject *
 list_iter_new(ListObject * lp) {
     IterObject *lio;
     lio = (IterObject*)malloc(sizeof(IterObject));
     if (lio == NULL)
         return NULL;
+    list_iter_init(lp, lio);
+    return lio;
+}
+
+void
+list_iter_init(ListObject *lp, IterObject *lio) {
     lio->object = (void*)lp;
-    lio->inipos = *lp->table;
+    lio->inipos = lp->used ? lp->table[0] : NULL;
     lio->rest = lp->used;
+    lio->endpos = lp->table + lp->used;
     lio->type = LIST;
-    return lio;
 }
 
 size_t
@@ -460,16 +1129,28 @@ list_iter_walk(IterObject * lio, void **key_addr) {
     ListObject* lp = (ListObject*)lio->object;
     *key_addr = lio->inipos;
     lio->rest--;
-    lio->inipos = lp->table[lp->used - lio->rest];
+    lio->inipos = lio->rest ? lp->table[lp->used - lio->rest] : NULL;
     return 1;
 }
 
+size_t
+list_iter_next_batch(IterObject *lio, void **keys, size_t n) {
+    ListObject *lp = (ListObject *)lio->object;
+    size_t start = lp->used - lio->rest;
+    if (n > lio->rest)
+        n = lio->rest;
+    if (n == 0)
+        return 0;
+    memcpy(keys, lp->table + start, n * sizeof(void *));
+    lio->rest -= n;
+    if (lio->rest)
+        lio->inipos = lp->table[start + n];
+    return n;
+}
+
 void
 list_iter_flush(IterObject * lio) {
-    ListObject *lp = (ListObject *)lio->object;
-    lio->inipos = *lp->table;
-    lio->rest = lp->used;
-    lio->type = LIST;
+    list_iter_init((ListObject *)lio->object, lio);
 }
 
 void
@@ -490,11 +1171,633 @@ list_print(ListObject *lp) {
         return;
     }
     void *key;
-    IterObject *lio = iter(lp);
     printf("[");
-    while(iterw(lio, &key)) {
+    LIST_FOREACH(lp, key) {
         printf("%d, ", *(int*)key);
     }
-    free(lio);
+    printf("]\n\n");
+}
+
+/* unboxed lists */
+
+static const size_t list_titemsizes[] = {
+    sizeof(int32_t), sizeof(int64_t), sizeof(double)
+};
+
+/* same over-allocation as list_resize(), counted in elements */
+static int
+list_tresize(TListObject *tp, size_t newsize) {
+    char *items;
+    size_t new_allocated;
+    size_t allocated = tp->allocated;
+    if (allocated >= newsize && newsize >= (allocated >> 1)) {
+        assert(tp->table != NULL || newsize == 0);
+        tp->used = newsize;
+        return 0;
+    }
+    new_allocated = (newsize >> 3) + (newsize < 9 ? 3 : 6);
+    /* check for integer overflow */
+    if (new_allocated > SIZE_MAX - newsize) {
+        return -1;
+    } else {
+        new_allocated += newsize;
+    }
+    if (newsize == 0)
+        new_allocated = 0;
+    items = tp->table;
+    if (new_allocated <= (SIZE_MAX / tp->itemsize))
+        Mem_ARESIZE(tp->allocator, items, char, new_allocated * tp->itemsize);
+    else
+        items = NULL;
+    if (items == NULL) {
+        return -1;
+    }
+    tp->table = items;
+    tp->used = newsize;
+    tp->allocated = new_allocated;
+    return 0;
+}
+
+TListObject *
+list_tcnew(ListItemType itemtype, size_t size) {
+    TListObject *tp;
+    Allocator *a = MEM_CONTAINER_ALLOCATOR();
+    size_t itemsize;
+    assert(itemtype >= LIST_INT32 && itemtype <= LIST_DOUBLE);
+    itemsize = list_titemsizes[itemtype];
+    if (size > SSIZE_T_MAX / itemsize)
+        return NULL;
+    tp = Mem_ANEW(a, TListObject, 1);
+    if (tp == NULL)
+        return NULL;
+    tp->allocator = a;
+    if (size == 0)
+        tp->table = NULL;
+    else {
+        tp->table = (char *)mem_calloc(a, size, itemsize);
+        if (tp->table == NULL) {
+            Mem_AFREE(a, tp);
+            return NULL;
+        }
+    }
+    tp->itemtype = itemtype;
+    tp->itemsize = itemsize;
+    tp->used = size;
+    tp->allocated = size;
+    return tp;
+}
+
+TListObject *
+list_tnew(ListItemType itemtype) {
+    return list_tcnew(itemtype, 0);
+}
+
+void
+list_tclear(TListObject *tp) {
+    Mem_AFREE(tp->allocator, tp->table);
+    tp->table = NULL;
+    tp->used = 0;
+    tp->allocated = 0;
+}
+
+int
+list_tfree(TListObject *tp) {
+    list_tclear(tp);
+    Mem_AFREE(tp->allocator, tp);
+    return 0;
+}
+
+TListObject *
+list_tcopy(TListObject *tp) {
+    return list_tsslice(tp, 0, SSIZE_T_MAX, 1);
+}
+
+size_t
+list_tlen(TListObject *tp) {
+    return tp->used;
+}
+
+int
+list_tget(TListObject *tp, ssize_t index, void *out) {
+    ssize_t n = tp->used;
+    if (index < 0)
+        index += n;
+    if (index < 0 || index >= n) {
+        return -1;
+    }
+    memcpy(out, tp->table + index * tp->itemsize, tp->itemsize);
+    return 0;
+}
+
+int
+list_tset(TListObject *tp, ssize_t index, void *value) {
+    ssize_t n = tp->used;
+    if (index < 0)
+        index += n;
+    if (index < 0 || index >= n) {
+        return -1;
+    }
+    memcpy(tp->table + index * tp->itemsize, value, tp->itemsize);
+    return 0;
+}
+
+int
+list_tadd(TListObject *tp, void *value) {
+    size_t n = tp->used;
+    if (list_tresize(tp, n + 1) == -1)
+        return -1;
+    memcpy(tp->table + n * tp->itemsize, value, tp->itemsize);
+    return 0;
+}
+
+int
+list_tpop(TListObject *tp, void *out) {
+    size_t n = tp->used;
+    if (n == 0)
+        return -1;
+    memcpy(out, tp->table + (n - 1) * tp->itemsize, tp->itemsize);
+    return list_tresize(tp, n - 1);
+}
+
+int
+list_tinsert(TListObject *tp, ssize_t where, void *value) {
+    ssize_t n = tp->used;
+    size_t size = tp->itemsize;
+    if (where < 0) {
+        where += n;
+        if (where < 0)
+            where = 0;
+    }
+    if (where > n)
+        where = n;
+    if (list_tresize(tp, n + 1) == -1)
+        return -1;
+    memmove(tp->table + (where + 1) * size, tp->table + where * size,
+            (n - where) * size);
+    memcpy(tp->table + where * size, value, size);
+    return 0;
+}
+
+int
+list_tdel(TListObject *tp, ssize_t index) {
+    ssize_t n = tp->used;
+    size_t size = tp->itemsize;
+    if (index < 0)
+        index += n;
+    if (index < 0 || index >= n) {
+        return -1;
+    }
+    memmove(tp->table + index * size, tp->table + (index + 1) * size,
+            (n - index - 1) * size);
+    return list_tresize(tp, n - 1);
+}
+
+int
+list_textend_from_array(TListObject *tp, void *values, size_t k) {
+    size_t n = tp->used;
+    if (k == 0)
+        return 0;
+    if (k > SIZE_MAX - n || list_tresize(tp, n + k) == -1)
+        return -1;
+    memcpy(tp->table + n * tp->itemsize, values, k * tp->itemsize);
+    return 0;
+}
+
+TListObject *
+list_tsslice(TListObject *tp, ssize_t start, ssize_t stop, ssize_t step) {
+    assert(step != 0);
+    size_t i, k, n = tp->used, size = tp->itemsize;
+    TListObject *ntp;
+    if (slice_interpret(n, &start, &stop, step) == -1)
+        k = 0;
+    else
+        k = slice_length(start, stop, step);
+    ntp = list_tnew(tp->itemtype);
+    if (ntp == NULL || k == 0)
+        return ntp;
+    if (list_tresize(ntp, k) == -1) {
+        list_tfree(ntp);
+        return NULL;
+    }
+    if (step == 1) {
+        memcpy(ntp->table, tp->table + start * size, k * size);
+        return ntp;
+    }
+    for (i = 0; i < k; i++, start += step)
+        memcpy(ntp->table + i * size, tp->table + start * size, size);
+    return ntp;
+}
+
+TListObject *
+list_tslice(TListObject *tp, ssize_t start, ssize_t stop) {
+    return list_tsslice(tp, start, stop, 1);
+}
+
+/* Scanning kernels of unboxed lists. Every kernel has a scalar version,
+   on x86 there are also SSE4.2 and AVX2 ones, picked at runtime by what
+   the cpu supports. Equality is the range [v, v], so index, count and
+   filter share the range kernels.
+*/
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LIST_SIMD
+#include <immintrin.h>
+#endif
+
+enum { SIMD_NONE, SIMD_SSE42, SIMD_AVX2 };
+
+static int
+simd_level(void) {
+    static int level = -1;
+    if (level == -1) {
+#ifdef LIST_SIMD
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("popcnt"))
+            level = SIMD_NONE;
+        else if (__builtin_cpu_supports("avx2"))
+            level = SIMD_AVX2;
+        else if (__builtin_cpu_supports("sse4.2"))
+            level = SIMD_SSE42;
+        else
+            level = SIMD_NONE;
+#else
+        level = SIMD_NONE;
+#endif
+    }
+    return level;
+}
+
+/* @acctype is where sums are accumulated, integers wrap around */
+#define SCALAR_KERNELS(sfx, ctype, acctype) \
+static size_t \
+range_count_scalar_##sfx(const ctype *a, size_t n, ctype lo, ctype hi) {\
+    size_t i, r = 0;\
+    for (i = 0; i < n; i++)\
+        r += a[i] >= lo && a[i] <= hi;\
+    return r;\
+}\
+static size_t \
+range_first_scalar_##sfx(const ctype *a, size_t n, ctype lo, ctype hi) {\
+    size_t i;\
+    for (i = 0; i < n; i++)\
+        if (a[i] >= lo && a[i] <= hi)\
+            return i;\
+    return LIST_NOT_FOUND;\
+}\
+static size_t \
+range_filter_scalar_##sfx(const ctype *a, size_t n, ctype lo, ctype hi,\
+                          ctype *out) {\
+    size_t i, k = 0;\
+    for (i = 0; i < n; i++)\
+        if (a[i] >= lo && a[i] <= hi)\
+            out[k++] = a[i];\
+    return k;\
+}\
+static void \
+minmax_scalar_##sfx(const ctype *a, size_t n, ctype *min, ctype *max) {\
+    size_t i;\
+    for (i = 0; i < n; i++) {\
+        if (a[i] < *min)\
+            *min = a[i];\
+        if (a[i] > *max)\
+            *max = a[i];\
+    }\
+}\
+static acctype \
+sum_scalar_##sfx(const ctype *a, size_t n) {\
+    size_t i;\
+    acctype s = 0;\
+    for (i = 0; i < n; i++)\
+        s += (acctype)a[i];\
+    return s;\
+}
+
+SCALAR_KERNELS(i32, int32_t, uint64_t)
+SCALAR_KERNELS(i64, int64_t, uint64_t)
+SCALAR_KERNELS(f64, double, double)
+
+#ifdef LIST_SIMD
+
+#define AVX2 __attribute__((target("avx2,popcnt")))
+#define SSE42 __attribute__((target("sse4.2,popcnt")))
+
+/* Per isa and element type: rmask_* returns a bit per lane that is in
+   [lo, hi], sumstep_* adds @lanes elements to the accumulator. */
+
+static inline AVX2 unsigned
+rmask_avx2_i32(const int32_t *p, __m256i lo, __m256i hi) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    __m256i out = _mm256_or_si256(_mm256_cmpgt_epi32(lo, v),
+                                  _mm256_cmpgt_epi32(v, hi));
+    return ~_mm256_movemask_ps(_mm256_castsi256_ps(out)) & 0xff;
+}
+
+static inline AVX2 unsigned
+rmask_avx2_i64(const int64_t *p, __m256i lo, __m256i hi) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    __m256i out = _mm256_or_si256(_mm256_cmpgt_epi64(lo, v),
+                                  _mm256_cmpgt_epi64(v, hi));
+    return ~_mm256_movemask_pd(_mm256_castsi256_pd(out)) & 0xf;
+}
+
+static inline AVX2 unsigned
+rmask_avx2_f64(const double *p, __m256d lo, __m256d hi) {
+    __m256d v = _mm256_loadu_pd(p);
+    return _mm256_movemask_pd(_mm256_and_pd(_mm256_cmp_pd(v, lo, _CMP_GE_OQ),
+                                            _mm256_cmp_pd(v, hi, _CMP_LE_OQ)));
+}
+
+static inline SSE42 unsigned
+rmask_sse42_i32(const int32_t *p, __m128i lo, __m128i hi) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i out = _mm_or_si128(_mm_cmpgt_epi32(lo, v), _mm_cmpgt_epi32(v, hi));
+    return ~_mm_movemask_ps(_mm_castsi128_ps(out)) & 0xf;
+}
+
+static inline SSE42 unsigned
+rmask_sse42_i64(const int64_t *p, __m128i lo, __m128i hi) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i out = _mm_or_si128(_mm_cmpgt_epi64(lo, v), _mm_cmpgt_epi64(v, hi));
+    return ~_mm_movemask_pd(_mm_castsi128_pd(out)) & 0x3;
+}
+
+static inline SSE42 unsigned
+rmask_sse42_f64(const double *p, __m128d lo, __m128d hi) {
+    __m128d v = _mm_loadu_pd(p);
+    return _mm_movemask_pd(_mm_and_pd(_mm_cmpge_pd(v, lo), _mm_cmple_pd(v, hi)));
+}
+
+static inline AVX2 __m256i
+min_avx2_i64(__m256i a, __m256i b) {
+    return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b));
+}
+
+static inline AVX2 __m256i
+max_avx2_i64(__m256i a, __m256i b) {
+    return _mm256_blendv_epi8(b, a, _mm256_cmpgt_epi64(a, b));
+}
+
+static inline SSE42 __m128i
+min_sse42_i64(__m128i a, __m128i b) {
+    return _mm_blendv_epi8(a, b, _mm_cmpgt_epi64(a, b));
+}
+
+static inline SSE42 __m128i
+max_sse42_i64(__m128i a, __m128i b) {
+    return _mm_blendv_epi8(b, a, _mm_cmpgt_epi64(a, b));
+}
+
+static inline AVX2 __m256i
+sumstep_avx2_i32(__m256i acc, const int32_t *p) {
+    __m128i lo = _mm_loadu_si128((const __m128i *)p);
+    __m128i hi = _mm_loadu_si128((const __m128i *)(p + 4));
+    acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(lo));
+    return _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(hi));
+}
+
+static inline AVX2 __m256i
+sumstep_avx2_i64(__m256i acc, const int64_t *p) {
+    return _mm256_add_epi64(acc, _mm256_loadu_si256((const __m256i *)p));
+}
+
+static inline AVX2 __m256d
+sumstep_avx2_f64(__m256d acc, const double *p) {
+    return _mm256_add_pd(acc, _mm256_loadu_pd(p));
+}
+
+static inline SSE42 __m128i
+sumstep_sse42_i32(__m128i acc, const int32_t *p) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    acc = _mm_add_epi64(acc, _mm_cvtepi32_epi64(v));
+    return _mm_add_epi64(acc, _mm_cvtepi32_epi64(_mm_srli_si128(v, 8)));
+}
+
+static inline SSE42 __m128i
+sumstep_sse42_i64(__m128i acc, const int64_t *p) {
+    return _mm_add_epi64(acc, _mm_loadu_si128((const __m128i *)p));
+}
+
+static inline SSE42 __m128d
+sumstep_sse42_f64(__m128d acc, const double *p) {
+    return _mm_add_pd(acc, _mm_loadu_pd(p));
+}
+
+/* The loops are the same for every isa and type: whole vectors of
+   @lanes elements first, then the scalar kernel on the rest.
+   @vtype holds @lanes elements, @acctype/@accvtype the sums and
+   @acclanes how many of them fit in an @accvtype.
+*/
+#define SIMD_KERNELS(isa, sfx, attr, ctype, lanes, vtype, set1, loadu, \
+                     storeu, vmin, vmax, acctype, accvtype, acclanes, \
+                     setzero, accstoreu) \
+static attr size_t \
+range_count_##isa##_##sfx(const ctype *a, size_t n, ctype lo, ctype hi) {\
+    size_t i, r = 0;\
+    vtype vlo = set1(lo), vhi = set1(hi);\
+    for (i = 0; i + lanes <= n; i += lanes)\
+        r += __builtin_popcount(rmask_##isa##_##sfx(a + i, vlo, vhi));\
+    return r + range_count_scalar_##sfx(a + i, n - i, lo, hi);\
+}\
+static attr size_t \
+range_first_##isa##_##sfx(const ctype *a, size_t n, ctype lo, ctype hi) {\
+    size_t i, j;\
+    unsigned m;\
+    vtype vlo = set1(lo), vhi = set1(hi);\
+    for (i = 0; i + lanes <= n; i += lanes)\
+        if ((m = rmask_##isa##_##sfx(a + i, vlo, vhi)) != 0)\
+            return i + __builtin_ctz(m);\
+    j = range_first_scalar_##sfx(a + i, n - i, lo, hi);\
+    return j == LIST_NOT_FOUND ? j : i + j;\
+}\
+static attr size_t \
+range_filter_##isa##_##sfx(const ctype *a, size_t n, ctype lo, ctype hi,\
+                           ctype *out) {\
+    size_t i, k = 0;\
+    unsigned m;\
+    vtype vlo = set1(lo), vhi = set1(hi);\
+    for (i = 0; i + lanes <= n; i += lanes) {\
+        for (m = rmask_##isa##_##sfx(a + i, vlo, vhi); m; m &= m - 1)\
+            out[k++] = a[i + __builtin_ctz(m)];\
+    }\
+    return k + range_filter_scalar_##sfx(a + i, n - i, lo, hi, out + k);\
+}\
+static attr void \
+minmax_##isa##_##sfx(const ctype *a, size_t n, ctype *min, ctype *max) {\
+    size_t i;\
+    ctype buf[lanes];\
+    vtype vmn = set1(*min), vmx = set1(*max), v;\
+    for (i = 0; i + lanes <= n; i += lanes) {\
+        v = loadu(a + i);\
+        vmn = vmin(v, vmn);\
+        vmx = vmax(v, vmx);\
+    }\
+    storeu(buf, vmn);\
+    minmax_scalar_##sfx(buf, lanes, min, max);\
+    storeu(buf, vmx);\
+    minmax_scalar_##sfx(buf, lanes, min, max);\
+    minmax_scalar_##sfx(a + i, n - i, min, max);\
+}\
+static attr acctype \
+sum_##isa##_##sfx(const ctype *a, size_t n) {\
+    size_t i;\
+    acctype buf[acclanes], s;\
+    accvtype acc = setzero();\
+    for (i = 0; i + lanes <= n; i += lanes)\
+        acc = sumstep_##isa##_##sfx(acc, a + i);\
+    accstoreu(buf, acc);\
+    s = sum_scalar_##sfx(a + i, n - i);\
+    for (i = 0; i < acclanes; i++)\
+        s += buf[i];\
+    return s;\
+}
+
+#define LOADU_AVX2_SI(p) _mm256_loadu_si256((const __m256i *)(p))
+#define STOREU_AVX2_SI(p, v) _mm256_storeu_si256((__m256i *)(p), v)
+#define LOADU_SSE42_SI(p) _mm_loadu_si128((const __m128i *)(p))
+#define STOREU_SSE42_SI(p, v) _mm_storeu_si128((__m128i *)(p), v)
+
+SIMD_KERNELS(avx2, i32, AVX2, int32_t, 8, __m256i, _mm256_set1_epi32,
+             LOADU_AVX2_SI, STOREU_AVX2_SI, _mm256_min_epi32, _mm256_max_epi32,
+             uint64_t, __m256i, 4, _mm256_setzero_si256, STOREU_AVX2_SI)
+SIMD_KERNELS(avx2, i64, AVX2, int64_t, 4, __m256i, _mm256_set1_epi64x,
+             LOADU_AVX2_SI, STOREU_AVX2_SI, min_avx2_i64, max_avx2_i64,
+             uint64_t, __m256i, 4, _mm256_setzero_si256, STOREU_AVX2_SI)
+SIMD_KERNELS(avx2, f64, AVX2, double, 4, __m256d, _mm256_set1_pd,
+             _mm256_loadu_pd, _mm256_storeu_pd, _mm256_min_pd, _mm256_max_pd,
+             double, __m256d, 4, _mm256_setzero_pd, _mm256_storeu_pd)
+SIMD_KERNELS(sse42, i32, SSE42, int32_t, 4, __m128i, _mm_set1_epi32,
+             LOADU_SSE42_SI, STOREU_SSE42_SI, _mm_min_epi32, _mm_max_epi32,
+             uint64_t, __m128i, 2, _mm_setzero_si128, STOREU_SSE42_SI)
+SIMD_KERNELS(sse42, i64, SSE42, int64_t, 2, __m128i, _mm_set1_epi64x,
+             LOADU_SSE42_SI, STOREU_SSE42_SI, min_sse42_i64, max_sse42_i64,
+             uint64_t, __m128i, 2, _mm_setzero_si128, STOREU_SSE42_SI)
+SIMD_KERNELS(sse42, f64, SSE42, double, 2, __m128d, _mm_set1_pd,
+             _mm_loadu_pd, _mm_storeu_pd, _mm_min_pd, _mm_max_pd,
+             double, __m128d, 2, _mm_setzero_pd, _mm_storeu_pd)
+
+#define SIMD_CALL(kernel, sfx, args) \
+    (simd_level() == SIMD_AVX2 ? kernel##_avx2_##sfx args :\
+     simd_level() == SIMD_SSE42 ? kernel##_sse42_##sfx args :\
+     kernel##_scalar_##sfx args)
+#else
+#define SIMD_CALL(kernel, sfx, args) (kernel##_scalar_##sfx args)
+#endif
+
+/* call @kernel for tp's element type, @args may use the names ctype
+   (the element type), a (the table) and n (the length) */
+#define TLIST_CALL(result, tp, kernel, args) do {\
+    size_t n = (tp)->used;\
+    switch ((tp)->itemtype) {\
+    case LIST_INT32: {\
+        typedef int32_t ctype;\
+        const ctype *a = (const ctype *)(tp)->table;\
+        result SIMD_CALL(kernel, i32, args);\
+        break;\
+    }\
+    case LIST_INT64: {\
+        typedef int64_t ctype;\
+        const ctype *a = (const ctype *)(tp)->table;\
+        result SIMD_CALL(kernel, i64, args);\
+        break;\
+    }\
+    case LIST_DOUBLE: {\
+        typedef double ctype;\
+        const ctype *a = (const ctype *)(tp)->table;\
+        result SIMD_CALL(kernel, f64, args);\
+        break;\
+    }\
+    }\
+    } while(0)
+
+size_t
+list_tindex(TListObject *tp, void *value) {
+    size_t i = LIST_NOT_FOUND;
+    TLIST_CALL(i =, tp, range_first,
+               (a, n, *(ctype *)value, *(ctype *)value));
+    return i;
+}
+
+size_t
+list_tcount(TListObject *tp, void *value) {
+    size_t result = 0;
+    TLIST_CALL(result =, tp, range_count,
+               (a, n, *(ctype *)value, *(ctype *)value));
+    return result;
+}
+
+size_t
+list_tcount_range(TListObject *tp, void *lo, void *hi) {
+    size_t result = 0;
+    TLIST_CALL(result =, tp, range_count,
+               (a, n, *(ctype *)lo, *(ctype *)hi));
+    return result;
+}
+
+TListObject *
+list_tfilter_range(TListObject *tp, void *lo, void *hi) {
+    size_t k = 0;
+    TListObject *ntp = list_tnew(tp->itemtype);
+    if (ntp == NULL || tp->used == 0)
+        return ntp;
+    /* room for every element, trimmed to the matches afterwards */
+    if (list_tresize(ntp, tp->used) == -1) {
+        list_tfree(ntp);
+        return NULL;
+    }
+    TLIST_CALL(k =, tp, range_filter,
+               (a, n, *(ctype *)lo, *(ctype *)hi, (ctype *)ntp->table));
+    if (list_tresize(ntp, k) == -1) {
+        list_tfree(ntp);
+        return NULL;
+    }
+    return ntp;
+}
+
+int
+list_tminmax(TListObject *tp, void *min, void *max) {
+    if (tp->used == 0)
+        return -1;
+    memcpy(min, tp->table, tp->itemsize);
+    memcpy(max, tp->table, tp->itemsize);
+    TLIST_CALL(, tp, minmax, (a, n, (ctype *)min, (ctype *)max));
+    return 0;
+}
+
+int
+list_tsum(TListObject *tp, void *sum) {
+    switch (tp->itemtype) {
+    case LIST_INT32:
+        *(int64_t *)sum = (int64_t)SIMD_CALL(sum, i32,
+                ((const int32_t *)tp->table, tp->used));
+        break;
+    case LIST_INT64:
+        *(int64_t *)sum = (int64_t)SIMD_CALL(sum, i64,
+                ((const int64_t *)tp->table, tp->used));
+        break;
+    case LIST_DOUBLE:
+        *(double *)sum = SIMD_CALL(sum, f64,
+                ((const double *)tp->table, tp->used));
+        break;
+    }
+    return 0;
+}
+
+void
+list_tprint(TListObject *tp) {
+    size_t i, n = tp->used;
+    printf("[");
+    for (i = 0; i < n; i++) {
+        switch (tp->itemtype) {
+        case LIST_INT32:
+            printf("%d, ", (int)LIST_TITEM(tp, int32_t, i));
+            break;
+        case LIST_INT64:
+            printf("%lld, ", (long long)LIST_TITEM(tp, int64_t, i));
+            break;
+        case LIST_DOUBLE:
+            printf("%g, ", LIST_TITEM(tp, double, i));
+            break;
+        }
+    }
     printf("]\n\n");
 }
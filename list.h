@@ -5,63 +5,201 @@
     (lp)->keydup,\
     (lp)->keyfree));
 
+/* returned by list_index when no key matches */
+#define LIST_NOT_FOUND SIZE_MAX
+
+/* # of shifting insertions/deletions remembered by a list's key index */
+#define LOOKUP_LOG 64
+
+/* optional key index of a list, see list_cnew_indexed */
+typedef struct {
+    DictObject *dict;  /* key -> LookupEntry */
+    size_t ibase;  /* position of table[0], moved by the deque functions */
+    size_t seq;  /* # shifts so far */
+    struct {
+        size_t pos;
+        ssize_t delta;
+    } shifts[LOOKUP_LOG];
+} ListLookup;
+
 typedef struct _listobject ListObject;
 struct _listobject {
     ObjectType type;
-    size_t allocated;
+    size_t allocated; /* # slots from table on */
     size_t used;  /* # Active */
+    size_t offset;  /* # free slots in front of table */
     void **table;
+    ListLookup *lookup;  /* NULL unless created by list_cnew_indexed */
+    Allocator *allocator;  /* of the struct, table and lookup */
     int (*keycmp)(void *key1, void *key2);
     void *(*keydup)(void *key);
     void (*keyfree)(void *key);
 };
 
+/* a slice of a list that reads through base->table instead of copying.
+Taking one costs O(1) and no allocation. A view sees later changes of
+base, and positions past base's end once it shrinks are invalid. */
+typedef struct {
+    ListObject *base;
+    ssize_t start;  /* position of the view's first key in base */
+    size_t len;
+    ssize_t step;
+} ListView;
+
+/* the index'th key of a view, without bound checking */
+#define LIST_VIEW_ITEM(view, index) \
+    ((view)->base->table[(view)->start + (ssize_t)(index) * (view)->step])
+
+/* element type of an unboxed list */
+typedef enum {
+    LIST_INT32, LIST_INT64, LIST_DOUBLE
+} ListItemType;
+
+/* unboxed list, the elements themselves are stored in table, so adding
+one costs no allocation and the table can be scanned directly */
+typedef struct {
+    ListItemType itemtype;
+    size_t itemsize;
+    size_t allocated;
+    size_t used;
+    char *table;
+    Allocator *allocator;
+} TListObject;
+
+/* the index'th element of an unboxed list as an lvalue of @ctype,
+without bound checking */
+#define LIST_TITEM(tp, ctype, index) (((ctype *)(tp)->table)[index])
+
 /* list level functions */
 ListObject *
 list_cnew(size_t size,
           int (*keycmp)(void *key1, void *key2),
           void * (*keydup)(void *key),
           void (*keyfree)(void *key));
+/* the same, taking the struct and table from @a instead of the
+thread's container allocator, NULL for mem_allocator */
+ListObject *
+list_anew(Allocator *a,
+          size_t size,
+          int (*keycmp)(void *key1, void *key2),
+          void * (*keydup)(void *key),
+          void (*keyfree)(void *key));
+/* keep a hash index of keys, so list_index, list_count, list_has and
+list_remove cost O(1) expected instead of a scan. @size only reserves
+slots, the list starts empty. */
+ListObject *
+list_cnew_indexed(size_t size,
+                  size_t (*keyhash)(void *key),
+                  int (*keycmp)(void *key1, void *key2),
+                  void * (*keydup)(void *key),
+                  void (*keyfree)(void *key));
 ListObject *list_new(void);
 void list_clear(ListObject *lp);
 int list_free(ListObject *lp);
 ListObject *list_copy(ListObject *lp);
 int list_extend(ListObject *lp, ListObject *other);
+int list_extend_from_array(ListObject *lp, void **keys, size_t k);
+/* append other's keys themselves, leaving @other empty */
+int list_extend_move(ListObject *lp, ListObject *other);
+int list_insert_many(ListObject *lp, ssize_t where, void **keys, size_t k);
+int list_del_range(ListObject *lp, ssize_t start, ssize_t stop);
 size_t list_len(ListObject *lp);
 size_t list_is_empty(ListObject *lp);
 
 /* list level function, return a slice copy or reference */
-ListObject *list_slice(ListObject *lp, int start, int stop);
-ListObject *list_sslice(ListObject *lp, int start, int stop, int step);
-ListObject *list_rslice(ListObject *lp, int start, int stop); /*reference version */
-ListObject *list_rsslice(ListObject *lp, int start, int stop, int step);
+ListObject *list_slice(ListObject *lp, ssize_t start, ssize_t stop);
+ListObject *list_sslice(ListObject *lp, ssize_t start, ssize_t stop, ssize_t step);
+ListObject *list_rslice(ListObject *lp, ssize_t start, ssize_t stop); /*reference version */
+ListObject *list_rsslice(ListObject *lp, ssize_t start, ssize_t stop, ssize_t step);
+
+/* slice views, @start, @stop and @step are interpreted like a slice's */
+void list_view(ListObject *lp, ssize_t start, ssize_t stop, ssize_t step,
+               ListView *view);
+void list_view_slice(ListView *view, ssize_t start, ssize_t stop, ssize_t step,
+                     ListView *sub);
+size_t list_view_len(ListView *view);
+void *list_view_get(ListView *view, ssize_t index);
+/* set *pos to 0 to start, returns 0 past the end */
+size_t list_view_walk(ListView *view, size_t *pos, void **key_addr);
+ListObject *list_view_copy(ListView *view);
+ListObject *list_view_rcopy(ListView *view); /*reference version */
+int list_extend_view(ListObject *lp, ListView *view);
 
 /* key level functions */
-void *list_get(ListObject *lp, int index);
-int list_set(ListObject *lp, int index, void *key);
+void *list_get(ListObject *lp, ssize_t index);
+int list_set(ListObject *lp, ssize_t index, void *key);
 int list_add(ListObject *lp, void *key);
 void *list_pop(ListObject *lp);
-void *list_popi(ListObject *lp, int index);
-int list_insert(ListObject *lp, int index, void *key);
+void *list_popi(ListObject *lp, ssize_t index);
+/* both ends are O(1) amortized, so lp can be used as a queue */
+int list_appendleft(ListObject *lp, void *key);
+void *list_popleft(ListObject *lp);
+int list_insert(ListObject *lp, ssize_t index, void *key);
 size_t list_index(ListObject *lp, void *key);
 size_t list_count(ListObject *lp, void *key);
-int list_del(ListObject *lp, int index);
+int list_has(ListObject *lp, void *key);
+int list_del(ListObject *lp, ssize_t index);
 int list_remove(ListObject *lp, void *key);
 
 /*key level functions. 'r' prefix is short for 'reference'.
 Assign @key's address directly instead of its copy's.
 So it will be dangerous to pass buffered data to these functions
 */
-int list_rset(ListObject *lp, int index, void *key);
+int list_rset(ListObject *lp, ssize_t index, void *key);
 int list_radd(ListObject *lp, void *key);
-int list_rinsert(ListObject *lp, int index, void *key);
+int list_rinsert(ListObject *lp, ssize_t index, void *key);
+int list_rappendleft(ListObject *lp, void *key);
+int list_rinsert_many(ListObject *lp, ssize_t where, void **keys, size_t k);
 
 /*traversal interfaces of ListObject*/
 IterObject *list_iter_new(ListObject *lp);
+/* the same on a caller owned iterator, e.g. one on the stack */
+void list_iter_init(ListObject *lp, IterObject *lio);
 size_t list_iter_walk(IterObject *lio, void **key_addr);
+/* fill @keys with up to @n next keys, returns how many, 0 at the end */
+size_t list_iter_next_batch(IterObject *lio, void **keys, size_t n);
 void list_iter_flush(IterObject *lio);
 
+/* Run the statement after it for each key of @lp in order, assigned to
+@_k (a void *). break and continue work as in a for loop. @lp mustn't
+be resized meanwhile. */
+#define LIST_FOREACH(lp, _k) \
+    for (void **_lfe_kp = (lp)->table, **_lfe_end = _lfe_kp + (lp)->used; \
+         _lfe_kp < _lfe_end && (((_k) = *_lfe_kp), 1); _lfe_kp++)
+
+/*unboxed list functions. 't' prefix is short for 'typed'.
+Elements are passed in and out by address, e.g. an int64_t * for a
+LIST_INT64 list. Doubles are compared with ==.
+*/
+TListObject *list_tnew(ListItemType itemtype);
+TListObject *list_tcnew(ListItemType itemtype, size_t size); /* @size zeros */
+void list_tclear(TListObject *tp);
+int list_tfree(TListObject *tp);
+TListObject *list_tcopy(TListObject *tp);
+size_t list_tlen(TListObject *tp);
+int list_tget(TListObject *tp, ssize_t index, void *out);
+int list_tset(TListObject *tp, ssize_t index, void *value);
+int list_tadd(TListObject *tp, void *value);
+int list_tpop(TListObject *tp, void *out);
+int list_tinsert(TListObject *tp, ssize_t where, void *value);
+int list_tdel(TListObject *tp, ssize_t index);
+int list_textend_from_array(TListObject *tp, void *values, size_t k);
+size_t list_tindex(TListObject *tp, void *value);
+size_t list_tcount(TListObject *tp, void *value);
+TListObject *list_tslice(TListObject *tp, ssize_t start, ssize_t stop);
+TListObject *list_tsslice(TListObject *tp, ssize_t start, ssize_t stop, ssize_t step);
+
+/*scans over unboxed lists, vectorized where the cpu allows. @lo and @hi
+are inclusive bounds. Sums of integer lists go to an int64_t and wrap
+around, sums of doubles are added in no particular order.
+*/
+size_t list_tcount_range(TListObject *tp, void *lo, void *hi);
+TListObject *list_tfilter_range(TListObject *tp, void *lo, void *hi);
+int list_tminmax(TListObject *tp, void *min, void *max);
+int list_tsum(TListObject *tp, void *sum);
+
 /*other functions for printing or testing*/
 void list_print(ListObject *lp);
+void list_tprint(TListObject *tp);
 
 
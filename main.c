@@ -1,3 +1,4 @@
+#include <pthread.h>
 #include "xlib.h"
 
 static void
@@ -107,6 +108,42 @@ test_rb(void) {
     rb_free(tr);
 }
 
+/* rb_hadd from the finger and max, also after they were deleted */
+static void
+test_rb_hint(void) {
+    rbtree *tr = rb_new();
+    char keybuf[100];
+    size_t valuebuf[] = { 1 };
+    void *keys[32];
+    size_t i, n;
+    rbnode *cursor = NULL;
+    for (i = 0; i < 10; i++) {
+        sprintf(keybuf, "k%02u", (unsigned)i);
+        rb_hadd(tr, NULL, keybuf, valuebuf);
+        assert(strcmp((char *)tr->max->key, keybuf) == 0);
+    }
+    rb_del(tr, "k09");
+    assert(strcmp((char *)tr->max->key, "k08") == 0);
+    rb_hadd(tr, NULL, "k50", valuebuf);
+    rb_del(tr, "k50");
+    rb_del(tr, "k04");
+    rb_hadd(tr, NULL, "k04", valuebuf);
+    rb_del(tr, "k04");
+    rb_hadd(tr, NULL, "k045", valuebuf);
+    rb_hadd(tr, NULL, "k00a", valuebuf);
+    assert(tr->size == 10);
+    for (i = 0; i < 9; i++) {
+        sprintf(keybuf, "k%02u", (unsigned)i);
+        assert(rb_get(tr, keybuf) != NULL || i == 4);
+    }
+    n = rb_next_batch(tr, &cursor, keys, NULL, 32);
+    assert(n == tr->size);
+    for (i = 1; i < n; i++)
+        assert(strcmp((char *)keys[i - 1], (char *)keys[i]) < 0);
+    assert(strcmp((char *)tr->max->key, "k08") == 0);
+    rb_free(tr);
+}
+
 static void
 test_set(void) {
     char *keys1[] = {"a", "b", "r", "a", "c", "a", "d", "a", "b", "r", "a"};
@@ -185,12 +222,1184 @@ void test_list(void) {
     list_free(nlp);
 }
 
+/* deterministic pseudo random numbers for the tests */
+static size_t test_seed = 12345;
+
+static size_t
+test_rand(void) {
+    test_seed = test_seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (size_t)(test_seed >> 33);
+}
+
+/* lp holds the ints of ref[0:n] in order */
+static void
+check_list(ListObject *lp, int *ref, size_t n) {
+    size_t i;
+    assert(lp->used == n && lp->used <= lp->allocated);
+    for (i = 0; i < n; i++)
+        assert(*(int *)list_get(lp, i) == ref[i]);
+}
+
+/* lp used as a FIFO, with the front slack left by list_popleft reused or
+given back by list_resize while keys are added, read, set and inserted */
+static void
+test_list_deque(void) {
+    ListObject *lp = list_new();
+    int *ref = (int *)malloc(20000 * sizeof(int));
+    int v, *kp;
+    size_t i, n = 0, round, target;
+    for (round = 0; round < 8; round++) {
+        /* grow well past the current size, then drain to a few keys, so
+           both directions cross several resize boundaries */
+        target = round & 1 ? 3 : 500 + 1500 * round;
+        while (n != target) {
+            i = n ? test_rand() % n : 0;
+            switch (test_rand() % 8) {
+            case 0:
+            case 1:
+            case 2:
+                if (n < target) {
+                    v = (int)test_rand();
+                    assert(list_add(lp, &v) == 0);
+                    ref[n++] = v;
+                    break;
+                }
+                /* fall through */
+            case 3:
+            case 4:
+                if (n > target) {
+                    kp = (int *)list_popleft(lp);
+                    assert(kp != NULL && *kp == ref[0]);
+                    lp->keyfree(kp);
+                    memmove(ref, ref + 1, --n * sizeof(int));
+                }
+                break;
+            case 5:
+                if (n) {
+                    v = (int)test_rand();
+                    kp = (int *)list_get(lp, i);
+                    assert(*kp == ref[i] && list_set(lp, i, &v) == 0);
+                    lp->keyfree(kp);
+                    ref[i] = v;
+                }
+                break;
+            case 6:
+                if (n < target) {
+                    v = (int)test_rand();
+                    assert(list_insert(lp, i, &v) == 0);
+                    memmove(ref + i + 1, ref + i, (n++ - i) * sizeof(int));
+                    ref[i] = v;
+                }
+                break;
+            default:
+                if (n < target) {
+                    v = (int)test_rand();
+                    assert(list_appendleft(lp, &v) == 0);
+                    memmove(ref + 1, ref, n++ * sizeof(int));
+                    ref[0] = v;
+                }
+                break;
+            }
+            assert(lp->used == n);
+        }
+        check_list(lp, ref, n);
+    }
+    while (n) {
+        kp = (int *)list_popleft(lp);
+        assert(*kp == ref[0]);
+        lp->keyfree(kp);
+        memmove(ref, ref + 1, --n * sizeof(int));
+    }
+    assert(list_popleft(lp) == NULL && lp->used == 0);
+    v = 7;
+    assert(list_add(lp, &v) == 0 && *(int *)list_get(lp, 0) == 7);
+    free(ref);
+    list_free(lp);
+}
+
+/* clp and lp hold equal keys in the same order */
+static void
+check_clist(CListObject *clp, ListObject *lp) {
+    size_t i, pos = 0;
+    void *key;
+    assert(clist_len(clp) == lp->used);
+    for (i = 0; clist_walk(clp, &pos, &key); i++)
+        assert(*(int *)key == *(int *)list_get(lp, i));
+    assert(i == lp->used);
+    if (i) {
+        assert(*(int *)clist_get(clp, -1) == *(int *)list_get(lp, -1));
+        assert(*(int *)clist_get(clp, -(ssize_t)i) == *(int *)list_get(lp, 0));
+    }
+    assert(clist_get(clp, i) == NULL && clist_get(clp, -(ssize_t)i - 1) == NULL);
+}
+
+/* the list API of clist against list, growing over several chunks and
+shrinking back so that chunks split and merge, with negative indexes and
+random accesses moving clist_locate's finger around */
+static void
+test_clist(void) {
+    CListObject *clp = clist_new(), *copy;
+    ListObject *lp = list_new(), *tolp;
+    size_t step, n;
+    ssize_t i;
+    int v, *ck, *lk;
+    for (step = 0; step < 40000; step++) {
+        n = lp->used;
+        i = n ? (ssize_t)(test_rand() % n) : 0;
+        if (test_rand() & 1)
+            i -= (ssize_t)n;
+        v = (int)(test_rand() % 100);
+        switch (test_rand() % 8) {
+        case 0:
+        case 1:
+            /* a net growth for the first half, a net shrink after */
+            if (step < 20000) {
+                assert(clist_add(clp, &v) == 0 && list_add(lp, &v) == 0);
+                break;
+            }
+            /* fall through */
+        case 2:
+            if (n) {
+                ck = (int *)clist_popi(clp, i);
+                lk = (int *)list_popi(lp, i);
+                assert(*ck == *lk);
+                clp->keyfree(ck);
+                lp->keyfree(lk);
+            }
+            break;
+        case 3:
+            if (step < 20000)
+                assert(clist_insert(clp, i, &v) == 0
+                       && list_insert(lp, i, &v) == 0);
+            else if (n)
+                assert(clist_del(clp, i) == 0 && list_del(lp, i) == 0);
+            break;
+        case 4:
+            if (n) {
+                ck = (int *)clist_get(clp, i);
+                lk = (int *)list_get(lp, i);
+                assert(*ck == *lk);
+                /* both leave the replaced key to the caller */
+                assert(clist_set(clp, i, &v) == 0 && list_set(lp, i, &v) == 0);
+                clp->keyfree(ck);
+                lp->keyfree(lk);
+            }
+            break;
+        case 5:
+            if (n && step >= 20000) {
+                ck = (int *)clist_pop(clp);
+                lk = (int *)list_pop(lp);
+                assert(*ck == *lk);
+                clp->keyfree(ck);
+                lp->keyfree(lk);
+            }
+            break;
+        case 6:
+            assert(clist_index(clp, &v) == list_index(lp, &v));
+            assert(clist_count(clp, &v) == list_count(lp, &v));
+            break;
+        default:
+            if (n)
+                assert(*(int *)clist_get(clp, i) == *(int *)list_get(lp, i));
+            break;
+        }
+        if (step % 1999 == 0)
+            check_clist(clp, lp);
+        if (step == 19999) {
+            assert(clp->nchunks > 4);
+            copy = clist_copy(clp);
+            check_clist(copy, lp);
+            clist_free(copy);
+        }
+    }
+    check_clist(clp, lp);
+    for (step = 0; step < 3000; step++) {
+        v = (int)(test_rand() % 100);
+        assert(clist_add(clp, &v) == 0 && list_add(lp, &v) == 0);
+    }
+    copy = clist_copy(clp);
+    check_clist(copy, lp);
+    tolp = clist_tolist(clp);
+    check_clist(clp, tolp);
+    while (lp->used) {
+        v = *(int *)list_get(lp, lp->used / 2);
+        assert(clist_remove(copy, &v) == 0 && list_remove(lp, &v) == 0);
+    }
+    check_clist(copy, lp);
+    clist_free(copy);
+    clist_free(clp);
+    list_free(tolp);
+    list_free(lp);
+}
+
+static void
+no_free(void *key) {
+    (void)key;
+}
+
+/* a and b hold the same keys */
+static int
+set_equal(SetObject *a, SetObject *b) {
+    return set_len(a) == set_len(b) && set_issubset(a, b);
+}
+
+/* the partitioned operations against the serial ones, on one thread and
+on four, with sets of many buckets, an empty one and self operands */
+static void
+test_set_partition(void) {
+    SetObject *(*pops[])(SetObject *, SetObject *, size_t) = {
+        set_pand, set_por, set_psub, set_pxor
+    };
+    SetObject *(*rpops[])(SetObject *, SetObject *, size_t) = {
+        set_rpand, set_rpor, set_rpsub, set_rpxor
+    };
+    SetObject *(*ops[])(SetObject *, SetObject *) = {
+        set_and, set_or, set_sub, set_xor
+    };
+    SetObject *a = set_new(), *b = set_new(), *e = set_new();
+    SetObject *pairs[][2] = {
+        {a, b}, {b, a}, {a, e}, {e, a}, {a, a}, {e, e}
+    };
+    SetObject *want, *got;
+    char keybuf[32];
+    size_t i, op, t, nthreads;
+    for (i = 0; i < 60000; i++) {
+        sprintf(keybuf, "p%u", (unsigned)i);
+        if (i < 40000 && test_rand() % 3)
+            set_add(a, keybuf);
+        if (i >= 20000 && test_rand() % 3)
+            set_add(b, keybuf);
+    }
+    for (t = 0; t < sizeof(pairs) / sizeof(pairs[0]); t++) {
+        for (op = 0; op < 4; op++) {
+            want = ops[op](pairs[t][0], pairs[t][1]);
+            for (nthreads = 1; nthreads <= 4; nthreads += 3) {
+                got = pops[op](pairs[t][0], pairs[t][1], nthreads);
+                assert(got != NULL && set_equal(got, want));
+                set_free(got);
+                got = rpops[op](pairs[t][0], pairs[t][1], nthreads);
+                assert(got != NULL && set_equal(got, want));
+                /* its keys belong to the operands */
+                got->keyfree = no_free;
+                set_free(got);
+            }
+            set_free(want);
+        }
+    }
+    set_free(a);
+    set_free(b);
+    set_free(e);
+}
+
 size_t
 int_hash(void *key) {
     int n = *(int*)key;
     return (size_t)n;
 }
 
+#define BM_DOMAIN (4 << 16)
+
+/* bm holds the values v < BM_DOMAIN with ref[v] set, walked in order */
+static void
+check_bitmap(BitmapObject *bm, unsigned char *ref) {
+    uint64_t cursor = 0;
+    uint32_t v, prev = 0;
+    size_t i, n = 0, count = 0;
+    for (i = 0; i < BM_DOMAIN; i++)
+        count += ref[i];
+    assert(bitmap_len(bm) == count);
+    while (bitmap_walk(bm, &cursor, &v)) {
+        assert(v < BM_DOMAIN && ref[v] && (n == 0 || v > prev));
+        prev = v;
+        n++;
+    }
+    assert(n == count);
+    for (i = 0; i < 1000; i++) {
+        v = (uint32_t)(test_rand() % BM_DOMAIN);
+        assert(!bitmap_has(bm, v) == !ref[v]);
+    }
+}
+
+/* a bitmap filled from @ref, whose four containers are an array, bits,
+a container pushed over BITMAP_ARRAY_MAX and back, and @last's density */
+static BitmapObject *
+bitmap_random(unsigned char *ref, size_t last) {
+    BitmapObject *bm = bitmap_new();
+    size_t i, per[4] = { 1000, 30000, 6000, 0 };
+    uint32_t v;
+    per[3] = last;
+    memset(ref, 0, BM_DOMAIN);
+    for (i = 0; i < 4; i++) {
+        while (per[i]--) {
+            v = (uint32_t)(i << 16 | test_rand() % 65536);
+            ref[v] = 1;
+            assert(bitmap_add(bm, v) == 0);
+        }
+    }
+    /* container 2 goes back under the array limit */
+    for (v = 2 << 16; v < (3 << 16) - 20000; v++) {
+        ref[v] = 0;
+        bitmap_discard(bm, v);
+    }
+    return bm;
+}
+
+/* the roaring bitmap against byte arrays: every operation and its in
+place form, subset tests, walks and the array/bits transitions */
+static void
+test_bitmap(void) {
+    unsigned char *rx = (unsigned char *)malloc(BM_DOMAIN);
+    unsigned char *ry = (unsigned char *)malloc(BM_DOMAIN);
+    unsigned char *rz = (unsigned char *)malloc(BM_DOMAIN);
+    BitmapObject *(*ops[])(BitmapObject *, BitmapObject *) = {
+        bitmap_or, bitmap_and, bitmap_sub, bitmap_xor
+    };
+    int (*iops[])(BitmapObject *, BitmapObject *) = {
+        bitmap_ior, bitmap_iand, bitmap_isub, bitmap_ixor
+    };
+    BitmapObject *x, *y, *z, *w;
+    ListObject *lp;
+    SetObject *sp;
+    size_t i, op, round, pos;
+    uint32_t v;
+    int k;
+    for (round = 0; round < 3; round++) {
+        x = bitmap_random(rx, round * 3000);
+        y = bitmap_random(ry, 40000 - round * 15000);
+        check_bitmap(x, rx);
+        check_bitmap(y, ry);
+        assert(x->containers[0].type == BITMAP_ARRAY
+               && x->containers[1].type == BITMAP_BITS
+               && x->containers[2].type == BITMAP_ARRAY);
+        for (op = 0; op < 4; op++) {
+            for (i = 0; i < BM_DOMAIN; i++)
+                rz[i] = op == 0 ? rx[i] | ry[i] : op == 1 ? rx[i] & ry[i] :
+                        op == 2 ? rx[i] & !ry[i] : rx[i] ^ ry[i];
+            z = ops[op](x, y);
+            check_bitmap(z, rz);
+            assert(bitmap_issubset(op == 0 ? x : z, op == 0 ? z : x) || op == 3);
+            assert(bitmap_issuperset(op == 0 ? z : x, op == 0 ? x : z) || op == 3);
+            w = bitmap_copy(x);
+            assert(iops[op](w, y) == 0);
+            check_bitmap(w, rz);
+            bitmap_free(w);
+            bitmap_free(z);
+        }
+        /* self operands */
+        z = bitmap_xor(x, x);
+        assert(bitmap_len(z) == 0 && bitmap_issubset(z, y));
+        bitmap_free(z);
+        z = bitmap_copy(x);
+        assert(bitmap_iand(z, z) == 0 && bitmap_issubset(z, x)
+               && bitmap_issubset(x, z));
+        bitmap_free(z);
+        bitmap_free(x);
+        bitmap_free(y);
+    }
+
+    /* through sets and lists of ints */
+    lp = list_new();
+    memset(rx, 0, BM_DOMAIN);
+    for (i = 0; i < 20000; i++) {
+        k = (int)(test_rand() % BM_DOMAIN);
+        rx[k] = 1;
+        list_add(lp, &k);
+    }
+    sp = set_fromlist(lp, int_hash, lp->keycmp, lp->keydup, lp->keyfree);
+    x = bitmap_fromset(sp, NULL);
+    check_bitmap(x, rx);
+    y = bitmap_fromlist(lp, NULL);
+    check_bitmap(y, rx);
+    list_free(lp);
+    lp = bitmap_tolist(x);
+    assert(lp->used == set_len(sp));
+    for (pos = 0, v = 0; pos < lp->used; pos++) {
+        k = *(int *)list_get(lp, pos);
+        assert(rx[k] && (pos == 0 || (uint32_t)k > v));
+        v = (uint32_t)k;
+    }
+    list_free(lp);
+    set_free(sp);
+    bitmap_free(x);
+    bitmap_free(y);
+    free(rx);
+    free(ry);
+    free(rz);
+}
+
+/* bloom filters never miss an added key and stay near their error rate,
+HyperLogLog stays within a few standard errors, and loads takes back
+what dumps gives but no truncated or corrupt image */
+static void
+test_sketch(void) {
+    BloomObject *bf = bloom_new(20000, 0.01, NULL), *bf2;
+    HLLObject *hp = hll_new(12, NULL), *hp2;
+    char keybuf[32];
+    unsigned char *buf;
+    size_t i, size, fp = 0, est;
+    double err;
+    for (i = 0; i < 20000; i++) {
+        sprintf(keybuf, "b%u", (unsigned)i);
+        bloom_add(bf, keybuf);
+    }
+    for (i = 0; i < 20000; i++) {
+        sprintf(keybuf, "b%u", (unsigned)i);
+        assert(bloom_has(bf, keybuf));
+        sprintf(keybuf, "x%u", (unsigned)i);
+        fp += bloom_has(bf, keybuf);
+    }
+    assert(fp < 20000 * 0.01 * 3);
+    for (i = 0; i < 100000; i++) {
+        sprintf(keybuf, "h%u", (unsigned)(i % 50000));
+        hll_add(hp, keybuf);
+    }
+    est = hll_len(hp);
+    err = ((double)est - 50000) / 50000;
+    /* the standard error is 1.04 / sqrt(4096), about 1.6% */
+    assert(err < 0.08 && err > -0.08);
+
+    buf = (unsigned char *)bloom_dumps(bf, &size);
+    bf2 = bloom_loads(buf, size, NULL);
+    assert(bf2 != NULL && bf2->used == bf->used && bf2->k == bf->k);
+    assert(memcmp(bf2->blocks, bf->blocks,
+                  bf->nblocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t)) == 0);
+    bloom_free(bf2);
+    assert(bloom_loads(buf, size - 1, NULL) == NULL);
+    assert(bloom_loads(buf, 10, NULL) == NULL);
+    buf[0] = 'Y';
+    assert(bloom_loads(buf, size, NULL) == NULL);
+    buf[0] = 'X';
+    buf[4] = 0;  /* k = 0 */
+    assert(bloom_loads(buf, size, NULL) == NULL);
+    mem_free(buf);
+
+    buf = (unsigned char *)hll_dumps(hp, &size);
+    hp2 = hll_loads(buf, size, NULL);
+    assert(hp2 != NULL && hll_len(hp2) == est);
+    hll_free(hp2);
+    assert(hll_loads(buf, size - 1, NULL) == NULL);
+    buf[12] = 64;  /* a rank no register can have */
+    assert(hll_loads(buf, size, NULL) == NULL);
+    buf[12] = 0;
+    buf[4] = 30;  /* precision */
+    assert(hll_loads(buf, size, NULL) == NULL);
+    mem_free(buf);
+    bloom_free(bf);
+    hll_free(hp);
+}
+
+/* containers with the intern_key* callbacks share one copy of a string */
+static void
+test_intern(void) {
+    SetObject *sp = set_cnew(0, intern_keyhash, intern_keycmp,
+                             intern_keydup, intern_keyfree);
+    DictObject *dp = dict_cnew(0, intern_keyhash, intern_keycmp,
+                               intern_keydup, NULL, NULL, intern_keyfree, NULL);
+    ListObject *lp = list_cnew(0, intern_keycmp, intern_keydup, intern_keyfree);
+    char keybuf[32], *k1, *k2;
+    void *key, *value;
+    size_t n = intern_len(), one = 1;
+    strcpy(keybuf, "shared token");
+    k1 = intern_str(keybuf);
+    assert(k1 != keybuf && strcmp(k1, keybuf) == 0);
+    assert(intern_strlen(k1) == strlen(keybuf));
+    /* another buffer with the same text gives the same copy */
+    k2 = intern_str("shared token");
+    assert(k2 == k1 && intern_lookup("shared token") == k1);
+    assert(intern_len() == n + 1);
+    assert(set_add(sp, k1) == 0 && dict_add(dp, k2, &one) == 0
+           && list_add(lp, k1) == 0);
+    SET_FOREACH(sp, key)
+        assert(key == k1);
+    DICT_FOREACH(dp, key, value)
+        assert(key == k1 && *(size_t *)value == 1);
+    assert(list_get(lp, 0) == k1);
+    assert(set_has(sp, intern_str("shared token")));
+    assert(intern_lookup("not interned") == NULL && intern_len() == n + 1);
+    set_free(sp);
+    dict_free(dp);
+    list_free(lp);
+    /* the containers never owned it */
+    assert(strcmp(k1, "shared token") == 0);
+}
+
+/* the interner outlives an arena that was the container allocator
+   when it was created */
+static void
+test_intern_arena(void) {
+    Allocator *arena, *old;
+    char *k;
+    intern_clear();
+    arena = mem_arena_new(0);
+    assert(arena != NULL);
+    old = mem_use_allocator(arena);
+    k = intern_str("alpha");
+    mem_use_allocator(old);
+    mem_arena_free(arena);
+    assert(k != NULL && intern_str("beta") != NULL);
+    assert(intern_lookup("alpha") == k && intern_len() == 2);
+    intern_clear();
+}
+
+/* accumulator of the parallel reduce tests */
+typedef struct {
+    size_t n;
+    size_t sum;
+    size_t max;
+} SumAcc;
+
+static void
+sum_init(void *acc) {
+    ((SumAcc *)acc)->max = 0;
+}
+
+static void
+sum_item(void *acc, void *key, void *value) {
+    SumAcc *a = (SumAcc *)acc;
+    size_t v = *(size_t *)value;
+    (void)key;
+    a->n++;
+    a->sum += v;
+    if (v > a->max)
+        a->max = v;
+}
+
+static void
+sum_key(void *acc, void *key) {
+    SumAcc *a = (SumAcc *)acc;
+    a->n++;
+    a->sum += strlen((char *)key);
+}
+
+static void
+sum_merge(void *acc, void *other) {
+    SumAcc *a = (SumAcc *)acc, *b = (SumAcc *)other;
+    a->n += b->n;
+    a->sum += b->sum;
+    if (b->max > a->max)
+        a->max = b->max;
+}
+
+static void
+count_item(void *arg, void *key, void *value) {
+    (void)key;
+    __atomic_fetch_add((size_t *)arg, *(size_t *)value, __ATOMIC_RELAXED);
+}
+
+static void
+count_key(void *arg, void *key) {
+    (void)key;
+    __atomic_fetch_add((size_t *)arg, 1, __ATOMIC_RELAXED);
+}
+
+static void
+count_id(void *arg, size_t id) {
+    __atomic_fetch_add((size_t *)arg, id + 1, __ATOMIC_RELAXED);
+}
+
+/* a run from inside a run gets threads of its own */
+static void
+nested_run(void *arg, size_t id) {
+    size_t ran, count = 0;
+    (void)id;
+    ran = parallel_run(3, count_id, &count);
+    assert(count == ran * (ran + 1) / 2);
+    __atomic_fetch_add((size_t *)arg, 1, __ATOMIC_RELAXED);
+}
+
+/* split iterators visit every item once between them, and the parallel
+for and reduce agree with serial loops, on pool threads used again and
+again and from inside a run */
+static void
+test_parallel(void) {
+    DictObject *dp = dict_new();
+    SetObject *sp = set_new();
+    char keybuf[32];
+    size_t i, j, k, n = 30000, ran, count, *seen;
+    size_t splits[] = { 1, 3, 8, 64 };
+    SumAcc want = { 0, 0, 0 }, got;
+    IterObject it;
+    void *key, *value;
+    seen = (size_t *)calloc(n, sizeof(size_t));
+    for (i = 0; i < n; i++) {
+        sprintf(keybuf, "q%u", (unsigned)i);
+        assert(dict_add(dp, keybuf, &i) == 0 && set_add(sp, keybuf) == 0);
+    }
+    /* holes left by deleted keys must be skipped */
+    for (i = 0; i < n; i += 7) {
+        sprintf(keybuf, "q%u", (unsigned)i);
+        dict_del(dp, keybuf);
+        set_del(sp, keybuf);
+    }
+    DICT_FOREACH(dp, key, value)
+        sum_item(&want, key, value);
+    for (j = 0; j < sizeof(splits) / sizeof(splits[0]); j++) {
+        memset(seen, 0, n * sizeof(size_t));
+        count = 0;
+        for (k = 0; k < splits[j]; k++) {
+            dict_iter_split(dp, &it, splits[j], k);
+            while (dict_iterkv(&it, &key, &value))
+                seen[*(size_t *)value]++;
+            set_iter_split(sp, &it, splits[j], k);
+            while (set_iter_walk(&it, &key))
+                count++;
+        }
+        for (i = 0; i < n; i++)
+            assert(seen[i] == (i % 7 != 0));
+        assert(count == set_len(sp));
+    }
+    for (k = 1; k <= 8; k++) {
+        memset(&got, 0, sizeof(got));
+        got.max = n + 1;
+        assert(dict_parallel_reduce(dp, k, &got, sizeof(got), sum_init,
+                                    sum_item, sum_merge) == 0);
+        assert(got.n == want.n && got.sum == want.sum && got.max == n + 1);
+        memset(&got, 0, sizeof(got));
+        assert(dict_parallel_reduce(dp, k, &got, sizeof(got), NULL,
+                                    sum_item, sum_merge) == 0);
+        assert(got.n == want.n && got.sum == want.sum && got.max == want.max);
+        count = 0;
+        dict_parallel_for(dp, k, count_item, &count);
+        assert(count == want.sum);
+        count = 0;
+        set_parallel_for(sp, k, count_key, &count);
+        assert(count == set_len(sp));
+        memset(&got, 0, sizeof(got));
+        assert(set_parallel_reduce(sp, k, &got, sizeof(got), NULL,
+                                   sum_key, sum_merge) == 0);
+        assert(got.n == set_len(sp));
+    }
+    for (k = 1; k <= 16; k++) {
+        count = 0;
+        ran = parallel_run(k, count_id, &count);
+        assert(ran == k && count == k * (k + 1) / 2);
+    }
+    count = 0;
+    ran = parallel_run(4, nested_run, &count);
+    assert(count == ran);
+    free(seen);
+    dict_free(dp);
+    set_free(sp);
+}
+
+/* an Allocator failing once its countdown runs out, for error paths */
+static size_t fail_countdown = SIZE_MAX;
+
+static void *
+fail_alloc(void *ctx, size_t size) {
+    (void)ctx;
+    if (fail_countdown == 0)
+        return NULL;
+    fail_countdown--;
+    return malloc(size);
+}
+
+static void *
+fail_realloc(void *ctx, void *p, size_t size) {
+    (void)ctx;
+    if (fail_countdown == 0)
+        return NULL;
+    fail_countdown--;
+    return realloc(p, size);
+}
+
+static void
+fail_free(void *ctx, void *p) {
+    (void)ctx;
+    free(p);
+}
+
+static Allocator fail_allocator = {
+    fail_alloc, fail_realloc, fail_free, NULL, NULL
+};
+
+/* list_index, list_count, list_has and list_remove of an indexed list
+agree with a scan of ref[0:n] for every key of 0..domain-1 */
+static void
+check_list_index(ListObject *lp, int *ref, size_t n, int domain) {
+    int v;
+    size_t i, first, count;
+    check_list(lp, ref, n);
+    for (v = 0; v < domain; v++) {
+        first = LIST_NOT_FOUND;
+        count = 0;
+        for (i = 0; i < n; i++)
+            if (ref[i] == v && count++ == 0)
+                first = i;
+        assert(list_index(lp, &v) == first);
+        assert(list_count(lp, &v) == count);
+        assert(!list_has(lp, &v) == !count);
+    }
+}
+
+/* the key index through shifting inserts and deletions (past the
+LOOKUP_LOG shifts it remembers), the deque functions moving ibase,
+list_set, extends and list_remove, then a failing insert rolled back */
+static void
+test_list_index(void) {
+    const int domain = 40;
+    ListObject *lp = list_cnew_indexed(0, int_hash, NULL, NULL, NULL);
+    Allocator *old;
+    ListObject *flp;
+    int *ref = (int *)malloc(4000 * sizeof(int));
+    int v, vs[8], *kp;
+    size_t i, j, n = 0, step;
+    for (step = 0; step < 3000; step++) {
+        v = (int)(test_rand() % domain);
+        i = n ? test_rand() % n : 0;
+        switch (test_rand() % 10) {
+        case 0:
+        case 1:
+            assert(list_add(lp, &v) == 0);
+            ref[n++] = v;
+            break;
+        case 2:
+        case 3:
+            /* shifts in the middle */
+            assert(list_insert(lp, i, &v) == 0);
+            memmove(ref + i + 1, ref + i, (n++ - i) * sizeof(int));
+            ref[i] = v;
+            break;
+        case 4:
+            if (n) {
+                assert(list_del(lp, i) == 0);
+                memmove(ref + i, ref + i + 1, (--n - i) * sizeof(int));
+            }
+            break;
+        case 5:
+            assert(list_appendleft(lp, &v) == 0);
+            memmove(ref + 1, ref, n++ * sizeof(int));
+            ref[0] = v;
+            break;
+        case 6:
+            if (n) {
+                kp = (int *)list_popleft(lp);
+                assert(*kp == ref[0]);
+                lp->keyfree(kp);
+                memmove(ref, ref + 1, --n * sizeof(int));
+            }
+            break;
+        case 7:
+            if (n) {
+                kp = (int *)list_get(lp, i);
+                assert(list_set(lp, i, &v) == 0);
+                lp->keyfree(kp);
+                ref[i] = v;
+            }
+            break;
+        case 8:
+            if (n < 3900) {
+                for (j = 0; j < 8; j++)
+                    vs[j] = (int)(test_rand() % domain);
+                for (j = 0; j < 8; j++) {
+                    kp = &vs[j];
+                    assert(list_extend_from_array(lp, (void **)&kp, 1) == 0);
+                    ref[n++] = vs[j];
+                }
+            }
+            break;
+        default:
+            /* the first copy goes, a later one must be found next */
+            for (j = 0; j < n && ref[j] != v; j++)
+                ;
+            if (j < n) {
+                assert(list_remove(lp, &v) == 0);
+                memmove(ref + j, ref + j + 1, (--n - j) * sizeof(int));
+            }
+            break;
+        }
+        if (step % 97 == 0)
+            check_list_index(lp, ref, n, domain);
+    }
+    check_list_index(lp, ref, n, domain);
+    list_free(lp);
+
+    /* an insert whose index update runs out of memory leaves both the
+       list and its index as they were */
+    old = mem_use_allocator(&fail_allocator);
+    flp = list_cnew_indexed(0, int_hash, NULL, NULL, NULL);
+    mem_use_allocator(old);
+    for (n = 0; n < 100; n++) {
+        ref[n] = (int)(n % domain);
+        assert(list_add(flp, &ref[n]) == 0);
+    }
+    for (step = 0; step < 40; step++) {
+        /* new keys, so the index needs an entry for them */
+        v = domain + (int)step;
+        fail_countdown = step / 4;
+        if (list_insert(flp, 50, &v) == 0) {
+            memmove(ref + 51, ref + 50, (n++ - 50) * sizeof(int));
+            ref[50] = v;
+            assert(list_index(flp, &v) == 50);
+        } else
+            assert(list_index(flp, &v) == LIST_NOT_FOUND);
+        fail_countdown = SIZE_MAX;
+        check_list_index(flp, ref, n, domain + 40);
+    }
+    list_free(flp);
+    free(ref);
+}
+
+static void
+combine_sum(void *value, void *other) {
+    *(size_t *)value += *(size_t *)other;
+}
+
+static void
+combine_last(void *value, void *other) {
+    *(size_t *)value = *(size_t *)other;
+}
+
+/* a and b map the same keys to the same size_t values */
+static void
+check_dict_equal(DictObject *a, DictObject *b) {
+    void *key, *value, *other;
+    assert(a->used == b->used);
+    DICT_FOREACH(a, key, value) {
+        other = dict_get(b, key);
+        assert(other != NULL && *(size_t *)other == *(size_t *)value);
+    }
+}
+
+/* shards with duplicate keys across them, some also in dp */
+static void
+merge_shards(DictObject **shards, size_t n) {
+    char keybuf[32];
+    size_t i, j, v;
+    for (i = 0; i < n; i++) {
+        shards[i] = dict_new();
+        for (j = 0; j < 4000; j++) {
+            sprintf(keybuf, "m%u", (unsigned)(test_rand() % 12000));
+            v = test_rand() % 1000 + 1;
+            dict_set(shards[i], keybuf, &v);
+        }
+    }
+}
+
+/* dict_merge_many against serial loops: counts summed by combine, or
+the last shard winning like a dict_update loop; copying and moving, on
+one thread and on four, then out of memory at every step it allocates */
+static void
+test_dict_merge(void) {
+    DictObject *shards[6], *dp, *ref;
+    Allocator *old;
+    char keybuf[32];
+    void *key, *value;
+    size_t i, v, move, nthreads, fails, used;
+    for (move = 0; move < 2; move++) {
+        for (nthreads = 1; nthreads <= 4; nthreads += 3) {
+            merge_shards(shards, 6);
+            dp = dict_new();
+            ref = dict_new();
+            for (i = 0; i < 3000; i++) {
+                sprintf(keybuf, "m%u", (unsigned)(i * 5));
+                v = 1;
+                dict_set(dp, keybuf, &v);
+                dict_set(ref, keybuf, &v);
+            }
+            for (i = 0; i < 6; i++)
+                DICT_FOREACH(shards[i], key, value)
+                    *(size_t *)dict_fget(ref, key) += *(size_t *)value;
+            assert(dict_merge_many(dp, shards, 6, combine_sum, (int)move,
+                                   nthreads) == 0);
+            check_dict_equal(dp, ref);
+            for (i = 0; i < 6; i++) {
+                if (move) {
+                    /* left empty but usable */
+                    assert(shards[i]->used == 0);
+                    assert(dict_get(shards[i], "m0") == NULL);
+                    assert(dict_set(shards[i], "m0", &v) == 0);
+                }
+                dict_free(shards[i]);
+            }
+            dict_free(dp);
+            dict_free(ref);
+
+            merge_shards(shards, 6);
+            dp = dict_new();
+            ref = dict_new();
+            for (i = 0; i < 6; i++)
+                assert(dict_update(ref, shards[i]) == 0);
+            assert(dict_merge_many(dp, shards, 6, combine_last, (int)move,
+                                   nthreads) == 0);
+            check_dict_equal(dp, ref);
+            for (i = 0; i < 6; i++)
+                dict_free(shards[i]);
+            dict_free(dp);
+            dict_free(ref);
+        }
+    }
+
+    /* a failed merge leaves dp and the shards as they were */
+    for (move = 0; move < 2; move++) {
+        fails = 0;
+        for (i = 0; ; i++) {
+            merge_shards(shards, 3);
+            old = mem_use_allocator(&fail_allocator);
+            dp = dict_new();
+            mem_use_allocator(old);
+            v = 1;
+            dict_set(dp, "m1", &v);
+            ref = dict_copy(dp);
+            used = shards[0]->used;
+            fail_countdown = i;
+            if (dict_merge_many(dp, shards, 3, combine_sum, (int)move, 4) == 0) {
+                fail_countdown = SIZE_MAX;
+                for (v = 0; v < 3; v++)
+                    dict_free(shards[v]);
+                dict_free(dp);
+                dict_free(ref);
+                break;
+            }
+            fail_countdown = SIZE_MAX;
+            fails++;
+            check_dict_equal(dp, ref);
+            assert(shards[0]->used == used);
+            for (v = 0; v < 3; v++)
+                dict_free(shards[v]);
+            dict_free(dp);
+            dict_free(ref);
+        }
+        assert(fails > 0);
+    }
+}
+
+/* keys and values handed over by dict_pop, dict_take, set_pop,
+dict_update_move and list_extend_move are owned by one side only, and
+the sources are left empty but usable */
+/* counts the blocks it has out, and is only ever asked for one on the
+thread that owns it, as a non thread safe allocator such as an arena
+must be */
+static size_t own_live;
+static pthread_t own_thread;
+
+static void *
+own_alloc(void *ctx, size_t size) {
+    void *p;
+    (void)ctx;
+    assert(pthread_equal(pthread_self(), own_thread));
+    if ((p = malloc(size)) != NULL)
+        own_live++;
+    return p;
+}
+
+static void *
+own_realloc(void *ctx, void *p, size_t size) {
+    void *q;
+    (void)ctx;
+    assert(pthread_equal(pthread_self(), own_thread));
+    if ((q = realloc(p, size)) != NULL && p == NULL)
+        own_live++;
+    return q;
+}
+
+static void
+own_free(void *ctx, void *p) {
+    (void)ctx;
+    assert(pthread_equal(pthread_self(), own_thread));
+    if (p != NULL)
+        own_live--;
+    free(p);
+}
+
+static Allocator own_allocator = {
+    own_alloc, own_realloc, own_free, NULL, NULL
+};
+
+/* the *_anew constructors take their allocator over the thread's one,
+and the list key index and the scratch of the partitioned set ops and
+of dict_merge_many come from the container's allocator, on the calling
+thread only */
+static void
+test_anew(void) {
+    SetObject *(*ops[4])(SetObject *, SetObject *, size_t) = {
+        set_pand, set_por, set_psub, set_pxor
+    };
+    DictObject *dp, *shards[6];
+    SetObject *a, *b, *r;
+    ListObject *lp;
+    rbtree *tr;
+    CListObject *clp;
+    Allocator *old;
+    char keybuf[32];
+    size_t i, k, v = 1;
+    int n;
+    own_thread = pthread_self();
+    own_live = 0;
+    /* the thread's allocator would fail them all */
+    old = mem_use_allocator(&fail_allocator);
+    fail_countdown = 0;
+    dp = dict_anew(&own_allocator, 0, NULL, NULL, NULL, NULL, NULL, NULL,
+                   NULL);
+    a = set_anew(&own_allocator, 0, NULL, NULL, NULL, NULL);
+    b = set_anew(&own_allocator, 0, NULL, NULL, NULL, NULL);
+    lp = list_anew(&own_allocator, 0, NULL, NULL, NULL);
+    tr = rb_anew(&own_allocator, NULL, NULL, NULL, NULL, NULL, NULL);
+    clp = clist_anew(&own_allocator, NULL, NULL, NULL);
+    fail_countdown = SIZE_MAX;
+    mem_use_allocator(old);
+    assert(dp && a && b && lp && tr && clp);
+    assert(dp->allocator == &own_allocator && a->allocator == &own_allocator
+           && lp->allocator == &own_allocator && tr->allocator == &own_allocator
+           && clp->allocator == &own_allocator);
+    for (i = 0; i < 6000; i++) {
+        sprintf(keybuf, "k%u", (unsigned)i);
+        n = (int)i;
+        assert(set_add(a, keybuf) == 0 && rb_add(tr, keybuf, &v) == 0
+               && list_add(lp, &n) == 0 && clist_add(clp, &n) == 0);
+        sprintf(keybuf, "k%u", (unsigned)(i + 3000));
+        assert(set_add(b, keybuf) == 0);
+    }
+    assert(own_live > 0);
+    /* big enough to be partitioned, on four threads */
+    for (k = 0; k < 4; k++) {
+        r = ops[k](a, b, 4);
+        assert(r != NULL && r->allocator == mem_allocator);
+        set_free(r);
+    }
+    merge_shards(shards, 6);
+    assert(dict_merge_many(dp, shards, 6, combine_sum, 0, 4) == 0);
+    assert(dp->used > 0);
+    for (k = 0; k < 6; k++)
+        dict_free(shards[k]);
+    dict_free(dp);
+    set_free(a);
+    set_free(b);
+    list_free(lp);
+    rb_free(tr);
+    clist_free(clp);
+    assert(own_live == 0);
+    /* an indexed list's index and its entries */
+    old = mem_use_allocator(&own_allocator);
+    lp = list_cnew_indexed(0, int_hash, NULL, NULL, NULL);
+    mem_use_allocator(old);
+    assert(lp != NULL && lp->lookup->dict->allocator == &own_allocator);
+    for (i = 0; i < 1000; i++) {
+        n = (int)(i % 300);
+        assert(list_add(lp, &n) == 0);
+    }
+    n = 7;
+    assert(list_count(lp, &n) == 4 && list_remove(lp, &n) == 0);
+    assert(list_count(lp, &n) == 3);
+    list_free(lp);
+    assert(own_live == 0);
+}
+
+/* a dict whose table outgrows mem_huge_new's threshold gets mappings of
+its own through its resizes, and gives them all back when freed */
+static void
+test_huge(void) {
+    Allocator *ha = mem_huge_new(1 << 16, MEM_NUMA_LOCAL, 0);
+    DictObject *dp;
+    MemHugeStats st;
+    char keybuf[32];
+    size_t i, v = 1;
+    assert(ha != NULL);
+    dp = dict_anew(ha, 0, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
+    assert(dp != NULL);
+    for (i = 0; i < 20000; i++) {
+        sprintf(keybuf, "h%u", (unsigned)i);
+        assert(dict_set(dp, keybuf, &v) == 0);
+    }
+    for (i = 0; i < 20000; i += 7) {
+        sprintf(keybuf, "h%u", (unsigned)i);
+        assert(dict_has(dp, keybuf));
+    }
+#ifdef __linux__
+    assert(mem_huge_stats(ha, &st) == 0);
+    /* only the table is that big */
+    assert(st.maps == 1
+           && st.mapped >= (dp->mask + 1) * sizeof(DictEntry));
+#else
+    mem_huge_stats(ha, &st);
+    assert(st.maps == 0);
+#endif
+    dict_free(dp);
+    mem_huge_stats(ha, &st);
+    assert(st.maps == 0 && st.mapped == 0 && st.huge == 0);
+    mem_huge_free(ha);
+}
+
+static void
+test_move(void) {
+    DictObject *dp = dict_new(), *other = dict_new();
+    SetObject *sp = set_new(), *seen = set_new();
+    ListObject *lp = list_new(), *lp2 = list_new();
+    char keybuf[32];
+    void *key, *value;
+    size_t i, v, n;
+    int k;
+    for (i = 0; i < 2000; i++) {
+        sprintf(keybuf, "v%u", (unsigned)i);
+        assert(dict_add(dp, keybuf, &i) == 0);
+    }
+    for (i = 0; i < 2000; i++) {
+        sprintf(keybuf, "v%u", (unsigned)i);
+        if (i & 1) {
+            value = dict_pop(dp, keybuf, &key);
+            assert(strcmp((char *)key, keybuf) == 0 && key != keybuf);
+            mem_free(key);
+        } else
+            value = dict_take(dp, keybuf);
+        assert(value != NULL && *(size_t *)value == i);
+        mem_free(value);
+        assert(dict_get(dp, keybuf) == NULL && dp->used == 1999 - i);
+    }
+    assert(dict_take(dp, "v0") == NULL && dict_pop(dp, "v1", &key) == NULL);
+    n = 0;
+    DICT_FOREACH(dp, key, value)
+        n++;
+    assert(n == 0);
+    v = 7;
+    assert(dict_add(dp, "again", &v) == 0 && *(size_t *)dict_get(dp, "again") == 7);
+    dict_clear(dp);
+
+    /* overlapping keys take other's values */
+    for (i = 0; i < 1500; i++) {
+        sprintf(keybuf, "u%u", (unsigned)i);
+        v = 1;
+        if (i < 1000)
+            assert(dict_set(dp, keybuf, &v) == 0);
+        v = 2;
+        if (i >= 500)
+            assert(dict_set(other, keybuf, &v) == 0);
+    }
+    assert(dict_update_move(dp, other) == 0);
+    assert(dp->used == 1500 && other->used == 0);
+    for (i = 0; i < 1500; i++) {
+        sprintf(keybuf, "u%u", (unsigned)i);
+        assert(*(size_t *)dict_get(dp, keybuf) == (i < 500 ? 1 : 2));
+        assert(dict_get(other, keybuf) == NULL);
+    }
+    assert(dict_set(other, "u1", &v) == 0 && other->used == 1);
+
+    for (i = 0; i < 1000; i++) {
+        sprintf(keybuf, "s%u", (unsigned)i);
+        assert(set_add(sp, keybuf) == 0);
+    }
+    while ((key = set_pop(sp)) != NULL) {
+        assert(!set_has(seen, key) && set_add(seen, key) == 0);
+        mem_free(key);
+    }
+    assert(sp->used == 0 && set_len(seen) == 1000);
+    assert(set_add(sp, "s1") == 0 && set_has(sp, "s1") && set_len(sp) == 1);
+
+    for (k = 0; k < 20; k++)
+        assert(list_add(k < 10 ? lp : lp2, &k) == 0);
+    assert(list_extend_move(lp, lp2) == 0);
+    assert(lp->used == 20 && lp2->used == 0);
+    for (k = 0; k < 20; k++)
+        assert(*(int *)list_get(lp, k) == k);
+    assert(list_add(lp2, &k) == 0 && *(int *)list_get(lp2, 0) == 20);
+
+    dict_free(dp);
+    dict_free(other);
+    set_free(sp);
+    set_free(seen);
+    list_free(lp);
+    list_free(lp2);
+}
+
 void
 test_communicate() {
     int valuebuf[] = { 1 };
@@ -225,6 +1434,20 @@ test_communicate() {
 
 /*scan words from stdin, print total amount for each word by DESC order*/
 int main(void) {
+    test_rb_hint();
+    test_list_deque();
+    test_list_index();
+    test_clist();
+    test_set_partition();
+    test_bitmap();
+    test_sketch();
+    test_intern();
+    test_intern_arena();
+    test_parallel();
+    test_dict_merge();
+    test_anew();
+    test_huge();
+    test_move();
     test_dict();
     return 0;
 }
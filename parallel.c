@@ -0,0 +1,117 @@
+#include <pthread.h>
+#include "xlib.h"
+
+typedef struct {
+    pthread_t tid;
+    size_t id;
+    void (*fn)(void *arg, size_t id);
+    void *arg;
+} Worker;
+
+/* The pool. Its threads are started on demand and then wait for work
+for the rest of the process. A run hands ids 1..want to whichever of
+them wakes first, and is over once pending drops to 0. */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static size_t pool_size;  /* # threads started */
+static int pool_busy;  /* a run is in progress */
+static void (*pool_fn)(void *arg, size_t id);
+static void *pool_arg;
+static size_t pool_next = 1;  /* next id to hand out */
+static size_t pool_want;  /* last id of the run */
+static size_t pool_pending;  /* # ids handed out or not, yet to finish */
+
+static void *
+pool_main(void *unused) {
+    size_t id;
+    void (*fn)(void *arg, size_t id);
+    void *arg;
+    (void)unused;
+    pthread_mutex_lock(&pool_lock);
+    for (;;) {
+        while (pool_next > pool_want)
+            pthread_cond_wait(&pool_work, &pool_lock);
+        id = pool_next++;
+        fn = pool_fn;
+        arg = pool_arg;
+        pthread_mutex_unlock(&pool_lock);
+        fn(arg, id);
+        pthread_mutex_lock(&pool_lock);
+        if (--pool_pending == 0)
+            pthread_cond_signal(&pool_done);
+    }
+    return NULL;
+}
+
+static void *
+worker_main(void *_w) {
+    Worker *w = (Worker *)_w;
+    w->fn(w->arg, w->id);
+    return NULL;
+}
+
+/* threads of their own, for a run while the pool is busy with another
+one, e.g. from inside fn */
+static size_t
+spawn_run(size_t nthreads, void (*fn)(void *arg, size_t id), void *arg) {
+    size_t i, started = 0;
+    Worker *workers = Mem_NEW(Worker, nthreads - 1);
+    /* without the workers array everything runs on this thread */
+    if (workers != NULL) {
+        for (i = 0; i < nthreads - 1; i++) {
+            workers[i].id = i + 1;
+            workers[i].fn = fn;
+            workers[i].arg = arg;
+            if (pthread_create(&workers[i].tid, NULL, worker_main,
+                               workers + i) != 0)
+                break;
+            started++;
+        }
+    }
+    fn(arg, 0);
+    for (i = 0; i < started; i++)
+        pthread_join(workers[i].tid, NULL);
+    Mem_FREE(workers);
+    return started + 1;
+}
+
+size_t
+parallel_run(size_t nthreads, void (*fn)(void *arg, size_t id), void *arg) {
+    pthread_t tid;
+    pthread_attr_t attr;
+    size_t want;
+    if (nthreads <= 1) {
+        fn(arg, 0);
+        return 1;
+    }
+    pthread_mutex_lock(&pool_lock);
+    if (pool_busy) {
+        pthread_mutex_unlock(&pool_lock);
+        return spawn_run(nthreads, fn, arg);
+    }
+    pool_busy = 1;
+    if (pool_size < nthreads - 1) {
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        while (pool_size < nthreads - 1
+               && pthread_create(&tid, &attr, pool_main, NULL) == 0)
+            pool_size++;
+        pthread_attr_destroy(&attr);
+    }
+    want = nthreads - 1 < pool_size ? nthreads - 1 : pool_size;
+    pool_fn = fn;
+    pool_arg = arg;
+    pool_next = 1;
+    pool_want = want;
+    pool_pending = want;
+    pthread_cond_broadcast(&pool_work);
+    pthread_mutex_unlock(&pool_lock);
+    fn(arg, 0);
+    pthread_mutex_lock(&pool_lock);
+    while (pool_pending)
+        pthread_cond_wait(&pool_done, &pool_lock);
+    pool_busy = 0;
+    pthread_mutex_unlock(&pool_lock);
+    return want + 1;
+}
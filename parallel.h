@@ -0,0 +1,15 @@
+/* Run fn(arg, id) for every id in [0, nthreads), id 0 on the calling
+thread and the others on a pool of threads kept for later runs, and wait
+for all of them. A run made while another is in progress, e.g. from
+inside @fn, gets threads of its own. If a thread can't be started, the
+ids from there on are not run, so @fn should take its work from a
+shared counter rather than rely on its id. Returns the number of ids
+actually run. */
+size_t parallel_run(size_t nthreads, void (*fn)(void *arg, size_t id), void *arg);
+
+/* # chunks per thread a table is cut in by the *_parallel_* functions,
+so that a thread with a dense chunk doesn't keep the others waiting */
+#define PARALLEL_CHUNKS 4
+
+/* next unit of work shared by the threads of a parallel_run */
+#define PARALLEL_NEXT(counter) __atomic_fetch_add(&(counter), 1, __ATOMIC_RELAXED)
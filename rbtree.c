@@ -7,12 +7,14 @@ default_keycmp(void *key1, void *key2) {
 
 static void *
 default_keydup(void *key) {
-    return (void *)strdup((char *)key);
+    return (void *)mem_strdup(mem_allocator, (char *)key);
 }
 
 static void *
 default_valuedup(void *_value) {
-    size_t *value = (size_t*)malloc(sizeof(size_t));
+    size_t *value = Mem_NEW(size_t, 1);
+    if (value == NULL)
+        return NULL;
     *value = *(size_t *)_value;
     return (void *)value;
 }
@@ -20,27 +22,29 @@ default_valuedup(void *_value) {
 /* dvf is short for "default_value_function" */
 static void *
 default_dvf(void) {
-    size_t *value = (size_t*)malloc(sizeof(size_t));
+    size_t *value = Mem_NEW(size_t, 1);
+    if (value == NULL)
+        return NULL;
     *value = 0;
     return (void *)value;
 }
 
 static rbnode *
 rbnode_new(rbtree *tr, void *key, void *value) {
-    rbnode *nd = (rbnode *) malloc(sizeof(rbnode));
+    rbnode *nd = Mem_ANEW(tr->allocator, rbnode, 1);
     if (nd == NULL)
         return NULL;
     memset(nd, 0, sizeof(rbnode));
     if (key) {
         if ((nd->key = tr->keydup(key)) == NULL) {
-            free(nd);
+            Mem_AFREE(tr->allocator, nd);
             return NULL;
         }
     }
     if (value) {
         if ((nd->value = tr->valuedup(value)) == NULL) {
-            free(nd->key);
-            free(nd);
+            tr->keyfree(nd->key);
+            Mem_AFREE(tr->allocator, nd);
             return NULL;
         }
     }
@@ -50,17 +54,17 @@ rbnode_new(rbtree *tr, void *key, void *value) {
 static rbnode *
 rbnode_fnew(rbtree *tr, void *key) {
     assert(key);
-    rbnode *nd = (rbnode *) malloc(sizeof(rbnode));
+    rbnode *nd = Mem_ANEW(tr->allocator, rbnode, 1);
     if (nd == NULL)
         return NULL;
     memset(nd, 0, sizeof(rbnode));
     if ((nd->key = tr->keydup(key)) == NULL) {
-        free(nd);
+        Mem_AFREE(tr->allocator, nd);
         return NULL;
     }
     if ((nd->value = tr->dvf()) == NULL) {
-        free(nd->key);
-        free(nd);
+        tr->keyfree(nd->key);
+        Mem_AFREE(tr->allocator, nd);
         return NULL;
     }
     return nd;
@@ -70,7 +74,7 @@ static void
 rbnode_clear(rbtree *tr, rbnode *nd) {
     tr->keyfree(nd->key);
     tr->valuefree(nd->value);
-    free(nd);
+    Mem_AFREE(tr->allocator, nd);
 }
 
 static void
@@ -86,6 +90,8 @@ void
 rb_clear(rbtree *tr) {
     _rb_clear(tr, tr->root);
     tr->root = tr->nil;
+    tr->finger = tr->nil;
+    tr->max = tr->nil;
     tr->size = 0;
 }
 
@@ -93,7 +99,7 @@ void
 rb_free(rbtree *tr) {
     _rb_clear(tr, tr->root);
     rbnode_clear(tr, tr->nil);
-    free(tr);
+    Mem_AFREE(tr->allocator, tr);
 }
 
 static void
@@ -187,6 +193,87 @@ rb_add_fixup(rbtree *tr, rbnode *z) {
     tr->root->color = BLACK;
 }
 
+/*link new node @z as a child of @y (on the left side if @left), then
+rebalance. Every insertion path ends here, so the finger and max are
+maintained in one place.*/
+static void
+rb_link(rbtree *tr, rbnode *z, rbnode *y, int left) {
+    z->p = y;
+    if (y == tr->nil) {
+        tr->root = z;
+        tr->max = z;
+    } else if (left) {
+        y->left = z;
+    } else {
+        y->right = z;
+        if (y == tr->max)
+            tr->max = z;
+    }
+    z->left = tr->nil;
+    z->right = tr->nil;
+    z->color = RED;
+    tr->finger = z;
+    rb_add_fixup(tr, z);
+    tr->size++;
+}
+
+/*intern routine used by rb_hadd and rb_rhadd. Find the parent of a new
+@key by climbing from @hint until the subtree in hand must hold @key,
+then descending from there. *left tells on which side to link.*/
+static rbnode *
+rbnode_hint_parent(rbtree *tr, rbnode *hint, void *key, int *left) {
+    rbnode *x = hint, *a;
+    if (x == NULL || x == tr->nil)
+        x = tr->finger;
+    if (x == tr->nil) {
+        *left = 0;
+        return tr->nil;
+    }
+    if (tr->keycmp(key, x->key) >= 0) {
+        /*@key goes after x. The right subtree of x holds every key up
+        to the nearest ancestor reached through a left link.*/
+        while (x != tr->max) {
+            for (a = x; a != tr->root && a == a->p->right; a = a->p)
+                ;
+            if (a == tr->root)
+                break;
+            a = a->p;
+            if (tr->keycmp(key, a->key) < 0)
+                break;
+            x = a;
+        }
+        if (x->right == tr->nil) {
+            *left = 0;
+            return x;
+        }
+        x = x->right;
+    } else {
+        /*symmetric case, @key goes before x*/
+        for (;;) {
+            for (a = x; a != tr->root && a == a->p->left; a = a->p)
+                ;
+            if (a == tr->root)
+                break;
+            a = a->p;
+            if (tr->keycmp(key, a->key) >= 0)
+                break;
+            x = a;
+        }
+        if (x->left == tr->nil) {
+            *left = 1;
+            return x;
+        }
+        x = x->left;
+    }
+    for (;;) {
+        *left = tr->keycmp(key, x->key) < 0;
+        a = *left ? x->left : x->right;
+        if (a == tr->nil)
+            return x;
+        x = a;
+    }
+}
+
 static void
 rb_transplant(rbtree *tr, rbnode *u, rbnode *v) {
     if (u->p == tr->nil)
@@ -256,53 +343,75 @@ rb_del_fixup(rbtree *tr, rbnode *x) {
 }
 
 rbtree *
-rb_cnew(int (*keycmp)(void *key1, void *key2),
+rb_anew(Allocator *a,
+        int (*keycmp)(void *key1, void *key2),
         void * (*keydup)(void *key),
         void * (*valuedup)(void *value),
         void * (*dvf)(void),
         void (*keyfree)(void *key),
         void (*valuefree)(void *value)) {
-    rbtree *tr = (rbtree *) malloc(sizeof(rbtree));
+    rbtree *tr;
+    if (a == NULL)
+        a = mem_allocator;
+    tr = Mem_ANEW(a, rbtree, 1);
     if (tr == NULL)
         return NULL;
+    tr->allocator = a;
     rbnode *nil = rbnode_new(tr, 0, 0);
     if (nil == NULL) {
-        free(tr);
+        Mem_AFREE(a, tr);
         return NULL;
     }
     tr->nil = nil;
     tr->root = nil;
+    tr->finger = nil;
+    tr->max = nil;
     tr->size = 0;
     tr->keycmp = keycmp ? keycmp : default_keycmp;
     tr->keydup = keydup ? keydup : default_keydup;
     tr->valuedup = valuedup ? valuedup : default_valuedup;
     tr->dvf = dvf ? dvf : default_dvf;
-    tr->keyfree = keyfree ? keyfree : free;
-    tr->valuefree = valuefree ? valuefree : free;
+    tr->keyfree = keyfree ? keyfree : mem_free;
+    tr->valuefree = valuefree ? valuefree : mem_free;
     return tr;
 }
 
+rbtree *
+rb_cnew(int (*keycmp)(void *key1, void *key2),
+        void * (*keydup)(void *key),
+        void * (*valuedup)(void *value),
+        void * (*dvf)(void),
+        void (*keyfree)(void *key),
+        void (*valuefree)(void *value)) {
+    return rb_anew(MEM_CONTAINER_ALLOCATOR(), keycmp, keydup, valuedup, dvf,
+                   keyfree, valuefree);
+}
+
 rbtree *
 rb_new(void) {
-    rbtree *tr = (rbtree *) malloc(sizeof(rbtree));
+    Allocator *a = MEM_CONTAINER_ALLOCATOR();
+    rbtree *tr = Mem_ANEW(a, rbtree, 1);
     if (tr == NULL)
         return NULL;
+    tr->allocator = a;
     rbnode *nil = rbnode_new(tr, 0, 0);
 //    assert(nil->key==NULL);
 //    assert(nil->value==NULL);
     if (nil == NULL) {
-        free(tr);
+        Mem_AFREE(a, tr);
         return NULL;
     }
     tr->nil = nil;
     tr->root = nil;
+    tr->finger = nil;
+    tr->max = nil;
     tr->size = 0;
     tr->keycmp = default_keycmp;
     tr->keydup = default_keydup;
     tr->valuedup = default_valuedup;
     tr->dvf = default_dvf;
-    tr->keyfree = free;
-    tr->valuefree = free;
+    tr->keyfree = mem_free;
+    tr->valuefree = mem_free;
     return tr;
 }
 
@@ -316,7 +425,7 @@ void *
 rb_fget(rbtree *tr, void *key) {
     rbnode *y = tr->nil;
     rbnode *x = tr->root;
-    int r;
+    int r = 0;
     while (x != tr->nil) {
         r = tr->keycmp(key, x->key);
         if (r == 0)
@@ -331,18 +440,7 @@ rb_fget(rbtree *tr, void *key) {
     if (z == NULL)
         return NULL;
     rbnode *original_z = z;
-    z->p = y;
-    if (y == tr->nil)
-        tr->root = z;
-    else if (tr->keycmp(key, y->key) < 0)
-        y->left = z;
-    else
-        y->right = z;
-    z->left = tr->nil;
-    z->right = tr->nil;
-    z->color = RED;
-    rb_add_fixup(tr, z);
-    tr->size++;
+    rb_link(tr, z, y, r < 0);
     return original_z->value;
 }
 
@@ -353,7 +451,7 @@ rb_set(rbtree *tr, void *key, void *value) {
     void *oldvalue;
     rbnode *y = tr->nil;
     rbnode *x = tr->root;
-    int r;
+    int r = 0;
     while (x != tr->nil) {
         r = tr->keycmp(key, x->key);
         if (r == 0) {
@@ -372,18 +470,7 @@ rb_set(rbtree *tr, void *key, void *value) {
     rbnode *z = rbnode_new(tr, key, value);
     if (z == NULL)
         return -1;
-    z->p = y;
-    if (y == tr->nil)
-        tr->root = z;
-    else if (tr->keycmp(key, y->key) < 0)
-        y->left = z;
-    else
-        y->right = z;
-    z->left = tr->nil;
-    z->right = tr->nil;
-    z->color = RED;
-    rb_add_fixup(tr, z);
-    tr->size++;
+    rb_link(tr, z, y, r < 0);
     return 0;
 }
 
@@ -394,7 +481,7 @@ rb_rset(rbtree *tr, void *key, void *value) {
     void *oldvalue;
     rbnode *y = tr->nil;
     rbnode *x = tr->root;
-    int r;
+    int r = 0;
     while (x != tr->nil) {
         r = tr->keycmp(key, x->key);
         if (r == 0) {
@@ -416,18 +503,7 @@ rb_rset(rbtree *tr, void *key, void *value) {
         return -1;
     z->key = key;
     z->value = value;
-    z->p = y;
-    if (y == tr->nil)
-        tr->root = z;
-    else if (tr->keycmp(key, y->key) < 0)
-        y->left = z;
-    else
-        y->right = z;
-    z->left = tr->nil;
-    z->right = tr->nil;
-    z->color = RED;
-    rb_add_fixup(tr, z);
-    tr->size++;
+    rb_link(tr, z, y, r < 0);
     return 0;
 }
 
@@ -440,25 +516,16 @@ rb_add(rbtree *tr, void *key, void *value) {
         return -1;
     rbnode *y = tr->nil;
     rbnode *x = tr->root;
+    int r = 0;
     while (x != tr->nil) {
         y = x;
-        if (tr->keycmp(key, x->key) < 0)
+        r = tr->keycmp(key, x->key);
+        if (r < 0)
             x = x->left;
         else
             x = x->right;
     }
-    z->p = y;
-    if (y == tr->nil)
-        tr->root = z;
-    else if (tr->keycmp(z->key, y->key) < 0)
-        y->left = z;
-    else
-        y->right = z;
-    z->left = tr->nil;
-    z->right = tr->nil;
-    z->color = RED;
-    rb_add_fixup(tr, z);
-    tr->size++;
+    rb_link(tr, z, y, r < 0);
     return 0;
 }
 
@@ -471,27 +538,46 @@ rb_radd(rbtree *tr, void *key, void *value) {
         return -1;
     rbnode *y = tr->nil;
     rbnode *x = tr->root;
+    int r = 0;
     while (x != tr->nil) {
         y = x;
-        if (tr->keycmp(key, x->key) < 0)
+        r = tr->keycmp(key, x->key);
+        if (r < 0)
             x = x->left;
         else
             x = x->right;
     }
     z->key = key;
     z->value = value;
-    z->p = y;
-    if (y == tr->nil)
-        tr->root = z;
-    else if (tr->keycmp(z->key, y->key) < 0)
-        y->left = z;
-    else
-        y->right = z;
-    z->left = tr->nil;
-    z->right = tr->nil;
-    z->color = RED;
-    rb_add_fixup(tr, z);
-    tr->size++;
+    rb_link(tr, z, y, r < 0);
+    return 0;
+}
+
+int
+rb_hadd(rbtree *tr, rbnode *hint, void *key, void *value) {
+    assert(key);
+    assert(value);
+    int left;
+    rbnode *z = rbnode_new(tr, key, value);
+    if (z == NULL)
+        return -1;
+    rbnode *y = rbnode_hint_parent(tr, hint, key, &left);
+    rb_link(tr, z, y, left);
+    return 0;
+}
+
+int
+rb_rhadd(rbtree *tr, rbnode *hint, void *key, void *value) {
+    assert(key);
+    assert(value);
+    int left;
+    rbnode *z = rbnode_new(tr, 0, 0);
+    if (z == NULL)
+        return -1;
+    z->key = key;
+    z->value = value;
+    rbnode *y = rbnode_hint_parent(tr, hint, key, &left);
+    rb_link(tr, z, y, left);
     return 0;
 }
 
@@ -523,6 +609,17 @@ rb_del(rbtree *tr, void *key) {
     assert(key);
     rbnode *z = rbnode_get(tr, key);
     assert(z);
+    if (z == tr->finger)
+        /*keep the finger next to z, it is nil only in an empty tree*/
+        tr->finger = z->left != tr->nil ? rb_max(tr, z->left) :
+                     z->p != tr->nil ? z->p : z->right;
+    if (z == tr->max) {
+        /*the new max is z's predecessor*/
+        if (z->left != tr->nil)
+            tr->max = rb_max(tr, z->left);
+        else
+            tr->max = z->p;
+    }
     rbnode *y = z;
     rbcolor y_original_color = y->color;
     rbnode *x;
@@ -628,6 +725,33 @@ rb_prewalk(rbtree *tr, void (*nodef)(rbnode *nd)) {
     return 0;
 }
 
+size_t
+rb_next_batch(rbtree *tr, rbnode **cursor, void **keys, void **values,
+              size_t n) {
+    rbnode *y, *x = *cursor;
+    size_t i = 0;
+    if (x == NULL)
+        x = tr->root == tr->nil ? tr->nil : rb_min(tr, NULL);
+    for (; i < n && x != tr->nil; i++) {
+        keys[i] = x->key;
+        if (values)
+            values[i] = x->value;
+        /* in order successor */
+        if (x->right != tr->nil) {
+            x = rb_min(tr, x->right);
+        } else {
+            y = x->p;
+            while (y != tr->nil && x == y->right) {
+                x = y;
+                y = y->p;
+            }
+            x = y;
+        }
+    }
+    *cursor = x;
+    return i;
+}
+
 static void
 print_nd(rbnode *nd) {
     printf("%s\t%u\n", (char*)nd->key, *(size_t*)nd->value);
@@ -16,6 +16,9 @@ typedef struct rbnode {
 typedef struct rbtree {
     rbnode *root;
     rbnode *nil;
+    rbnode *finger; /* last inserted node or a neighbour of a deleted one,
+                       start point of rb_hadd */
+    rbnode *max;    /* node with the largest key */
     size_t size;
     int (*keycmp)(void *key1, void *key2);
     void *(*keydup)(void *key);
@@ -23,6 +26,7 @@ typedef struct rbtree {
     void *(*dvf)(void);
     void (*keyfree)(void *key);
     void (*valuefree)(void *value);
+    Allocator *allocator;  /* of the struct and nodes */
 } rbtree;
 
 typedef struct {
@@ -38,6 +42,16 @@ rb_cnew(int (*keycmp)(void *key1, void *key2),
         void * (*dvf)(void),
         void (*keyfree)(void *key),
         void (*valuefree)(void *value));
+/* the same, taking the tree and its nodes from @a instead of the
+thread's container allocator, NULL for mem_allocator */
+rbtree *
+rb_anew(Allocator *a,
+        int (*keycmp)(void *key1, void *key2),
+        void * (*keydup)(void *key),
+        void * (*valuedup)(void *value),
+        void * (*dvf)(void),
+        void (*keyfree)(void *key),
+        void (*valuefree)(void *value));
 rbtree *rb_new(void) ;
 void rb_clear(rbtree *tr) ;
 void rb_free(rbtree *tr) ;
@@ -58,10 +72,23 @@ int rb_rset(rbtree *tr, void *key, void *value) ;
 int rb_radd(rbtree *tr, void *key, void *value) ;
 int rb_rupdate(rbtree *tr, void *key, void *value) ;
 
+/*hinted insertion. Search starts from @hint (or the last inserted node
+if @hint is NULL) and only climbs as far as needed, so in-order streams
+such as timestamps cost O(1) key comparisons per insertion.*/
+int rb_hadd(rbtree *tr, rbnode *hint, void *key, void *value) ;
+int rb_rhadd(rbtree *tr, rbnode *hint, void *key, void *value) ;
+
 /* classical non-recursive traversal functions of binary tree */
 int rb_prewalk(rbtree *tr, void (*nodef)(rbnode *nd));
 int rb_inwalk(rbtree *tr, void (*nodef)(rbnode *nd));
 int rb_postwalk(rbtree *tr, void (*nodef)(rbnode *nd));
 
+/* in order traversal by batches. Set *cursor to NULL to start, it's left
+at the next node. Fills @keys and @values (unless NULL) with up to @n
+items, returns how many, 0 past the end. The tree mustn't change
+meanwhile. */
+size_t rb_next_batch(rbtree *tr, rbnode **cursor, void **keys, void **values,
+                     size_t n);
+
 /*other functions for printing or testing*/
 void rb_print(rbtree *tr);
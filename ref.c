@@ -0,0 +1,77 @@
+#include "xlib.h"
+
+/* the header sits right in front of a key's bytes, the union keeps the
+   bytes as aligned as malloc's */
+typedef union {
+    struct {
+        size_t refcnt;
+        size_t size;
+    } h;
+    long double align1;
+    void *align2;
+} RefHeader;
+
+#define REF_HEAD(key) ((RefHeader *)(key) - 1)
+
+void *
+ref_new(const void *data, size_t size) {
+    RefHeader *head;
+    if (size > SSIZE_T_MAX - sizeof(RefHeader))
+        return NULL;
+    head = (RefHeader *)Mem_MALLOC(sizeof(RefHeader) + size);
+    if (head == NULL)
+        return NULL;
+    head->h.refcnt = 1;
+    head->h.size = size;
+    memcpy(head + 1, data, size);
+    return (void *)(head + 1);
+}
+
+void *
+ref_str(const char *s) {
+    return ref_new(s, strlen(s) + 1);
+}
+
+void *
+ref_retain(void *key) {
+    __atomic_fetch_add(&REF_HEAD(key)->h.refcnt, 1, __ATOMIC_RELAXED);
+    return key;
+}
+
+void
+ref_release(void *key) {
+    RefHeader *head = REF_HEAD(key);
+    if (__atomic_sub_fetch(&head->h.refcnt, 1, __ATOMIC_ACQ_REL) == 0)
+        Mem_FREE(head);
+}
+
+size_t
+ref_count(void *key) {
+    return __atomic_load_n(&REF_HEAD(key)->h.refcnt, __ATOMIC_RELAXED);
+}
+
+size_t
+ref_size(void *key) {
+    return REF_HEAD(key)->h.size;
+}
+
+size_t
+ref_keyhash(void *key) {
+    unsigned char *p = (unsigned char *)key;
+    size_t i, hash = 5381, size = REF_HEAD(key)->h.size;
+    for (i = 0; i < size; i++)
+        hash = ((hash << 5) + hash) + p[i]; /* hash * 33 + c */
+    return hash;
+}
+
+int
+ref_keycmp(void *key1, void *key2) {
+    size_t size1 = REF_HEAD(key1)->h.size, size2 = REF_HEAD(key2)->h.size;
+    int r;
+    if (key1 == key2)
+        return 0;
+    r = memcmp(key1, key2, size1 < size2 ? size1 : size2);
+    if (r != 0)
+        return r;
+    return size1 < size2 ? -1 : size1 > size2;
+}
@@ -0,0 +1,24 @@
+/* Refcounted keys. A key made by ref_new carries a count in front of its
+bytes. Passing ref_retain as keydup and ref_release as keyfree to
+set_cnew, dict_cnew, rb_cnew or list_cnew makes every copy a shared
+pointer, e.g.
+
+    set_cnew(0, ref_keyhash, ref_keycmp, ref_retain, ref_release);
+
+so derived sets cost a pointer per key, and any mix of sets, dicts and
+lists holding the same key can be freed in any order. Set ops are not
+given special treatment, they go on calling keydup and keyfree. Counts
+are atomic, so keys may be shared by threads. */
+
+/* a refcounted copy of @size bytes at @data, with one reference */
+void *ref_new(const void *data, size_t size);
+/* the same for a string, which stays usable with the string callbacks */
+void *ref_str(const char *s);
+void *ref_retain(void *key);
+void ref_release(void *key);
+size_t ref_count(void *key);
+size_t ref_size(void *key);
+
+/* hash and compare refcounted keys by their bytes */
+size_t ref_keyhash(void *key);
+int ref_keycmp(void *key1, void *key2);
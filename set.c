@@ -1,8 +1,19 @@
 #include "xlib.h"
 // test aaa bbb
 /* Object used as dummy key to fill deleted entries */
-static DummyStruct _dummy_struct;
-#define dummy (&_dummy_struct)
+DummyStruct set_dummy_struct;
+#define dummy SET_DUMMY
+
+/* fingerprint bit of a hash, the top 6 bits of a fibonacci hashing */
+#define FP_BIT(hash) ((uint64_t)1 << (((uint64_t)(hash) * 0x9e3779b97f4a7c15ULL) >> 58))
+#define FP_ADD(sp, hash) do {\
+    if ((sp)->fpstate != SET_FP_OFF)\
+        (sp)->fingerprint |= FP_BIT(hash);\
+    } while(0)
+#define FP_DEL(sp) do {\
+    if ((sp)->fpstate == SET_FP_ON)\
+        (sp)->fpstate = SET_FP_STALE;\
+    } while(0)
 
 static size_t
 default_keyhash(void *_key) {
@@ -20,7 +31,7 @@ default_keycmp(void *key1, void *key2) {
 
 static void *
 default_keydup(void *key) {
-    return (void *)strdup((char *)key);
+    return (void *)mem_strdup(mem_allocator, (char *)key);
 }
 
 static SetEntry *
@@ -89,21 +100,44 @@ set_has_intern(SetObject *sp, void *key, size_t hash) {
     return ep->key && ep->key != dummy;
 }
 
+/* give ep a copy of @key, inline if it is short enough */
+static int
+set_entry_dup(SetObject *sp, SetEntry *ep, void *key) {
+    void *copy;
+#ifdef X_INLINE_KEYS
+    if (sp->keydup == default_keydup) {
+        size_t len = strlen((char *)key);
+        if (len < INLINE_KEY_SIZE) {
+            memcpy(ep->inl, key, len + 1);
+            ep->key = ep->inl;
+            ep->isinline = 1;
+            return 0;
+        }
+    }
+#endif
+    if ((copy = sp->keydup(key)) == NULL)
+        return -1;
+    ENTRY_SET_REF(ep, copy);
+    return 0;
+}
+
 /* try to insert key's copy to sp */
 static int
 set_insert(SetObject *sp, void *key, size_t hash) {
     SetEntry *ep = set_search(sp, key, hash);
     if (ep->key == NULL) {
-        if ((ep->key = sp->keydup(key)) == NULL)
+        if (set_entry_dup(sp, ep, key) == -1)
             return -1;
         sp->fill++;
         sp->used++;
         ep->hash = hash;
+        FP_ADD(sp, hash);
     } else if (ep->key == dummy) {
-        if ((ep->key = sp->keydup(key)) == NULL)
+        if (set_entry_dup(sp, ep, key) == -1)
             return -1;
         sp->used++;
         ep->hash = hash;
+        FP_ADD(sp, hash);
     }/* else already key exists, do nothing */
     return 0;
 }
@@ -112,22 +146,24 @@ static int
 set_rinsert(SetObject *sp, void *key, size_t hash) {
     SetEntry *ep = set_search(sp, key, hash);
     if (ep->key == NULL) {
-        ep->key = key;
+        ENTRY_SET_REF(ep, key);
         sp->fill++;
         sp->used++;
         ep->hash = hash;
+        FP_ADD(sp, hash);
     } else if (ep->key == dummy) {
-        ep->key = key;
+        ENTRY_SET_REF(ep, key);
         sp->used++;
         ep->hash = hash;
+        FP_ADD(sp, hash);
     }/* else already key exists, do nothing */
     return 0;
 }
 
-/*intern fast function to assign @key's address to sp
-when no dummy or equal key exists.*/
-static void
-set_insert_clean(SetObject *sp, void *key, size_t hash) {
+/*intern fast function to find @hash's slot in sp
+when no dummy or equal key exists. The caller fills in the key.*/
+static SetEntry *
+set_slot_clean(SetObject *sp, size_t hash) {
     size_t i;
     size_t perturb;
     size_t mask = sp->mask;
@@ -141,8 +177,29 @@ set_insert_clean(SetObject *sp, void *key, size_t hash) {
     }
     sp->fill++;
     sp->used++;
-    ep->key = key;
     ep->hash = hash;
+    FP_ADD(sp, hash);
+    return ep;
+}
+
+/* assign the key of @src, an entry of another table */
+static void
+set_insert_clean_entry(SetObject *sp, SetEntry *src) {
+    SetEntry *ep = set_slot_clean(sp, src->hash);
+    ENTRY_SHARE(ep, src);
+}
+
+/* assign @key's copy */
+static int
+set_insert_clean_dup(SetObject *sp, void *key, size_t hash) {
+    SetEntry *ep = set_slot_clean(sp, hash);
+    if (set_entry_dup(sp, ep, key) == -1) {
+        ep->key = NULL;
+        sp->fill--;
+        sp->used--;
+        return -1;
+    }
+    return 0;
 }
 
 static int
@@ -170,7 +227,7 @@ set_resize(SetObject *sp, size_t minused) {
             oldtable = small_copy;
         }
     } else {
-        newtable = Mem_NEW(SetEntry, newsize);
+        newtable = Mem_ANEW(sp->allocator, SetEntry, newsize);
         if (newtable == NULL)
             return -1;
     }
@@ -180,24 +237,33 @@ set_resize(SetObject *sp, size_t minused) {
     size_t used = sp->used;
     sp->used = 0;
     sp->fill = 0;
+    /* every key is inserted again, which makes the fingerprint exact */
+    if (sp->fpstate != SET_FP_OFF) {
+        sp->fingerprint = 0;
+        sp->fpstate = SET_FP_ON;
+    }
     for (ep = oldtable; used > 0; ep++) {
         if (ep->key && ep->key != dummy) {           /* active key */
             used--;
-            set_insert_clean(sp, ep->key, ep->hash);
+            set_insert_clean_entry(sp, ep);
         }
     }
     if (is_oldtable_malloced)
-        free(oldtable);
+        Mem_AFREE(sp->allocator, oldtable);
     return 0;
 }
 
 SetObject *
-set_cnew(size_t size,
+set_anew(Allocator *a,
+         size_t size,
          size_t (*keyhash)(void *key),
          int (*keycmp)(void *key1, void *key2),
          void * (*keydup)(void *key),
          void (*keyfree)(void *key)) {
-    SetObject *sp = (SetObject *)malloc(sizeof(SetObject));
+    SetObject *sp;
+    if (a == NULL)
+        a = mem_allocator;
+    sp = Mem_ANEW(a, SetObject, 1);
     if (sp == NULL)
         return NULL;
     size_t newsize;
@@ -206,9 +272,11 @@ set_cnew(size_t size,
             newsize <<= 1)
         ;
     if (newsize > HASH_MINSIZE) {
-        SetEntry *newtable = Mem_NEW(SetEntry, newsize);
-        if (newtable == NULL)
+        SetEntry *newtable = Mem_ANEW(a, SetEntry, newsize);
+        if (newtable == NULL) {
+            Mem_AFREE(a, sp);
             return NULL;
+        }
         memset(newtable, 0, sizeof(SetEntry)* newsize);
         sp->table = newtable;
         sp->mask = newsize - 1;
@@ -217,24 +285,41 @@ set_cnew(size_t size,
         EMPTY_TO_MINSIZE(sp);
     }
     sp->type = SET;
+    sp->allocator = a;
+    sp->fingerprint = 0;
+    sp->fpstate = SET_FP_OFF;
     sp->keyhash = keyhash ? keyhash : default_keyhash;
     sp->keycmp = keycmp ? keycmp : default_keycmp;
     sp->keydup = keydup ? keydup : default_keydup;
-    sp->keyfree = keyfree ? keyfree : free;
+    sp->keyfree = keyfree ? keyfree : mem_free;
     return sp;
 }
 
+SetObject *
+set_cnew(size_t size,
+         size_t (*keyhash)(void *key),
+         int (*keycmp)(void *key1, void *key2),
+         void * (*keydup)(void *key),
+         void (*keyfree)(void *key)) {
+    return set_anew(MEM_CONTAINER_ALLOCATOR(), size, keyhash, keycmp,
+                    keydup, keyfree);
+}
+
 SetObject *
 set_new(void) {
-    SetObject *sp = (SetObject *)malloc(sizeof(SetObject));
+    Allocator *a = MEM_CONTAINER_ALLOCATOR();
+    SetObject *sp = Mem_ANEW(a, SetObject, 1);
     if (sp == NULL)
         return NULL;
     EMPTY_TO_MINSIZE(sp);
     sp->type = SET;
+    sp->allocator = a;
+    sp->fingerprint = 0;
+    sp->fpstate = SET_FP_OFF;
     sp->keyhash = default_keyhash;
     sp->keycmp = default_keycmp;
     sp->keydup = default_keydup;
-    sp->keyfree = free;
+    sp->keyfree = mem_free;
     return sp;
 }
 
@@ -254,21 +339,25 @@ set_clear(SetObject *sp) {
         EMPTY_TO_MINSIZE(sp);
     } else /* else it's a small table that's already empty */
         return;
+    if (sp->fpstate != SET_FP_OFF) {
+        sp->fingerprint = 0;
+        sp->fpstate = SET_FP_ON;
+    }
     for (ep = table; used > 0; ep++) {
         /*only free active key, this is different from thon 2.7*/
         if (ep->key && ep->key != dummy) {
             used--;
-            sp->keyfree(ep->key);
+            ENTRY_FREE_KEY(sp, ep);
         }
     }
     if (table_is_malloced)
-        free(table);
+        Mem_AFREE(sp->allocator, table);
 }
 
 void
 set_free(SetObject *sp) {
     set_clear(sp);
-    free(sp);
+    Mem_AFREE(sp->allocator, sp);
 }
 
 /* make a fresh copy of sp, filtering dummy keys by the way.*/
@@ -278,16 +367,14 @@ set_copy(SetObject *sp) {
     if (copy == NULL)
         return NULL;
     SetEntry *ep;
-    void *key;
     size_t used = sp->used;
     for (ep = sp->table; used > 0; ep++) {
         if (ep->key && ep->key != dummy) {           /* active key */
             used--;
-            if ((key = copy->keydup(ep->key)) == NULL) {
+            if (set_insert_clean_dup(copy, ep->key, ep->hash) == -1) {
                 set_free(copy);
                 return NULL;
             }
-            set_insert_clean(copy, key, ep->hash);
         }
     }
     return copy;
@@ -303,7 +390,7 @@ set_rcopy(SetObject *sp) {
     for (ep = sp->table; used > 0; ep++) {
         if (ep->key && ep->key != dummy) {
             used--;
-            set_insert_clean(copy, ep->key, ep->hash);
+            set_insert_clean_entry(copy, ep);
         }
     }
     return copy;
@@ -330,13 +417,15 @@ set_radd(SetObject *sp, void *key) {
     SetEntry *ep = set_search(sp, key, hash);
     if (ep->key == NULL) {
         sp->fill++;
-        ep->key = key;
+        ENTRY_SET_REF(ep, key);
         sp->used++;
         ep->hash = hash;
+        FP_ADD(sp, hash);
     } else if (ep->key == dummy) {
-        ep->key = key;
+        ENTRY_SET_REF(ep, key);
         sp->used++;
         ep->hash = hash;
+        FP_ADD(sp, hash);
     } else if(ep->key != key)
         /*key already exists and its address is different
         from @key's, so free @key*/
@@ -353,9 +442,10 @@ set_del(SetObject *sp, void *key) {
     SetEntry *ep = set_search(sp, key, hash);
     /*only for existing keys*/
     assert(ep->key && ep->key != dummy);
-    sp->keyfree(ep->key);
+    ENTRY_FREE_KEY(sp, ep);
     ep->key = dummy;
     sp->used--;
+    FP_DEL(sp);
 }
 
 /*silent version of set_del*/
@@ -366,9 +456,55 @@ set_discard(SetObject *sp, void *key) {
     SetEntry *ep = set_search(sp, key, hash);
     if (ep->key == NULL || ep->key == dummy)
         return;
-    sp->keyfree(ep->key);
+    ENTRY_FREE_KEY(sp, ep);
     ep->key = dummy;
     sp->used--;
+    FP_DEL(sp);
+}
+
+/* ep's key for the caller to own, a copy if it is inline */
+static void *
+set_entry_take(SetObject *sp, SetEntry *ep) {
+    (void)sp;
+#ifdef X_INLINE_KEYS
+    if (ep->isinline)
+        return sp->keydup(ep->key);
+#endif
+    return ep->key;
+}
+
+/*remove an arbitrary key and hand it over to the caller, NULL if sp is
+empty or copying an inline key fails.*/
+void *
+set_pop(SetObject *sp) {
+    size_t i = 0;
+    SetEntry *ep;
+    void *key;
+    if (sp->used == 0)
+        return NULL;
+    /* The hash field of slot 0 is abused to hold a search finger, so
+     * that popping every key costs one pass over the table:
+     * if slot 0 has a key, pop it, else start looking at its hash,
+     * which may be out of bounds by now.
+     */
+    ep = sp->table;
+    if (ep->key == NULL || ep->key == dummy) {
+        i = ep->hash;
+        if (i > sp->mask || i < 1)
+            i = 1;              /* skip slot 0 */
+        while ((ep = sp->table + i)->key == NULL || ep->key == dummy) {
+            i++;
+            if (i > sp->mask)
+                i = 1;
+        }
+    }
+    if ((key = set_entry_take(sp, ep)) == NULL)
+        return NULL;
+    ep->key = dummy;
+    sp->used--;
+    FP_DEL(sp);
+    sp->table[0].hash = i + 1;  /* next place to start */
+    return key;
 }
 
 /*from other to sp, add keys in other but not in sp */
@@ -427,7 +563,7 @@ set_or(SetObject *sp, SetObject *other) {
             s_used--;
             ep2 = set_search_nodummy(result, key, ep->hash);
             if (ep2->key == NULL) {          /* key not in result*/
-                if ((ep2->key = result->keydup(key)) == NULL) {
+                if (set_entry_dup(result, ep2, key) == -1) {
                     set_free(result);
                     return NULL;
                 }
@@ -465,7 +601,7 @@ set_ror(SetObject *sp, SetObject *other) {
             s_used--;
             ep2 = set_search_nodummy(result, key, ep->hash);
             if (ep2->key == NULL) {          /* key not in result*/
-                ep2->key = key;
+                ENTRY_SHARE(ep2, ep);
                 result->fill++;
                 result->used++;
                 ep2->hash = ep->hash;
@@ -496,9 +632,10 @@ set_iand(SetObject *sp, SetObject *other) {
             used--;
             /* but key not in other */
             if (fast_del || !set_has_intern(other, key, ep->hash)) {
-                sp->keyfree(key);
+                ENTRY_FREE_KEY(sp, ep);
                 ep->key = dummy;
                 sp->used--;
+                FP_DEL(sp);
             } else if (--o_used == 0)
                 /*now, the rest of sp's keys can delete directly*/
                 fast_del = 1;
@@ -519,18 +656,16 @@ set_and(SetObject *sp, SetObject *other) {
         return NULL;
     size_t s_used = sml->used;
     SetEntry *ep;
-    void *key;
     /*walk smaller one is better*/
     for (ep = sml->table; s_used > 0; ep++) {
         if (ep->key && ep->key != dummy) {           /* key in sml */
             s_used--;
             if (set_has_intern(big, ep->key, ep->hash)) {    /* key also in big*/
-                if ((key = sml->keydup(ep->key)) == NULL) {
+                /* there's no dummy key in result, so use this fast way */
+                if (set_insert_clean_dup(result, ep->key, ep->hash) == -1) {
                     set_free(result);
                     return NULL;
                 }
-                /* there's no dummy key in result, so use this fast way */
-                set_insert_clean(result, key, ep->hash);
             }
         }
     }
@@ -554,7 +689,7 @@ set_rand(SetObject *sp, SetObject *other) {
             s_used--;
             if (set_has_intern(big, ep->key, ep->hash)) {    /* key also in big*/
                 /* there's no dummy key in result, so use this fast way */
-                set_insert_clean(result, ep->key, ep->hash);
+                set_insert_clean_entry(result, ep);
             }
         }
     }
@@ -579,9 +714,10 @@ set_isub(SetObject *sp, SetObject *other) {
         if (key && key != dummy) {           /* key in sp */
             used--;
             if (set_has_intern(other, key, ep->hash)) { /* key also in other */
-                sp->keyfree(key);
+                ENTRY_FREE_KEY(sp, ep);
                 ep->key = dummy;
                 sp->used--;
+                FP_DEL(sp);
                 if(--o_used == 0)
                     /*all other's keys are checked, no need to go further*/
                     break;
@@ -604,19 +740,17 @@ set_sub(SetObject *sp, SetObject *other) {
         return NULL;
     size_t used = sp->used;
     SetEntry *ep;
-    void *key;
     size_t fast_add = 0;
     for (ep = sp->table; used > 0; ep++) {
         if (ep->key && ep->key != dummy) {   /* key in sp */
             used--;
             /* but key not in other */
             if (fast_add || !set_has_intern(other, ep->key, ep->hash)) {
-                if ((key = result->keydup(ep->key)) == NULL) {
+                /* there's no dummy key in result, so use this faster way */
+                if (set_insert_clean_dup(result, ep->key, ep->hash) == -1) {
                     set_free(result);
                     return NULL;
                 }
-                /* there's no dummy key in result, so use this faster way */
-                set_insert_clean(result, key, ep->hash);
             } else if (--o_used == 0)
                 /*if key is also in other and all its keys are checked,
                 the rest of sp's keys can add to result directly from now on*/
@@ -645,7 +779,7 @@ set_rsub(SetObject *sp, SetObject *other) {
             /* but key not in other */
             if (fast_add || !set_has_intern(other, ep->key, ep->hash)) {
                 /* there's no dummy key in result, so use this faster way */
-                set_insert_clean(result, ep->key, ep->hash);
+                set_insert_clean_entry(result, ep);
             } else if (--o_used == 0)
                 /*if key is also in other and all its keys are checked,
                 the rest of sp's keys can add to result directly from now on*/
@@ -682,16 +816,18 @@ set_ixor(SetObject *sp, SetObject *other) {
             key2 = ep2->key;
             /* key not in sp */
             if (key2 == NULL || key2 == dummy) {
-                if ((ep2->key = sp->keydup(key)) == NULL)
+                if (set_entry_dup(sp, ep2, key) == -1)
                     return -1;
                 sp->used++;
                 ep2->hash = ep->hash;
+                FP_ADD(sp, ep->hash);
                 if (key2 == NULL)
                     sp->fill++;
             } else {            /*key is also in sp*/
-                sp->keyfree(key2);
+                ENTRY_FREE_KEY(sp, ep2);
                 ep2->key = dummy;
                 sp->used--;
+                FP_DEL(sp);
             }
         }
     }
@@ -746,7 +882,7 @@ set_rxor(SetObject *sp, SetObject *other) {
             key2 = ep2->key;
             /* key not in result */
             if (key2 == NULL || key2 == dummy) {
-                ep2->key = key;
+                ENTRY_SHARE(ep2, ep);
                 result->used++;
                 ep2->hash = ep->hash;
                 if (key2 == NULL)
@@ -760,17 +896,545 @@ set_rxor(SetObject *sp, SetObject *other) {
     return result;
 }
 
+/* free a set whose keys belong to other sets */
+static void
+set_rfree(SetObject *sp) {
+    if (sp->table != sp->smalltable)
+        Mem_AFREE(sp->allocator, sp->table);
+    Mem_AFREE(sp->allocator, sp);
+}
+
+/* a copy of sets[0:n] sorted by size, smallest first */
+static SetObject **
+sets_by_size(SetObject **sets, size_t n) {
+    size_t i, j;
+    SetObject *sp;
+    SetObject **sorted = Mem_NEW(SetObject *, n);
+    if (sorted == NULL)
+        return NULL;
+    /* n is a handful of sets, insertion sort will do */
+    for (i = 0; i < n; i++) {
+        sp = sets[i];
+        for (j = i; j > 0 && sorted[j - 1]->used > sp->used; j--)
+            sorted[j] = sorted[j - 1];
+        sorted[j] = sp;
+    }
+    return sorted;
+}
+
+static SetObject *
+set_and_many_intern(SetObject **sets, size_t n, int ref) {
+    assert(n > 0);
+    SetObject **sorted = sets_by_size(sets, n);
+    if (sorted == NULL)
+        return NULL;
+    SetObject *sml = sorted[0];
+    SetObject *result = SET_COPY_INIT(sml);
+    if (result == NULL) {
+        Mem_FREE(sorted);
+        return NULL;
+    }
+    size_t j, s_used = sml->used;
+    SetEntry *ep;
+    /*walk the smallest one, probe the others from small to big, so a
+    missing key is usually found out early*/
+    for (ep = sml->table; s_used > 0; ep++) {
+        if (ep->key && ep->key != dummy) {           /* key in sml */
+            s_used--;
+            for (j = 1; j < n; j++)
+                if (!set_has_intern(sorted[j], ep->key, ep->hash))
+                    break;
+            if (j < n)
+                continue;
+            /* there's no dummy key in result, so use this fast way */
+            if (ref)
+                set_insert_clean_entry(result, ep);
+            else if (set_insert_clean_dup(result, ep->key, ep->hash) == -1) {
+                set_free(result);
+                Mem_FREE(sorted);
+                return NULL;
+            }
+        }
+    }
+    Mem_FREE(sorted);
+    return result;
+}
+
+static SetObject *
+set_or_many_intern(SetObject **sets, size_t n, int ref) {
+    assert(n > 0);
+    size_t i, total = 0;
+    SetObject *big = sets[0];
+    for (i = 0; i < n; i++) {
+        if (sets[i]->used > big->used)
+            big = sets[i];
+        total += sets[i]->used;
+    }
+    /* choose the biggest one as the start set*/
+    SetObject *result = ref ? set_rcopy(big) : set_copy(big);
+    if (result == NULL)
+        return NULL;
+    total -= big->used;
+    if ((result->fill + total) * 3 >= (result->mask + 1) * 2) {
+        if (set_resize(result, (result->used + total) * 2) != 0) {
+            if (ref)
+                set_rfree(result);
+            else
+                set_free(result);
+            return NULL;
+        }
+    }
+    SetEntry *ep, *ep2;
+    void *key;
+    size_t used;
+    for (i = 0; i < n; i++) {
+        if (sets[i] == big)
+            continue;
+        used = sets[i]->used;
+        for (ep = sets[i]->table; used > 0; ep++) {
+            key = ep->key;
+            if (key && key != dummy) {
+                used--;
+                ep2 = set_search_nodummy(result, key, ep->hash);
+                if (ep2->key == NULL) {          /* key not in result*/
+                    if (ref)
+                        ENTRY_SHARE(ep2, ep);
+                    else if (set_entry_dup(result, ep2, key) == -1) {
+                        set_free(result);
+                        return NULL;
+                    }
+                    result->fill++;
+                    result->used++;
+                    ep2->hash = ep->hash;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+SetObject *
+set_and_many(SetObject **sets, size_t n) {
+    return set_and_many_intern(sets, n, 0);
+}
+
+SetObject *
+set_rand_many(SetObject **sets, size_t n) {
+    return set_and_many_intern(sets, n, 1);
+}
+
+SetObject *
+set_or_many(SetObject **sets, size_t n) {
+    return set_or_many_intern(sets, n, 0);
+}
+
+SetObject *
+set_ror_many(SetObject **sets, size_t n) {
+    return set_or_many_intern(sets, n, 1);
+}
+
+/* Hash-partitioned set algebra. Both sets' entries are copied into
+   buckets by the bits of hash & result->mask just below its top, so a
+   bucket pair is small enough to be matched in cache, and the result
+   keys of one bucket land in one region of the result table. Copying
+   into buckets and matching them run in parallel, on slices of the
+   tables and on whole buckets respectively. Inserting into the result
+   (and keydup) happens on the calling thread afterwards.
+*/
+
+/* aim for this many entries of the smaller set per bucket */
+#define PART_BUCKET 2048
+#define PART_MAXBITS 16
+
+enum { PART_AND, PART_OR, PART_SUB, PART_XOR };
+enum { PART_COUNT, PART_SCATTER, PART_MATCH };
+
+typedef struct {
+    SetObject *sp;
+    SetEntry *entries;
+    size_t *bounds;  /* bucket i is entries[bounds[i]:bounds[i + 1]] */
+    size_t *kept;  /* # entries kept at the start of bucket i */
+    size_t *hist;  /* per slice and bucket, counts and then fill positions */
+} SetPartition;
+
+typedef struct {
+    int op;
+    int phase;
+    SetPartition part[2];  /* the result prefers part[0]'s keys */
+    size_t mask;
+    int shift;
+    size_t nbuckets;
+    size_t nslices;  /* of each table */
+    size_t next;  /* next slice or bucket to be taken by a thread */
+    size_t maxbucket;  /* largest bucket of either side */
+    size_t tsize;  /* slots of part_match's table */
+    /* part_match's table and flags for thread id start at
+       scratch + id * scratchsize, taken up front from part[0]'s set's
+       allocator since that one need not be thread safe */
+    char *scratch;
+    size_t scratchsize;
+} PartJob;
+
+static int
+set_partition_init(SetPartition *part, SetObject *sp, size_t nbuckets,
+                   size_t nslices) {
+    Allocator *a = sp->allocator;
+    part->sp = sp;
+    part->entries = Mem_ANEW(a, SetEntry, sp->used);
+    part->bounds = Mem_ANEW(a, size_t, nbuckets + 1);
+    part->kept = Mem_ANEW(a, size_t, nbuckets);
+    part->hist = (size_t *)mem_calloc(a, nslices * nbuckets, sizeof(size_t));
+    if (part->entries == NULL || part->bounds == NULL || part->kept == NULL
+        || part->hist == NULL)
+        return -1;
+    return 0;
+}
+
+static void
+set_partition_free(SetPartition *part) {
+    Allocator *a;
+    /* never initialized */
+    if (part->sp == NULL)
+        return;
+    a = part->sp->allocator;
+    Mem_AFREE(a, part->entries);
+    Mem_AFREE(a, part->bounds);
+    Mem_AFREE(a, part->kept);
+    Mem_AFREE(a, part->hist);
+}
+
+/* turn the counts of every slice into the slices' fill positions */
+static void
+set_partition_bounds(SetPartition *part, size_t nbuckets, size_t nslices) {
+    size_t i, t, c, pos = 0;
+    for (i = 0; i < nbuckets; i++) {
+        part->bounds[i] = pos;
+        for (t = 0; t < nslices; t++) {
+            c = part->hist[t * nbuckets + i];
+            part->hist[t * nbuckets + i] = pos;
+            pos += c;
+        }
+    }
+    part->bounds[nbuckets] = pos;
+}
+
+/* count or copy the entries of slice t of part->sp's table */
+static void
+part_slice(PartJob *job, SetPartition *part, size_t t) {
+    size_t size = part->sp->mask + 1;
+    size_t lo = size / job->nslices * t;
+    size_t hi = t == job->nslices - 1 ? size : lo + size / job->nslices;
+    size_t *hist = part->hist + t * job->nbuckets;
+    SetEntry *ep = part->sp->table + lo, *end = part->sp->table + hi;
+    for (; ep < end; ep++) {
+        if (ep->key && ep->key != dummy) {
+            size_t bucket = (ep->hash & job->mask) >> job->shift;
+            if (job->phase == PART_COUNT)
+                hist[bucket]++;
+            else
+                part->entries[hist[bucket]++] = *ep;
+        }
+    }
+}
+
+/* keep the entries of e[0:n] whose flag equals @want at the front */
+static size_t
+part_compact(SetEntry *e, size_t n, char *flags, char want) {
+    size_t i, k = 0;
+    for (i = 0; i < n; i++)
+        if (flags[i] == want)
+            e[k++] = e[i];
+    return k;
+}
+
+static void
+part_match(PartJob *job, size_t id) {
+    size_t i, j, bucket, tsize = job->tsize, tmask, na, nb;
+    SetEntry *ea, *eb, *build, *probe;
+    char *fa, *fb, *fbuild, *fprobe;
+    size_t nbuild, nprobe, slot;
+    unsigned int *table;
+    SetPartition *pa = job->part, *pb = job->part + 1;
+    int (*keycmp)(void *key1, void *key2) = pa->sp->keycmp;
+    table = (unsigned int *)(job->scratch + id * job->scratchsize);
+    fa = (char *)(table + tsize);
+    fb = fa + job->maxbucket + 1;
+    while ((bucket = PARALLEL_NEXT(job->next)) < job->nbuckets) {
+        ea = pa->entries + pa->bounds[bucket];
+        na = pa->bounds[bucket + 1] - pa->bounds[bucket];
+        eb = pb->entries + pb->bounds[bucket];
+        nb = pb->bounds[bucket + 1] - pb->bounds[bucket];
+        memset(fa, 0, na);
+        memset(fb, 0, nb);
+        /* index the smaller side, probe with the other, flag both */
+        if (na <= nb) {
+            build = ea, nbuild = na, fbuild = fa;
+            probe = eb, nprobe = nb, fprobe = fb;
+        } else {
+            build = eb, nbuild = nb, fbuild = fb;
+            probe = ea, nprobe = na, fprobe = fa;
+        }
+        if (nbuild > 0) {
+            for (tsize = 8; tsize < nbuild * 2; tsize <<= 1)
+                ;
+            tmask = tsize - 1;
+            memset(table, 0, tsize * sizeof(unsigned int));
+            /* the bucket bits are the same for the whole bucket, so mix
+               the hash before taking table bits from it */
+            for (i = 0; i < nbuild; i++) {
+                slot = (build[i].hash * (size_t)0x9E3779B97F4A7C15ULL) & tmask;
+                while (table[slot])
+                    slot = (slot + 1) & tmask;
+                table[slot] = i + 1;
+            }
+            for (i = 0; i < nprobe; i++) {
+                slot = (probe[i].hash * (size_t)0x9E3779B97F4A7C15ULL) & tmask;
+                for (; (j = table[slot]) != 0; slot = (slot + 1) & tmask) {
+                    SetEntry *ep = build + j - 1;
+                    if (ep->hash == probe[i].hash
+                        && (ep->key == probe[i].key
+                            || keycmp(ep->key, probe[i].key) == 0)) {
+                        fbuild[j - 1] = 1;
+                        fprobe[i] = 1;
+                        break;
+                    }
+                }
+            }
+        }
+        switch (job->op) {
+        case PART_AND:
+            pa->kept[bucket] = part_compact(ea, na, fa, 1);
+            pb->kept[bucket] = 0;
+            break;
+        case PART_SUB:
+            pa->kept[bucket] = part_compact(ea, na, fa, 0);
+            pb->kept[bucket] = 0;
+            break;
+        case PART_OR:
+            pa->kept[bucket] = na;
+            pb->kept[bucket] = part_compact(eb, nb, fb, 0);
+            break;
+        case PART_XOR:
+            pa->kept[bucket] = part_compact(ea, na, fa, 0);
+            pb->kept[bucket] = part_compact(eb, nb, fb, 0);
+            break;
+        }
+    }
+}
+
+static void
+part_worker(void *arg, size_t id) {
+    PartJob *job = (PartJob *)arg;
+    size_t t;
+    if (job->phase == PART_MATCH) {
+        part_match(job, id);
+        return;
+    }
+    while ((t = PARALLEL_NEXT(job->next)) < 2 * job->nslices)
+        part_slice(job, job->part + t / job->nslices, t % job->nslices);
+}
+
+static void
+part_phase(PartJob *job, int phase, size_t nthreads) {
+    job->phase = phase;
+    job->next = 0;
+    parallel_run(nthreads, part_worker, job);
+}
+
+/* @a's callbacks are the result's, its keys are preferred over @b's */
+static SetObject *
+set_partition_op(int op, SetObject *a, SetObject *b, size_t nthreads,
+                 int ref) {
+    PartJob job;
+    SetObject *result;
+    size_t i, k, bucket, rsize, sml;
+    int pbits, rbits, failed = 0;
+    if (nthreads == 0)
+        nthreads = 1;
+    switch (op) {
+    case PART_AND:
+        rsize = SMALLER(a, b)->used;
+        break;
+    case PART_SUB:
+        rsize = a->used;
+        break;
+    default:
+        rsize = a->used + b->used;
+    }
+    /* keep the result at most 2/3 full, like NEED_RESIZE wants */
+    result = set_cnew(rsize + (rsize >> 1), a->keyhash, a->keycmp,
+                      a->keydup, a->keyfree);
+    if (result == NULL)
+        return NULL;
+    for (rbits = 0; ((size_t)1 << rbits) <= result->mask; rbits++)
+        ;
+    sml = SMALLER(a, b)->used;
+    for (pbits = 0; pbits < PART_MAXBITS && pbits < rbits
+         && (sml >> pbits) > PART_BUCKET; pbits++)
+        ;
+    memset(&job, 0, sizeof(job));
+    job.op = op;
+    job.mask = result->mask;
+    job.shift = rbits - pbits;
+    job.nbuckets = (size_t)1 << pbits;
+    job.nslices = nthreads;
+    if (set_partition_init(job.part, a, job.nbuckets, job.nslices) == -1
+        || set_partition_init(job.part + 1, b, job.nbuckets, job.nslices) == -1) {
+        failed = 1;
+        goto done;
+    }
+    part_phase(&job, PART_COUNT, nthreads);
+    for (k = 0; k < 2; k++)
+        set_partition_bounds(job.part + k, job.nbuckets, job.nslices);
+    part_phase(&job, PART_SCATTER, nthreads);
+    for (bucket = 0; bucket < job.nbuckets; bucket++) {
+        for (k = 0; k < 2; k++) {
+            size_t *bounds = job.part[k].bounds;
+            if (bounds[bucket + 1] - bounds[bucket] > job.maxbucket)
+                job.maxbucket = bounds[bucket + 1] - bounds[bucket];
+        }
+    }
+    for (job.tsize = 8; job.tsize < job.maxbucket * 2; job.tsize <<= 1)
+        ;
+    /* rounded up so every thread's table stays aligned */
+    job.scratchsize = job.tsize * sizeof(unsigned int)
+                      + 2 * (job.maxbucket + 1);
+    job.scratchsize = (job.scratchsize + sizeof(size_t) - 1)
+                      & ~(sizeof(size_t) - 1);
+    if (job.scratchsize > SSIZE_T_MAX / nthreads
+        || (job.scratch = (char *)Mem_AMALLOC(a->allocator,
+                              job.scratchsize * nthreads)) == NULL) {
+        failed = 1;
+        goto done;
+    }
+    part_phase(&job, PART_MATCH, nthreads);
+    /* bucket by bucket, so the insertions stay in one table region */
+    for (bucket = 0; bucket < job.nbuckets && !failed; bucket++) {
+        for (k = 0; k < 2 && !failed; k++) {
+            SetPartition *part = job.part + k;
+            SetEntry *e = part->entries + part->bounds[bucket];
+            for (i = 0; i < part->kept[bucket]; i++) {
+                if (ref)
+                    set_insert_clean_entry(result, e + i);
+                else if (set_insert_clean_dup(result, e[i].key, e[i].hash) == -1) {
+                    failed = 1;
+                    break;
+                }
+            }
+        }
+    }
+done:
+    Mem_AFREE(a->allocator, job.scratch);
+    set_partition_free(job.part);
+    set_partition_free(job.part + 1);
+    if (failed) {
+        /* only a keydup can fail after keys went in, so a reference
+           result is still empty here */
+        set_free(result);
+        return NULL;
+    }
+    return result;
+}
+
+SetObject *
+set_pand(SetObject *sp, SetObject *other, size_t nthreads) {
+    if (sp == other)
+        return set_copy(sp);
+    /* like set_and, the result takes the smaller set's keys */
+    return set_partition_op(PART_AND, SMALLER(sp, other), BIGGER(sp, other),
+                            nthreads, 0);
+}
+
+SetObject *
+set_por(SetObject *sp, SetObject *other, size_t nthreads) {
+    if (sp == other)
+        return set_copy(sp);
+    return set_partition_op(PART_OR, BIGGER(sp, other), SMALLER(sp, other),
+                            nthreads, 0);
+}
+
+SetObject *
+set_psub(SetObject *sp, SetObject *other, size_t nthreads) {
+    if (sp == other)
+        return SET_COPY_INIT_MIN(sp);
+    return set_partition_op(PART_SUB, sp, other, nthreads, 0);
+}
+
+SetObject *
+set_pxor(SetObject *sp, SetObject *other, size_t nthreads) {
+    if (sp == other)
+        return SET_COPY_INIT_MIN(sp);
+    return set_partition_op(PART_XOR, BIGGER(sp, other), SMALLER(sp, other),
+                            nthreads, 0);
+}
+
+SetObject *
+set_rpand(SetObject *sp, SetObject *other, size_t nthreads) {
+    if (sp == other)
+        return set_rcopy(sp);
+    return set_partition_op(PART_AND, SMALLER(sp, other), BIGGER(sp, other),
+                            nthreads, 1);
+}
+
+SetObject *
+set_rpor(SetObject *sp, SetObject *other, size_t nthreads) {
+    if (sp == other)
+        return set_rcopy(sp);
+    return set_partition_op(PART_OR, BIGGER(sp, other), SMALLER(sp, other),
+                            nthreads, 1);
+}
+
+SetObject *
+set_rpsub(SetObject *sp, SetObject *other, size_t nthreads) {
+    if (sp == other)
+        return SET_COPY_INIT_MIN(sp);
+    return set_partition_op(PART_SUB, sp, other, nthreads, 1);
+}
+
+SetObject *
+set_rpxor(SetObject *sp, SetObject *other, size_t nthreads) {
+    if (sp == other)
+        return SET_COPY_INIT_MIN(sp);
+    return set_partition_op(PART_XOR, BIGGER(sp, other), SMALLER(sp, other),
+                            nthreads, 1);
+}
+
 size_t
 set_has(SetObject *sp, void *key) {
     assert(key);
     return set_has_intern(sp, key, sp->keyhash(key));
 }
 
+void
+set_fingerprint(SetObject *sp, int on) {
+    SetEntry *ep;
+    size_t used = sp->used;
+    if (!on) {
+        sp->fpstate = SET_FP_OFF;
+        return;
+    }
+    sp->fingerprint = 0;
+    sp->fpstate = SET_FP_ON;
+    for (ep = sp->table; used > 0; ep++) {
+        if (ep->key && ep->key != dummy) {
+            used--;
+            sp->fingerprint |= FP_BIT(ep->hash);
+        }
+    }
+}
+
 /* is sp a subset of other? */
 size_t
 set_issubset(SetObject *sp, SetObject *other) {
     if (sp == other)
         return 1;
+    if (sp->used > other->used)
+        return 0;
+    /* a stale fingerprint may only stand for a superset of the keys, so
+       it can't tell that sp has a key other lacks */
+    if (sp->fpstate == SET_FP_ON && other->fpstate != SET_FP_OFF
+            && (sp->fingerprint & ~other->fingerprint))
+        return 0;
     SetEntry *ep;
     size_t used = sp->used;
     for (ep = sp->table; used > 0; ep++) {
@@ -786,20 +1450,141 @@ set_issubset(SetObject *sp, SetObject *other) {
 /* is sp a superset of other? */
 size_t
 set_issuperset(SetObject *sp, SetObject *other) {
+    return set_issubset(other, sp);
+}
+
+/* do sp and other share no key? stops at the first common key */
+size_t
+set_isdisjoint(SetObject *sp, SetObject *other) {
     if (sp == other)
+        return sp->used == 0;
+    if (sp->fpstate != SET_FP_OFF && other->fpstate != SET_FP_OFF
+            && (sp->fingerprint & other->fingerprint) == 0)
         return 1;
+    SetObject *big = BIGGER(sp, other);
+    SetObject *sml = SMALLER(sp, other);
+    size_t s_used = sml->used;
     SetEntry *ep;
-    size_t used = other->used;
-    for (ep = other->table; used > 0; ep++) {
-        if (ep->key  && ep->key != dummy) {
-            used--;
-            if (!set_has_intern(sp, ep->key, ep->hash))
+    for (ep = sml->table; s_used > 0; ep++) {
+        if (ep->key && ep->key != dummy) {
+            s_used--;
+            if (set_has_intern(big, ep->key, ep->hash))
                 return 0;
         }
     }
     return 1;
 }
 
+/* |sp & other|, nothing is allocated */
+size_t
+set_and_count(SetObject *sp, SetObject *other) {
+    if (sp == other)
+        return sp->used;
+    SetObject *big = BIGGER(sp, other);
+    SetObject *sml = SMALLER(sp, other);
+    size_t count = 0, s_used = sml->used;
+    SetEntry *ep;
+    for (ep = sml->table; s_used > 0; ep++) {
+        if (ep->key && ep->key != dummy) {
+            s_used--;
+            count += set_has_intern(big, ep->key, ep->hash);
+        }
+    }
+    return count;
+}
+
+size_t
+set_or_count(SetObject *sp, SetObject *other) {
+    return sp->used + other->used - set_and_count(sp, other);
+}
+
+size_t
+set_sub_count(SetObject *sp, SetObject *other) {
+    return sp->used - set_and_count(sp, other);
+}
+
+/* |sp & other| / |sp | other|, 1.0 for two empty sets */
+double
+set_jaccard(SetObject *sp, SetObject *other) {
+    size_t and_count = set_and_count(sp, other);
+    size_t or_count = sp->used + other->used - and_count;
+    return or_count ? (double)and_count / or_count : 1.0;
+}
+
+/*counts[i] = |sp & others[i]|. Every other set smaller than sp is walked
+on its own, all the bigger ones are probed in a single walk of sp.*/
+int
+set_and_count_batch(SetObject *sp, SetObject **others, size_t n,
+                    size_t *counts) {
+    size_t i, k = 0, used = sp->used;
+    SetEntry *ep;
+    size_t *bigger = Mem_NEW(size_t, n);
+    if (bigger == NULL)
+        return -1;
+    for (i = 0; i < n; i++) {
+        if (others[i] == sp || others[i]->used < sp->used) {
+            counts[i] = set_and_count(sp, others[i]);
+        } else {
+            counts[i] = 0;
+            bigger[k++] = i;
+        }
+    }
+    if (k > 0) {
+        for (ep = sp->table; used > 0; ep++) {
+            if (ep->key && ep->key != dummy) {
+                used--;
+                for (i = 0; i < k; i++)
+                    counts[bigger[i]] += set_has_intern(others[bigger[i]],
+                                                        ep->key, ep->hash);
+            }
+        }
+    }
+    Mem_FREE(bigger);
+    return 0;
+}
+
+int
+set_or_count_batch(SetObject *sp, SetObject **others, size_t n,
+                   size_t *counts) {
+    size_t i;
+    if (set_and_count_batch(sp, others, n, counts) == -1)
+        return -1;
+    for (i = 0; i < n; i++)
+        counts[i] = sp->used + others[i]->used - counts[i];
+    return 0;
+}
+
+int
+set_sub_count_batch(SetObject *sp, SetObject **others, size_t n,
+                    size_t *counts) {
+    size_t i;
+    if (set_and_count_batch(sp, others, n, counts) == -1)
+        return -1;
+    for (i = 0; i < n; i++)
+        counts[i] = sp->used - counts[i];
+    return 0;
+}
+
+int
+set_jaccard_batch(SetObject *sp, SetObject **others, size_t n,
+                  double *scores) {
+    size_t i, and_count, or_count;
+    size_t *counts = Mem_NEW(size_t, n);
+    if (counts == NULL)
+        return -1;
+    if (set_and_count_batch(sp, others, n, counts) == -1) {
+        Mem_FREE(counts);
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        and_count = counts[i];
+        or_count = sp->used + others[i]->used - and_count;
+        scores[i] = or_count ? (double)and_count / or_count : 1.0;
+    }
+    Mem_FREE(counts);
+    return 0;
+}
+
 int
 set_update(SetObject *sp, SetObject *other) {
     return set_ior(sp, other);
@@ -816,11 +1601,28 @@ set_iter_new(SetObject *sp) {
     sio = (IterObject*)malloc(sizeof(IterObject));
     if (sio == NULL)
         return NULL;
+    set_iter_init(sp, sio);
+    return sio;
+}
+
+void
+set_iter_init(SetObject *sp, IterObject *sio) {
     sio->object = (void*)sp;
     sio->inipos = (void*)sp->table;
     sio->rest = sp->used;
+    sio->endpos = (void*)(sp->table + sp->mask + 1);
+    sio->type = SET;
+}
+
+void
+set_iter_split(SetObject *sp, IterObject *sio, size_t k, size_t i) {
+    size_t slots = sp->mask + 1;
+    assert(k > 0 && i < k);
+    sio->object = (void*)sp;
+    sio->inipos = (void*)(sp->table + slots * i / k);
+    sio->rest = i == 0 && k == 1 ? sp->used : (size_t)-1;
+    sio->endpos = (void*)(sp->table + slots * (i + 1) / k);
     sio->type = SET;
-    return sio;
 }
 
 size_t
@@ -828,7 +1630,7 @@ set_iter_walk(IterObject *sio, void **key_addr) {
     SetEntry *ep;
     void *key;
     size_t rest = sio->rest;
-    for(ep = (SetEntry*)sio->inipos; rest > 0; ep++) {
+    for(ep = (SetEntry*)sio->inipos; rest > 0 && ep < (SetEntry*)sio->endpos; ep++) {
         key = ep->key;
         if ( key && key != dummy) {
             sio->rest--;
@@ -840,12 +1642,113 @@ set_iter_walk(IterObject *sio, void **key_addr) {
     return 0;
 }
 
+size_t
+set_iter_next_batch(IterObject *sio, void **keys, size_t n) {
+    SetEntry *ep = (SetEntry *)sio->inipos;
+    SetEntry *end = (SetEntry *)sio->endpos;
+    void *key;
+    size_t i = 0;
+    if (n > sio->rest)
+        n = sio->rest;
+    for (; i < n && ep < end; ep++) {
+        key = ep->key;
+        if (key && key != dummy)
+            keys[i++] = key;
+    }
+    sio->rest -= i;
+    sio->inipos = (void*)ep;
+    return i;
+}
+
+/* shared by set_parallel_for and set_parallel_reduce, accs is NULL for
+   the former */
+typedef struct {
+    SetObject *sp;
+    size_t nchunks;
+    size_t next;
+    void (*fn)(void *arg, void *key);
+    void *arg;
+    char *accs;  /* an accumulator of accsize bytes per chunk */
+    size_t accsize;
+    void (*init)(void *acc);
+} SetParallelJob;
+
+static void
+set_parallel_worker(void *_job, size_t id) {
+    SetParallelJob *job = (SetParallelJob *)_job;
+    IterObject it;
+    SetEntry *ep, *end;
+    void *arg, *key;
+    size_t chunk;
+    (void)id;
+    while ((chunk = PARALLEL_NEXT(job->next)) < job->nchunks) {
+        set_iter_split(job->sp, &it, job->nchunks, chunk);
+        arg = job->arg;
+        if (job->accs) {
+            arg = job->accs + chunk * job->accsize;
+            if (job->init)
+                job->init(arg);
+        }
+        end = (SetEntry *)it.endpos;
+        for (ep = (SetEntry *)it.inipos; ep < end; ep++) {
+            key = ep->key;
+            if (key && key != dummy)
+                job->fn(arg, key);
+        }
+    }
+}
+
+static void
+set_parallel_run(SetParallelJob *job, size_t nthreads) {
+    if (nthreads == 0)
+        nthreads = 1;
+    job->nchunks = nthreads == 1 ? 1 : nthreads * PARALLEL_CHUNKS;
+    if (job->nchunks > job->sp->mask + 1)
+        job->nchunks = job->sp->mask + 1;
+    job->next = 0;
+    parallel_run(nthreads, set_parallel_worker, job);
+}
+
+void
+set_parallel_for(SetObject *sp, size_t nthreads,
+                 void (*fn)(void *arg, void *key), void *arg) {
+    SetParallelJob job;
+    memset(&job, 0, sizeof(job));
+    job.sp = sp;
+    job.fn = fn;
+    job.arg = arg;
+    set_parallel_run(&job, nthreads);
+}
+
+int
+set_parallel_reduce(SetObject *sp, size_t nthreads, void *acc,
+                    size_t accsize, void (*init)(void *acc),
+                    void (*fn)(void *acc, void *key),
+                    void (*merge)(void *acc, void *other)) {
+    SetParallelJob job;
+    size_t i;
+    memset(&job, 0, sizeof(job));
+    job.sp = sp;
+    job.fn = fn;
+    job.accsize = accsize;
+    job.init = init;
+    /* the chunks of the largest possible split */
+    i = (nthreads ? nthreads : 1) * PARALLEL_CHUNKS;
+    if (accsize == 0 || i > SSIZE_T_MAX / accsize)
+        return -1;
+    job.accs = (char *)mem_calloc(sp->allocator, i, accsize);
+    if (job.accs == NULL)
+        return -1;
+    set_parallel_run(&job, nthreads);
+    for (i = 0; i < job.nchunks; i++)
+        merge(acc, job.accs + i * accsize);
+    Mem_AFREE(sp->allocator, job.accs);
+    return 0;
+}
+
 void
 set_iter_flush(IterObject *sio) {
-    SetObject *sp = (SetObject *)sio->object;
-    sio->inipos = (void*)sp->table;
-    sio->rest = sp->used;
-    sio->type = SET;
+    set_iter_init((SetObject *)sio->object, sio);
 }
 
 void
@@ -876,24 +1779,20 @@ set_print_intern(SetObject *sp) {
 void
 set_print(SetObject *sp) {
     void *key;
-    IterObject *sio = iter(sp);
     printf("{");
-    while(iterw(sio, &key)) {
+    SET_FOREACH(sp, key) {
         printf("'%s', ", (char*)key);
     }
-    free(sio);
     printf("}\n\n");
 }
 
 void
 set_print_int(SetObject *sp) {
     void *key;
-    IterObject *sio = iter(sp);
     printf("{");
-    while(iterw(sio, &key)) {
+    SET_FOREACH(sp, key) {
         printf("'%d', ", *(int*)key);
     }
-    free(sio);
     printf("}\n\n");
 }
 
@@ -903,14 +1802,79 @@ set_fromlist(ListObject *lp,
              int (*keycmp)(void *key1, void *key2),
              void * (*keydup)(void *key),
              void (*keyfree)(void *key)) {
-    SetObject *sp = set_cnew(lp->used, keyhash, keycmp, keydup, keyfree);
+    ListView view;
+    list_view(lp, 0, lp->used, 1, &view);
+    return set_fromview(&view, keyhash, keycmp, keydup, keyfree);
+}
+
+SetObject *
+set_fromview(ListView *view,
+             size_t (*keyhash)(void *key),
+             int (*keycmp)(void *key1, void *key2),
+             void * (*keydup)(void *key),
+             void (*keyfree)(void *key)) {
+    SetObject *sp = set_cnew(view->len, keyhash, keycmp, keydup, keyfree);
     if (sp == NULL)
         return NULL;
     void *key;
-    IterObject *lio = iter(lp);
-    while(iterw(lio, &key)) {
+    size_t pos = 0;
+    while(list_view_walk(view, &pos, &key)) {
         set_add(sp, key);
     }
-    free(lio);
     return sp;
 }
+
+BloomObject *
+set_to_bloom(SetObject *sp, double error_rate) {
+    SetEntry *ep;
+    size_t used = sp->used;
+    BloomObject *bf = bloom_new(used, error_rate, sp->keyhash);
+    if (bf == NULL)
+        return NULL;
+    for (ep = sp->table; used > 0; ep++) {
+        if (ep->key && ep->key != dummy) {
+            used--;
+            bloom_add_hash(bf, ep->hash);
+        }
+    }
+    return bf;
+}
+
+static void
+set_hll_add(SetObject *sp, HLLObject *hp) {
+    SetEntry *ep;
+    size_t used = sp->used;
+    for (ep = sp->table; used > 0; ep++) {
+        if (ep->key && ep->key != dummy) {
+            used--;
+            hll_add_hash(hp, ep->hash);
+        }
+    }
+}
+
+HLLObject *
+set_to_hll(SetObject *sp, uint32_t precision) {
+    HLLObject *hp = hll_new(precision, sp->keyhash);
+    if (hp == NULL)
+        return NULL;
+    set_hll_add(sp, hp);
+    return hp;
+}
+
+size_t
+set_estimate_len(SetObject **sets, size_t n, uint32_t precision) {
+    size_t i, len;
+    HLLObject *hp;
+    if (n == 0)
+        return 0;
+    if (n == 1)
+        return sets[0]->used;
+    hp = hll_new(precision, sets[0]->keyhash);
+    if (hp == NULL)
+        return (size_t)-1;
+    for (i = 0; i < n; i++)
+        set_hll_add(sets[i], hp);
+    len = hll_len(hp);
+    hll_free(hp);
+    return len;
+}
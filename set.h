@@ -17,8 +17,20 @@
 typedef struct {
     size_t hash;
     void *key;
+    INLINE_KEY_FIELDS
 } SetEntry;
 
+/* fills deleted entries, exported for SET_FOREACH */
+extern DummyStruct set_dummy_struct;
+#define SET_DUMMY (&set_dummy_struct)
+
+/* states of a set's fingerprint */
+typedef enum {
+    SET_FP_OFF,  /* not maintained */
+    SET_FP_ON,  /* exactly the bits of the keys */
+    SET_FP_STALE  /* may still have bits of deleted keys */
+} SetFingerprintState;
+
 typedef struct _setobject SetObject;
 struct _setobject {
     ObjectType type;
@@ -27,6 +39,9 @@ struct _setobject {
     size_t mask;
     SetEntry *table;
     SetEntry smalltable[HASH_MINSIZE];
+    Allocator *allocator;  /* of the struct and table */
+    uint64_t fingerprint;  /* a bit per key hash, see set_fingerprint */
+    int fpstate;  /* SetFingerprintState */
     size_t (*keyhash)(void *key);
     int (*keycmp)(void *key1, void *key2);
     void *(*keydup)(void *key);
@@ -40,6 +55,15 @@ set_cnew(size_t size,
          int (*keycmp)(void *key1, void *key2),
          void * (*keydup)(void *key),
          void (*keyfree)(void *key));
+/* the same, taking the struct and table from @a instead of the
+thread's container allocator, NULL for mem_allocator */
+SetObject *
+set_anew(Allocator *a,
+         size_t size,
+         size_t (*keyhash)(void *key),
+         int (*keycmp)(void *key1, void *key2),
+         void * (*keydup)(void *key),
+         void (*keyfree)(void *key));
 SetObject *set_new(void);
 void set_clear(SetObject *sp);
 void set_free(SetObject *sp);
@@ -48,7 +72,8 @@ size_t set_len(SetObject *sp);
 
 /* set level functions, basic operations between two sets.
 Note, for set_iand, set_isub and set_ixor,the two sets should never
-share any element i.e. the two keys have the same memory address */
+share any element i.e. the two keys have the same memory address,
+unless the keys are refcounted (see ref.h) */
 SetObject *set_or(SetObject *sp, SetObject *other);
 SetObject *set_and(SetObject *sp, SetObject *other);
 SetObject *set_sub(SetObject *sp, SetObject *other);
@@ -61,8 +86,48 @@ int set_ior(SetObject *sp, SetObject *other);
 int set_iand(SetObject *sp, SetObject *other);
 int set_isub(SetObject *sp, SetObject *other);
 int set_ixor(SetObject *sp, SetObject *other);
+
+/* intersection and union of sets[0:n] in one pass, n must be > 0. The
+intersection walks the smallest set and takes its keys and callbacks,
+the union starts from a copy of the biggest one. */
+SetObject *set_and_many(SetObject **sets, size_t n);
+SetObject *set_or_many(SetObject **sets, size_t n);
+SetObject *set_rand_many(SetObject **sets, size_t n);
+SetObject *set_ror_many(SetObject **sets, size_t n);
+
+/* sizes of the results of set_and, set_or and set_sub, and the Jaccard
+similarity of two sets, without building any result set. The batch
+versions compare @sp with each of others[0:n]. */
+size_t set_and_count(SetObject *sp, SetObject *other);
+size_t set_or_count(SetObject *sp, SetObject *other);
+size_t set_sub_count(SetObject *sp, SetObject *other);
+double set_jaccard(SetObject *sp, SetObject *other);
+int set_and_count_batch(SetObject *sp, SetObject **others, size_t n, size_t *counts);
+int set_or_count_batch(SetObject *sp, SetObject **others, size_t n, size_t *counts);
+int set_sub_count_batch(SetObject *sp, SetObject **others, size_t n, size_t *counts);
+int set_jaccard_batch(SetObject *sp, SetObject **others, size_t n, double *scores);
+
+/* the same operations for big sets, 'p' is short for 'partitioned'.
+Both sets are copied into cache-sized buckets by hash, which are matched
+on up to @nthreads threads. Costs sizeof(SetEntry) bytes per key of
+both sets while running. */
+SetObject *set_pand(SetObject *sp, SetObject *other, size_t nthreads);
+SetObject *set_por(SetObject *sp, SetObject *other, size_t nthreads);
+SetObject *set_psub(SetObject *sp, SetObject *other, size_t nthreads);
+SetObject *set_pxor(SetObject *sp, SetObject *other, size_t nthreads);
+SetObject *set_rpand(SetObject *sp, SetObject *other, size_t nthreads);
+SetObject *set_rpor(SetObject *sp, SetObject *other, size_t nthreads);
+SetObject *set_rpsub(SetObject *sp, SetObject *other, size_t nthreads);
+SetObject *set_rpxor(SetObject *sp, SetObject *other, size_t nthreads);
+
+/* Sizes and fingerprints are compared before any key is probed */
 size_t set_issuperset(SetObject *sp, SetObject *other);
-size_t set_subset(SetObject *sp, SetObject *other);
+size_t set_issubset(SetObject *sp, SetObject *other);
+size_t set_isdisjoint(SetObject *sp, SetObject *other);
+/* Keep a 64-bit OR of one bit per key hash, so subset and disjoint tests
+between two fingerprinted sets are mostly answered in O(1). Deleting
+makes it stale until the next table resize or set_fingerprint(sp, 1). */
+void set_fingerprint(SetObject *sp, int on);
 int set_update(SetObject *sp, SetObject *other); /*same as set_ior */
 SetObject *set_union(SetObject *sp, SetObject *other);/*same as set_or */
 
@@ -71,6 +136,9 @@ int set_add(SetObject *sp, void *key);
 size_t set_has(SetObject *sp, void *key);
 void set_del(SetObject *sp, void *key);
 void set_discard(SetObject *sp, void *key);
+/* remove an arbitrary key and return it, now owned by the caller. NULL
+if sp is empty. */
+void *set_pop(SetObject *sp);
 
 /*key level functions. 'r' prefix is short for 'reference'.
 Assign @key's address directly instead of its copy's.
@@ -80,9 +148,39 @@ int set_radd(SetObject *sp, void *key);
 
 /*traversal interfaces of SetObject*/
 IterObject *set_iter_new(SetObject *sp);
+/* the same on a caller owned iterator, e.g. one on the stack */
+void set_iter_init(SetObject *sp, IterObject *sio);
+/* set up @sio for the @i th of @k contiguous ranges of sp's slots, the
+iterators of i = 0..k-1 visit every key once between them */
+void set_iter_split(SetObject *sp, IterObject *sio, size_t k, size_t i);
 size_t set_iter_walk(IterObject *sio, void **key_addr);
+/* fill @keys with up to @n next keys, returns how many, 0 at the end */
+size_t set_iter_next_batch(IterObject *sio, void **keys, size_t n);
 void set_iter_flush(IterObject *sio);
 
+/* Run the statement after it for each key of @sp, assigned to @_k
+(a void *). It scans the table itself, no IterObject nor call per key.
+break and continue work as in a for loop. @sp mustn't be resized
+meanwhile. */
+#define SET_FOREACH(sp, _k) \
+    for (SetEntry *_sfe_ep = (sp)->table, \
+         *_sfe_end = _sfe_ep + (sp)->mask + 1; \
+         _sfe_ep < _sfe_end; _sfe_ep++) \
+        if (((_k) = _sfe_ep->key) == NULL || (_k) == SET_DUMMY) \
+            ; \
+        else
+
+/*parallel traversal, the same as dict_parallel_for and
+dict_parallel_reduce with keys only*/
+void
+set_parallel_for(SetObject *sp, size_t nthreads,
+                 void (*fn)(void *arg, void *key), void *arg);
+int
+set_parallel_reduce(SetObject *sp, size_t nthreads, void *acc,
+                    size_t accsize, void (*init)(void *acc),
+                    void (*fn)(void *acc, void *key),
+                    void (*merge)(void *acc, void *other));
+
 /*other functions for printing or testing*/
 void set_print(SetObject *sp);
 void set_print_int(SetObject *sp);
@@ -95,3 +193,9 @@ set_fromlist(ListObject *lp,
              int (*keycmp)(void *key1, void *key2),
              void * (*keydup)(void *key),
              void (*keyfree)(void *key));
+SetObject *
+set_fromview(ListView *view,
+             size_t (*keyhash)(void *key),
+             int (*keycmp)(void *key1, void *key2),
+             void * (*keydup)(void *key),
+             void (*keyfree)(void *key));
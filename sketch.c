@@ -0,0 +1,332 @@
+#include <math.h>
+#include "xlib.h"
+
+#define BLOOM_BLOCK_BITS (BLOOM_BLOCK_WORDS * 64)
+#define BLOOM_MAX_K 16
+
+static size_t
+default_keyhash(void *_key) {
+    char *key = (char *)_key;
+    size_t hash = 5381;
+    for (; *key; key++)
+        hash = ((hash << 5) + hash) + *key; /* hash * 33 + c */
+    return hash;
+}
+
+/* keyhash only has to spread keys over a table's low bits, sketches want
+   all 64 bits to look random (splitmix64's finalizer) */
+static uint64_t
+hash_mix(uint64_t h) {
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+/* dumps are little endian whatever the host is */
+static unsigned char *
+put64(unsigned char *p, uint64_t v) {
+    int i;
+    for (i = 0; i < 8; i++)
+        *p++ = (unsigned char)(v >> (8 * i));
+    return p;
+}
+
+static const unsigned char *
+get64(const unsigned char *p, uint64_t *v) {
+    int i;
+    *v = 0;
+    for (i = 0; i < 8; i++)
+        *v |= (uint64_t)*p++ << (8 * i);
+    return p;
+}
+
+static BloomObject *
+bloom_alloc(size_t nblocks, uint32_t k, size_t (*keyhash)(void *key)) {
+    BloomObject *bf;
+    if (nblocks > SSIZE_T_MAX / (BLOOM_BLOCK_WORDS * sizeof(uint64_t)))
+        return NULL;
+    bf = Mem_NEW(BloomObject, 1);
+    if (bf == NULL)
+        return NULL;
+    bf->blocks = Mem_NEW(uint64_t, nblocks * BLOOM_BLOCK_WORDS);
+    if (bf->blocks == NULL) {
+        Mem_FREE(bf);
+        return NULL;
+    }
+    bf->nblocks = nblocks;
+    bf->k = k;
+    bf->keyhash = keyhash ? keyhash : default_keyhash;
+    bloom_clear(bf);
+    return bf;
+}
+
+BloomObject *
+bloom_new(size_t capacity, double error_rate, size_t (*keyhash)(void *key)) {
+    double bits;
+    size_t nblocks;
+    uint32_t k;
+    assert(error_rate > 0 && error_rate < 1);
+    if (capacity == 0)
+        capacity = 1;
+    /* the optimal m = -n ln(p) / ln(2)^2 and k = m / n ln(2) */
+    bits = -(double)capacity * log(error_rate) / (M_LN2 * M_LN2);
+    k = (uint32_t)(bits / capacity * M_LN2 + 0.5);
+    if (k < 1)
+        k = 1;
+    if (k > BLOOM_MAX_K)
+        k = BLOOM_MAX_K;
+    if (bits / BLOOM_BLOCK_BITS >= (double)(SSIZE_T_MAX / 2))
+        return NULL;
+    for (nblocks = 1; nblocks * BLOOM_BLOCK_BITS < bits; nblocks <<= 1)
+        ;
+    return bloom_alloc(nblocks, k, keyhash);
+}
+
+void
+bloom_clear(BloomObject *bf) {
+    memset(bf->blocks, 0, bf->nblocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+    bf->used = 0;
+}
+
+void
+bloom_free(BloomObject *bf) {
+    Mem_FREE(bf->blocks);
+    Mem_FREE(bf);
+}
+
+BloomObject *
+bloom_copy(BloomObject *bf) {
+    BloomObject *copy = bloom_alloc(bf->nblocks, bf->k, bf->keyhash);
+    if (copy == NULL)
+        return NULL;
+    memcpy(copy->blocks, bf->blocks,
+           bf->nblocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+    copy->used = bf->used;
+    return copy;
+}
+
+/* the block of @hash, and in it k bits by double hashing */
+#define BLOOM_PROBE(bf, hash, block, g1, g2) do {\
+    uint64_t h = hash_mix((uint64_t)(hash));\
+    (block) = (bf)->blocks + (h & ((bf)->nblocks - 1)) * BLOOM_BLOCK_WORDS;\
+    h = hash_mix(h);\
+    (g1) = (uint32_t)h;\
+    (g2) = (uint32_t)(h >> 32) | 1;\
+    } while(0)
+
+void
+bloom_add_hash(BloomObject *bf, size_t hash) {
+    uint64_t *block;
+    uint32_t i, g1, g2, bit;
+    BLOOM_PROBE(bf, hash, block, g1, g2);
+    for (i = 0; i < bf->k; i++, g1 += g2) {
+        bit = g1 % BLOOM_BLOCK_BITS;
+        block[bit >> 6] |= (uint64_t)1 << (bit & 63);
+    }
+    bf->used++;
+}
+
+int
+bloom_has_hash(BloomObject *bf, size_t hash) {
+    uint64_t *block;
+    uint32_t i, g1, g2, bit;
+    BLOOM_PROBE(bf, hash, block, g1, g2);
+    for (i = 0; i < bf->k; i++, g1 += g2) {
+        bit = g1 % BLOOM_BLOCK_BITS;
+        if (!(block[bit >> 6] >> (bit & 63) & 1))
+            return 0;
+    }
+    return 1;
+}
+
+void
+bloom_add(BloomObject *bf, void *key) {
+    assert(key);
+    bloom_add_hash(bf, bf->keyhash(key));
+}
+
+int
+bloom_has(BloomObject *bf, void *key) {
+    assert(key);
+    return bloom_has_hash(bf, bf->keyhash(key));
+}
+
+int
+bloom_merge(BloomObject *bf, BloomObject *other) {
+    size_t i, n = bf->nblocks * BLOOM_BLOCK_WORDS;
+    if (bf->nblocks != other->nblocks || bf->k != other->k)
+        return -1;
+    for (i = 0; i < n; i++)
+        bf->blocks[i] |= other->blocks[i];
+    bf->used += other->used;
+    return 0;
+}
+
+/* "XBLM", k, used, nblocks, then the words */
+void *
+bloom_dumps(BloomObject *bf, size_t *size) {
+    size_t i, n = bf->nblocks * BLOOM_BLOCK_WORDS;
+    unsigned char *buf, *p;
+    if (n > (SSIZE_T_MAX - 32) / 8)
+        return NULL;
+    *size = 4 + 8 * 3 + n * 8;
+    buf = Mem_NEW(unsigned char, *size);
+    if (buf == NULL)
+        return NULL;
+    memcpy(buf, "XBLM", 4);
+    p = put64(buf + 4, bf->k);
+    p = put64(p, bf->used);
+    p = put64(p, bf->nblocks);
+    for (i = 0; i < n; i++)
+        p = put64(p, bf->blocks[i]);
+    return buf;
+}
+
+BloomObject *
+bloom_loads(const void *buf, size_t size, size_t (*keyhash)(void *key)) {
+    const unsigned char *p = (const unsigned char *)buf;
+    uint64_t k, used, nblocks;
+    size_t i;
+    BloomObject *bf;
+    if (size < 4 + 8 * 3 || memcmp(p, "XBLM", 4) != 0)
+        return NULL;
+    p = get64(p + 4, &k);
+    p = get64(p, &used);
+    p = get64(p, &nblocks);
+    if (k < 1 || k > BLOOM_MAX_K || nblocks == 0 || (nblocks & (nblocks - 1))
+        || nblocks > (size - 4 - 8 * 3) / (8 * BLOOM_BLOCK_WORDS)
+        || size != 4 + 8 * 3 + nblocks * 8 * BLOOM_BLOCK_WORDS)
+        return NULL;
+    bf = bloom_alloc((size_t)nblocks, (uint32_t)k, keyhash);
+    if (bf == NULL)
+        return NULL;
+    for (i = 0; i < bf->nblocks * BLOOM_BLOCK_WORDS; i++)
+        p = get64(p, bf->blocks + i);
+    bf->used = (size_t)used;
+    return bf;
+}
+
+HLLObject *
+hll_new(uint32_t precision, size_t (*keyhash)(void *key)) {
+    HLLObject *hp;
+    assert(precision >= HLL_MIN_PRECISION && precision <= HLL_MAX_PRECISION);
+    hp = Mem_NEW(HLLObject, 1);
+    if (hp == NULL)
+        return NULL;
+    hp->registers = Mem_NEW(uint8_t, (size_t)1 << precision);
+    if (hp->registers == NULL) {
+        Mem_FREE(hp);
+        return NULL;
+    }
+    hp->precision = precision;
+    hp->keyhash = keyhash ? keyhash : default_keyhash;
+    hll_clear(hp);
+    return hp;
+}
+
+void
+hll_clear(HLLObject *hp) {
+    memset(hp->registers, 0, (size_t)1 << hp->precision);
+}
+
+void
+hll_free(HLLObject *hp) {
+    Mem_FREE(hp->registers);
+    Mem_FREE(hp);
+}
+
+HLLObject *
+hll_copy(HLLObject *hp) {
+    HLLObject *copy = hll_new(hp->precision, hp->keyhash);
+    if (copy == NULL)
+        return NULL;
+    memcpy(copy->registers, hp->registers, (size_t)1 << hp->precision);
+    return copy;
+}
+
+void
+hll_add_hash(HLLObject *hp, size_t hash) {
+    uint64_t h = hash_mix((uint64_t)hash);
+    size_t i = (size_t)(h >> (64 - hp->precision));
+    /* the sentinel bit bounds the rank to 64 - precision + 1 */
+    uint64_t w = h << hp->precision | (uint64_t)1 << (hp->precision - 1);
+    uint8_t rank = (uint8_t)(__builtin_clzll(w) + 1);
+    if (rank > hp->registers[i])
+        hp->registers[i] = rank;
+}
+
+void
+hll_add(HLLObject *hp, void *key) {
+    assert(key);
+    hll_add_hash(hp, hp->keyhash(key));
+}
+
+size_t
+hll_len(HLLObject *hp) {
+    size_t i, zeros = 0, m = (size_t)1 << hp->precision;
+    double alpha, e, sum = 0.0;
+    for (i = 0; i < m; i++) {
+        sum += 1.0 / (double)((uint64_t)1 << hp->registers[i]);
+        zeros += hp->registers[i] == 0;
+    }
+    alpha = m == 16 ? 0.673 : m == 32 ? 0.697 : m == 64 ? 0.709 :
+            0.7213 / (1.0 + 1.079 / m);
+    e = alpha * m * m / sum;
+    /* few keys leave empty registers, linear counting is better there */
+    if (e <= 2.5 * m && zeros)
+        e = m * log((double)m / zeros);
+    return (size_t)(e + 0.5);
+}
+
+int
+hll_merge(HLLObject *hp, HLLObject *other) {
+    size_t i, m = (size_t)1 << hp->precision;
+    if (hp->precision != other->precision)
+        return -1;
+    for (i = 0; i < m; i++)
+        if (other->registers[i] > hp->registers[i])
+            hp->registers[i] = other->registers[i];
+    return 0;
+}
+
+/* "XHLL", precision, then the registers */
+void *
+hll_dumps(HLLObject *hp, size_t *size) {
+    size_t m = (size_t)1 << hp->precision;
+    unsigned char *buf;
+    *size = 4 + 8 + m;
+    buf = Mem_NEW(unsigned char, *size);
+    if (buf == NULL)
+        return NULL;
+    memcpy(buf, "XHLL", 4);
+    put64(buf + 4, hp->precision);
+    memcpy(buf + 12, hp->registers, m);
+    return buf;
+}
+
+HLLObject *
+hll_loads(const void *buf, size_t size, size_t (*keyhash)(void *key)) {
+    const unsigned char *p = (const unsigned char *)buf;
+    uint64_t precision;
+    size_t i, m;
+    HLLObject *hp;
+    if (size < 4 + 8 || memcmp(p, "XHLL", 4) != 0)
+        return NULL;
+    get64(p + 4, &precision);
+    if (precision < HLL_MIN_PRECISION || precision > HLL_MAX_PRECISION)
+        return NULL;
+    m = (size_t)1 << precision;
+    if (size != 4 + 8 + m)
+        return NULL;
+    for (i = 0; i < m; i++)
+        if (p[12 + i] > 64 - precision + 1)
+            return NULL;
+    hp = hll_new((uint32_t)precision, keyhash);
+    if (hp == NULL)
+        return NULL;
+    memcpy(hp->registers, p + 12, m);
+    return hp;
+}
@@ -0,0 +1,62 @@
+/* # 64-bit words of a bloom filter block, one cache line */
+#define BLOOM_BLOCK_WORDS 8
+#define HLL_MIN_PRECISION 4
+#define HLL_MAX_PRECISION 18
+
+/* Blocked bloom filter. All the bits of a key are in one cache line, so
+a lookup costs a single miss. bloom_has never misses a key that was
+added, and is wrong about other keys with about the error rate given. */
+typedef struct {
+    size_t nblocks;  /* a power of 2 */
+    size_t used;  /* # keys added */
+    uint32_t k;  /* # bits per key */
+    uint64_t *blocks;  /* nblocks * BLOOM_BLOCK_WORDS words */
+    size_t (*keyhash)(void *key);
+} BloomObject;
+
+/* HyperLogLog distinct counter, 2^precision one byte registers with a
+standard error of about 1.04 / sqrt(2^precision). */
+typedef struct {
+    uint32_t precision;
+    uint8_t *registers;
+    size_t (*keyhash)(void *key);
+} HLLObject;
+
+/* @keyhash is the one of the sets the sketches stand for, NULL means
+set_new's string hash */
+BloomObject *
+bloom_new(size_t capacity, double error_rate, size_t (*keyhash)(void *key));
+void bloom_clear(BloomObject *bf);
+void bloom_free(BloomObject *bf);
+BloomObject *bloom_copy(BloomObject *bf);
+void bloom_add(BloomObject *bf, void *key);
+int bloom_has(BloomObject *bf, void *key);
+/* the same with a hash made by keyhash, e.g. SetEntry.hash */
+void bloom_add_hash(BloomObject *bf, size_t hash);
+int bloom_has_hash(BloomObject *bf, size_t hash);
+/* union, both filters must come from the same bloom_new arguments */
+int bloom_merge(BloomObject *bf, BloomObject *other);
+/* a malloc'ed portable image of @bf, *size is set to its length */
+void *bloom_dumps(BloomObject *bf, size_t *size);
+BloomObject *bloom_loads(const void *buf, size_t size, size_t (*keyhash)(void *key));
+
+HLLObject *hll_new(uint32_t precision, size_t (*keyhash)(void *key));
+void hll_clear(HLLObject *hp);
+void hll_free(HLLObject *hp);
+HLLObject *hll_copy(HLLObject *hp);
+void hll_add(HLLObject *hp, void *key);
+void hll_add_hash(HLLObject *hp, size_t hash);
+/* estimated # distinct keys added */
+size_t hll_len(HLLObject *hp);
+/* union, both must have the same precision */
+int hll_merge(HLLObject *hp, HLLObject *other);
+void *hll_dumps(HLLObject *hp, size_t *size);
+HLLObject *hll_loads(const void *buf, size_t size, size_t (*keyhash)(void *key));
+
+/*communicate with set.c, the sets' cached hashes are used, no key is
+hashed again */
+BloomObject *set_to_bloom(SetObject *sp, double error_rate);
+HLLObject *set_to_hll(SetObject *sp, uint32_t precision);
+/* estimated # distinct keys of the union of @sets, (size_t)-1 if out
+of memory */
+size_t set_estimate_len(SetObject **sets, size_t n, uint32_t precision);
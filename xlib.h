@@ -2,6 +2,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
 #include <assert.h>
 
 #ifndef X_DEBUG
@@ -22,18 +24,64 @@
    pymalloc. To solve these problems, allocate an extra byte. */
 /* Returns NULL to indicate error if a negative size or size larger than
    _ssize_t can represent is supplied.  Helps prevents security holes. */
-#define Mem_MALLOC(n) ((size_t)(n) > (size_t)SSIZE_T_MAX ?\
-                          NULL : malloc((n) ? (n) : 1))
-
-#define Mem_REALLOC(p, n) ((size_t)(n) > (size_t)SSIZE_T_MAX ?\
-                           NULL : realloc((p), (n) ? (n) : 1))
-#define Mem_FREE free
-
-#define Mem_NEW(type, n) (((size_t)(n) > SSIZE_T_MAX / sizeof(type)) ? \
-                          NULL : ((type*)Mem_MALLOC((n) * sizeof(type))))
-
-#define Mem_RESIZE(p, type, n) ((p) = ((size_t)(n) > SSIZE_T_MAX / sizeof(type)) ? \
-                                       NULL : (type*) Mem_REALLOC((p), (n) * sizeof(type)))
+/* The Mem_A* macros take memory from the Allocator @a (see alloc.h),
+   the others from mem_allocator. */
+#define Mem_AMALLOC(a, n) ((size_t)(n) > (size_t)SSIZE_T_MAX ?\
+                           NULL : (a)->alloc((a)->ctx,\
+                                             (size_t)(n) == 0 ? 1 : (size_t)(n)))
+
+#define Mem_AREALLOC(a, p, n) ((size_t)(n) > (size_t)SSIZE_T_MAX ?\
+                               NULL : (a)->realloc((a)->ctx, (p),\
+                                                   (size_t)(n) == 0 ? 1 : (size_t)(n)))
+#define Mem_AFREE(a, p) ((a)->free((a)->ctx, (p)))
+
+#define Mem_ANEW(a, type, n) (((size_t)(n) > SSIZE_T_MAX / sizeof(type)) ? \
+                              NULL : ((type*)Mem_AMALLOC(a, (n) * sizeof(type))))
+
+#define Mem_ARESIZE(a, p, type, n) ((p) = ((size_t)(n) > SSIZE_T_MAX / sizeof(type)) ? \
+                                    NULL : (type*) Mem_AREALLOC(a, (p), (n) * sizeof(type)))
+
+#define Mem_MALLOC(n) Mem_AMALLOC(mem_allocator, n)
+#define Mem_REALLOC(p, n) Mem_AREALLOC(mem_allocator, p, n)
+#define Mem_FREE(p) Mem_AFREE(mem_allocator, p)
+#define Mem_NEW(type, n) Mem_ANEW(mem_allocator, type, n)
+#define Mem_RESIZE(p, type, n) Mem_ARESIZE(mem_allocator, p, type, n)
+
+/* Build with -DX_INLINE_KEYS to keep string keys shorter than
+   INLINE_KEY_SIZE in dict and set entries themselves, with ep->key
+   pointing there. Comparing such a key while probing touches no other
+   cache line, and it takes no malloc block. Only containers with the
+   default (string) keydup store keys inline. Keys handed out by their
+   iterators then live in the table, until it's resized or freed. */
+#ifdef X_INLINE_KEYS
+#define INLINE_KEY_SIZE 15
+#define INLINE_KEY_FIELDS \
+    char inl[INLINE_KEY_SIZE];  /* the key itself, if isinline */\
+    unsigned char isinline;
+/* ep takes @key's address, it owns no inline copy */
+#define ENTRY_SET_REF(ep, k) do {\
+    (ep)->key = (k);\
+    (ep)->isinline = 0;\
+    } while(0)
+/* ep takes src's key, by copying it if it is inline */
+#define ENTRY_SHARE(ep, src) do {\
+    if ((src)->isinline) {\
+        memcpy((ep)->inl, (src)->inl, INLINE_KEY_SIZE);\
+        (ep)->key = (ep)->inl;\
+        (ep)->isinline = 1;\
+    } else\
+        ENTRY_SET_REF(ep, (src)->key);\
+    } while(0)
+#define ENTRY_FREE_KEY(op, ep) do {\
+    if (!(ep)->isinline)\
+        (op)->keyfree((ep)->key);\
+    } while(0)
+#else
+#define INLINE_KEY_FIELDS
+#define ENTRY_SET_REF(ep, k) ((ep)->key = (k))
+#define ENTRY_SHARE(ep, src) ((ep)->key = (src)->key)
+#define ENTRY_FREE_KEY(op, ep) ((op)->keyfree((ep)->key))
+#endif
 
 #define PERTURB_SHIFT 5
 
@@ -64,6 +112,12 @@
                             (iop)->type == SET ? set_iter_walk(iop, keyaddr):\
                             0)
 
+/* set up a caller owned IterObject, no malloc */
+#define iteri(op,iop) ((op)->type == LIST ? list_iter_init((void*)(op), iop):\
+                       (op)->type == DICT ? dict_iter_init((void*)(op), iop):\
+                       (op)->type == SET ? set_iter_init((void*)(op), iop):\
+                       (void)0)
+
 #define iterf(iop) ((iop)->type == LIST ? list_iter_flush(iop):\
                     (iop)->type == DICT ? dict_iter_flush(iop):\
                     (iop)->type == SET ? set_iter_flush(iop):\
@@ -79,10 +133,18 @@ typedef struct {
     ObjectType type;
     void *object;
     void *inipos;
-    size_t rest;
+    size_t rest;  /* # keys left, (size_t)-1 if not known */
+    void *endpos;  /* past the last slot to visit */
 } IterObject;
 
+#include "alloc.h"
+#include "parallel.h"
+#include "ref.h"
+#include "intern.h"
 #include "dict.h"
 #include "rbtree.h"
 #include "list.h"
+#include "clist.h"
 #include "set.h"
+#include "bitmap.h"
+#include "sketch.h"